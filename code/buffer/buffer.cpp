@@ -1,7 +1,12 @@
 #include "buffer.h"
+#include <algorithm>  // std::max
 
 // 构造函数，初始化缓冲区大小、读写指针
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+Buffer::Buffer(int initBuffSize) : buffer_(BufferPool::Alloc(initBuffSize)), readPos_(0), writePos_(0) {}
+
+Buffer::~Buffer() {
+    BufferPool::Free(buffer_);
+}
 
 // 返回缓冲区中可读数据的长度
 size_t Buffer::ReadableBytes() const {
@@ -27,6 +32,18 @@ const char* Buffer::Peek() const {
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes()); // 确保回收的长度不超过 可读数据长度
     readPos_ += len;
+    // 读空了就回到开头，后面的写入不用再整理缓冲区
+    if(readPos_ == writePos_) {
+        RetrieveAll();
+    }
+}
+
+void Buffer::Erase(size_t offset, size_t len) {
+    assert(offset + len <= ReadableBytes());
+    if(len == 0) { return; }
+    char* begin = BeginPtr_() + readPos_ + offset;
+    memmove(begin, begin + len, ReadableBytes() - offset - len);
+    writePos_ -= len;
 }
 
 // 回收数据直到指定的end指针位置
@@ -35,18 +52,30 @@ void Buffer::RetrieveUntil(const char* end) {
     Retrieve(end - Peek());
 }
 
-// 清空缓冲区，重置读写指针，并清零缓冲区
+// 清空缓冲区，只重置读写指针。旧数据留在原处，之后总是按读写指针访问，不需要清零
 void Buffer::RetrieveAll() {
-    // bzero(void *s, size_t n);
-    // void *s：指向要置零的内存区域的起始地址。
-    // size_t n：指定了要置零的字节数。
-    bzero(&buffer_[0], buffer_.size());
-    // 读取位置
     readPos_ = 0;
-    // 写的位置
     writePos_ = 0;
 }
 
+// 没有待读的数据时归还存储，下次写入时再从缓冲池取
+void Buffer::ReleaseSpace() {
+    if(ReadableBytes() == 0) {
+        RetrieveAll();
+        BufferPool::Free(buffer_);
+    }
+}
+
+// 存储连同可读数据整块交出去，不拷贝
+BufferStorage Buffer::TakeStorage(size_t* readPos, size_t* len) {
+    *readPos = readPos_;
+    *len = ReadableBytes();
+    BufferStorage storage;
+    storage.swap(buffer_);
+    RetrieveAll();
+    return storage;
+}
+
 // 清空缓冲区，并返回之前缓冲区中的所有数据转换成的字符串
 std::string Buffer::RetrieveAllToStr() {
     // 构造函数std::string(const char* s, size_t n)接受两个参数：
@@ -113,34 +142,31 @@ void Buffer::EnsureWriteable(size_t len) {
 }
 
 // 从文件描述符读取数据到缓冲区,向 缓冲区buffer中写数据，读fd。
-ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    char buff[65535]; // 临时缓冲区
-
-    // 分两个区域进行分散读，避免多次进行read，减少了系统调用的开销和上下文切换的成本。
-    
-    struct iovec iov[2];
-    const size_t writable = WritableBytes();
-    
-    iov[0].iov_base = BeginPtr_() + writePos_; // 第一部分直接写入缓冲区可写位置
-    iov[0].iov_len = writable; // 可写的长度
-
-    iov[1].iov_base = buff; // 第二部分写入临时缓冲区
-    iov[1].iov_len = sizeof(buff);
-
-    // 通过一次系统调用readv完成的
-    // 告诉内核从fd读取数据，首先填充到Buffer的可写空间，
-    // 如果第一个缓冲区填满，剩余的数据会继续填充到临时缓冲区buff中。
-    const ssize_t len = readv(fd, iov, 2); // 使用readv进行分散读
-
+// 可写空间不够时按hint从缓冲池取，数据直接读进缓冲区，不经过临时数组再拷贝一次。
+// 读满了可写空间时fd里可能还有数据，由调用者决定是否接着读(ET模式会一直读到EAGAIN)
+ssize_t Buffer::ReadFd(int fd, int* saveErrno, size_t hint) {
+    if(WritableBytes() == 0 && ReadableBytes() > 0) {
+        // 上一次刚好读满: 先读进栈上的小数组探一下，fd里已经没有数据时就不必为此扩容
+        char extra[4096];
+        const ssize_t len = read(fd, extra, sizeof(extra));
+        if(len < 0) {
+            *saveErrno = errno;
+        }
+        else {
+            Append(extra, len);
+        }
+        return len;
+    }
+    // 剩余空间还有hint的一半以上就直接读进去，否则按hint扩容
+    if(WritableBytes() < hint / 2) {
+        EnsureWriteable(hint);
+    }
+    const ssize_t len = read(fd, BeginWrite(), WritableBytes());
     if(len < 0) {
         *saveErrno = errno; // 读取失败，保存错误码
     }
-    else if(static_cast<size_t>(len) <= writable) {
-        writePos_ += len; // 全部数据都写入了缓冲区
-    }
     else {
-        writePos_ = buffer_.size();
-        Append(buff, len - writable); // 将临时缓冲区的数据追加到缓冲区
+        writePos_ += len;
     }
     return len;
 }
@@ -164,20 +190,27 @@ ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
 
 // 返回缓冲区开始的指针
 char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+    return buffer_.data();
 }
 
 // 返回缓冲区开始的const指针
 const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+    return buffer_.data();
 }
 
 // 当可写空间不足时，调整缓冲区大小或整理缓冲区以腾出空间
 void Buffer::MakeSpace_(size_t len) {
-    // 如果当前的 可写的长度 + 前面已经回收的长度，还是小于需要的长度的len话，就重新调整vector<char>的长度。
+    // 如果当前的 可写的长度 + 前面已经回收的长度，还是小于需要的长度的len话，就从缓冲池换一块更大的存储。
     if(WritableBytes() + PrependableBytes() < len + 1) {
-        // resize方法调整vector的大小以使其能够容纳n个元素
-        buffer_.resize(writePos_ + len + 1); // 直接扩展缓冲区大小
+        size_t readable = ReadableBytes(); // 当前可读数据长度
+        // 至少翻倍，超过最大档后按实际大小分配时也不会每次追加都拷贝一遍
+        BufferStorage buff = BufferPool::Alloc(std::max(readable + len, buffer_.size() * 2));
+        // 可读数据拷到新存储的开头，旧存储还给缓冲池
+        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, buff.data());
+        BufferPool::Free(buffer_);
+        buffer_.swap(buff);
+        readPos_ = 0;
+        writePos_ = readable;
     } 
     // 将已有的可读数据向缓冲区的开始移动来腾出足够的可写空间
     else {
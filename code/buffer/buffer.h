@@ -6,15 +6,22 @@
 #include <unistd.h>  // 提供UNIX标准的函数定义，如write()
 #include <sys/uio.h> // 提供readv()和writev()函数的定义
 #include <vector>    // 使用vector作为缓冲区的底层实现
-#include <atomic>    // 提供原子操作，用于线程安全的读写指针操作
 #include <assert.h>  // 提供断言，用于调试中检查逻辑错误
+#include "bufferpool.h"
 
+// 一个Buffer只属于一个连接(或一条日志)，同一时刻只有一个线程访问，读写指针不需要原子操作
+// 存储从BufferPool按档取，扩容时换更大一档的块，空闲时可以用ReleaseSpace还回池里
+// 可读数据总是连续的一段: 请求解析、SIMD扫描和JSON/multipart解析都直接在[Peek(), BeginWrite())上进行，
+// 请求头按相对Peek()的偏移记录。所以不做两段iovec的环形缓冲区，绕回时请求跨在两段上就得再拷成连续的。
+// 读空时Retrieve把读写指针拨回开头，MakeSpace_要搬的只是还没解析完的半个请求
 class Buffer {
 public:
-    // 构造函数，默认初始化缓冲区大小为1024字节
+    // 构造函数，默认初始化缓冲区大小为1024字节，为0时等到第一次写入再取存储
     Buffer(int initBuffSize = 1024);
-    // 默认的析构函数
-    ~Buffer() = default;
+    // 析构时把存储还给缓冲池
+    ~Buffer();
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
     
     // 返回缓冲区中可写的字节数
     size_t WritableBytes() const;       
@@ -35,8 +42,17 @@ public:
     // 回收数据直到指定的end指针位置
     void RetrieveUntil(const char* end);
 
-    // 清空缓冲区
+    // 去掉可读数据中[offset, offset + len)这一段，后面的数据前移，前面的数据位置不变
+    void Erase(size_t offset, size_t len);
+
+    // 清空缓冲区，只重置读写指针
     void RetrieveAll() ;
+    // 没有可读数据时把存储还给缓冲池，连接空闲时不占缓冲区内存
+    void ReleaseSpace();
+    // 当前存储的大小
+    size_t Capacity() const { return buffer_.size(); }
+    // 交出存储，readPos/len返回其中可读数据的位置，Buffer变空。交出的存储用完后用BufferPool::Free归还
+    BufferStorage TakeStorage(size_t* readPos, size_t* len);
     // 清空缓冲区，并返回之前缓冲区中的所有数据转换成的字符串
     std::string RetrieveAllToStr();
 
@@ -51,8 +67,8 @@ public:
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
 
-    // 从文件描述符读取数据到缓冲区
-    ssize_t ReadFd(int fd, int* Errno);
+    // 从文件描述符读取数据到缓冲区: 可写空间不到hint的一半时先扩容到至少hint，直接读进缓冲区，最多读满可写空间
+    ssize_t ReadFd(int fd, int* Errno, size_t hint = 4096);
     // 将缓冲区的数据写入文件描述符
     ssize_t WriteFd(int fd, int* Errno);
 
@@ -63,9 +79,9 @@ private:
     // 当可写空间不足时，调整缓冲区大小或整理缓冲区以腾出空间
     void MakeSpace_(size_t len);
 
-    std::vector<char> buffer_; // 实际存储数据的vector
-    std::atomic<std::size_t> readPos_; // 缓冲区中的读指针位置
-    std::atomic<std::size_t> writePos_; // 缓冲区中的写指针位置
+    BufferStorage buffer_; // 实际存储数据的vector
+    std::size_t readPos_; // 缓冲区中的读指针位置
+    std::size_t writePos_; // 缓冲区中的写指针位置
 };
 
 #endif //BUFFER_H
@@ -0,0 +1,97 @@
+#include "bufferpool.h"
+
+using namespace std;
+
+static const size_t CLASS_SIZE[BufferPool::CLASS_NUM] = { 4096, 16384, 65536 };
+// 每个线程每档最多缓存的空闲块数，每档约1MB
+static const size_t MAX_CACHED[BufferPool::CLASS_NUM] = { 256, 64, 16 };
+
+atomic<size_t> BufferPool::inUse_[BufferPool::CLASS_NUM];
+atomic<size_t> BufferPool::cached_[BufferPool::CLASS_NUM];
+atomic<size_t> BufferPool::hits_;
+atomic<size_t> BufferPool::misses_;
+atomic<size_t> BufferPool::oversize_;
+
+// 线程退出后缓存已经析构，之后在该线程上归还的块直接释放
+static thread_local bool cacheDead = false;
+
+struct BufferPoolCache {
+    vector<BufferStorage> free[BufferPool::CLASS_NUM];
+
+    ~BufferPoolCache() {
+        for(int i = 0; i < BufferPool::CLASS_NUM; i++) {
+            BufferPool::cached_[i].fetch_sub(free[i].size(), memory_order_relaxed);
+        }
+        cacheDead = true;
+    }
+};
+
+static BufferPoolCache* LocalCache() {
+    if(cacheDead) { return nullptr; }
+    static thread_local BufferPoolCache cache;
+    return &cache;
+}
+
+size_t BufferPool::ClassSize(int cls) {
+    return CLASS_SIZE[cls];
+}
+
+size_t BufferPool::MaxCached(int cls) {
+    return MAX_CACHED[cls];
+}
+
+int BufferPool::ClassOf_(size_t len) {
+    for(int i = 0; i < CLASS_NUM; i++) {
+        if(len <= CLASS_SIZE[i]) { return i; }
+    }
+    return -1;
+}
+
+BufferStorage BufferPool::Alloc(size_t len) {
+    if(len == 0) { return BufferStorage(); }
+    int cls = ClassOf_(len);
+    if(cls < 0) {
+        oversize_.fetch_add(1, memory_order_relaxed);
+        return BufferStorage(len);
+    }
+    inUse_[cls].fetch_add(1, memory_order_relaxed);
+    BufferPoolCache* cache = LocalCache();
+    if(cache && !cache->free[cls].empty()) {
+        BufferStorage buff = std::move(cache->free[cls].back());
+        cache->free[cls].pop_back();
+        cached_[cls].fetch_sub(1, memory_order_relaxed);
+        hits_.fetch_add(1, memory_order_relaxed);
+        return buff;
+    }
+    misses_.fetch_add(1, memory_order_relaxed);
+    return BufferStorage(CLASS_SIZE[cls]);
+}
+
+void BufferPool::Free(BufferStorage& buff) {
+    int cls = ClassOf_(buff.size());
+    // 只有大小正好是某一档的才是池里的块
+    if(cls < 0 || buff.size() != CLASS_SIZE[cls]) {
+        BufferStorage().swap(buff);
+        return;
+    }
+    inUse_[cls].fetch_sub(1, memory_order_relaxed);
+    BufferPoolCache* cache = LocalCache();
+    if(cache && cache->free[cls].size() < MAX_CACHED[cls]) {
+        cache->free[cls].push_back(std::move(buff));
+        cached_[cls].fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    BufferStorage().swap(buff);
+}
+
+BufferPool::Stats BufferPool::GetStats() {
+    Stats stats;
+    for(int i = 0; i < CLASS_NUM; i++) {
+        stats.inUse[i] = inUse_[i].load(memory_order_relaxed);
+        stats.cached[i] = cached_[i].load(memory_order_relaxed);
+    }
+    stats.hits = hits_.load(memory_order_relaxed);
+    stats.misses = misses_.load(memory_order_relaxed);
+    stats.oversize = oversize_.load(memory_order_relaxed);
+    return stats;
+}
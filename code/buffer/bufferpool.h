@@ -0,0 +1,69 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstddef>
+
+/* 默认初始化的分配器: vector<char>(n)默认会把新分配的n字节清零，
+   缓冲区的内容总是先写后读，清零是白做的。构造元素时不带参数就什么也不做 */
+template<typename T>
+struct DefaultInitAllocator : std::allocator<T> {
+    template<typename U>
+    struct rebind { using other = DefaultInitAllocator<U>; };
+
+    using std::allocator<T>::allocator;
+
+    template<typename U>
+    void construct(U* p) noexcept { ::new(static_cast<void*>(p)) U; }
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) { ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+};
+
+// 缓冲区的存储块，新分配时不清零
+using BufferStorage = std::vector<char, DefaultInitAllocator<char>>;
+
+/* 缓冲区存储池: 按4K/16K/64K三档分配定长块，每个线程缓存一批空闲块，
+   取还都只动本线程的空闲链表，不加锁。新分配的块不清零。超过64K的按实际大小分配，不进池。
+   块在哪个线程归还就进哪个线程的缓存，每档缓存超过上限的直接释放 */
+class BufferPool {
+public:
+    enum { CLASS_NUM = 3 };
+
+    struct Stats {
+        size_t inUse[CLASS_NUM];   // 各档正在被缓冲区使用的块数
+        size_t cached[CLASS_NUM];  // 各档在线程缓存中空闲的块数
+        size_t hits;               // 从线程缓存取到块的次数
+        size_t misses;             // 缓存为空、新分配块的次数
+        size_t oversize;           // 超过最大档、按实际大小分配的次数
+    };
+
+    // 取一块至少len字节的存储，len为0时返回空
+    static BufferStorage Alloc(size_t len);
+
+    // 归还存储，buff随后为空
+    static void Free(BufferStorage& buff);
+
+    // 第cls档的块大小
+    static size_t ClassSize(int cls);
+
+    // 每个线程第cls档最多缓存的空闲块数
+    static size_t MaxCached(int cls);
+
+    static Stats GetStats();
+
+private:
+    static int ClassOf_(size_t len);
+
+    static std::atomic<size_t> inUse_[CLASS_NUM];
+    static std::atomic<size_t> cached_[CLASS_NUM];
+    static std::atomic<size_t> hits_;
+    static std::atomic<size_t> misses_;
+    static std::atomic<size_t> oversize_;
+
+    friend struct BufferPoolCache;
+};
+
+#endif //BUFFER_POOL_H
@@ -0,0 +1,122 @@
+#include "outputchain.h"
+#include <sys/sendfile.h>  // sendfile()
+#include <algorithm>
+
+using namespace std;
+
+OutputChain::OutputChain() : bytes_(0), scratchUsed_(0) {}
+
+// 自有块: 存储来自缓冲池，最后一个引用释放时还回去
+shared_ptr<BufferStorage> OutputChain::MakeBlock_(BufferStorage&& storage) {
+    return shared_ptr<BufferStorage>(new BufferStorage(std::move(storage)), [](BufferStorage* block) {
+        BufferPool::Free(*block);
+        delete block;
+    });
+}
+
+void OutputChain::Append(Buffer& buff) {
+    if(buff.ReadableBytes() == 0) { return; }
+    size_t pos = 0, len = 0;
+    shared_ptr<BufferStorage> block = MakeBlock_(buff.TakeStorage(&pos, &len));
+    const char* data = block->data() + pos;
+    slices_.push_back({ block, data, len, -1, 0 });
+    bytes_ += len;
+    // 块里剩下的空间接着当暂存块用
+    scratch_ = std::move(block);
+    scratchUsed_ = pos + len;
+}
+
+void OutputChain::Append(const string& str) {
+    Append(str.data(), str.size());
+}
+
+void OutputChain::Append(const char* data, size_t len) {
+    if(len == 0) { return; }
+    assert(data);
+    if(!scratch_ || scratch_->size() - scratchUsed_ < len) {
+        scratch_ = MakeBlock_(BufferPool::Alloc(len));
+        scratchUsed_ = 0;
+    }
+    char* dst = scratch_->data() + scratchUsed_;
+    copy(data, data + len, dst);
+    scratchUsed_ += len;
+    bytes_ += len;
+    // 紧接着链尾那一段就直接合并
+    if(!slices_.empty() && slices_.back().owner == scratch_ && slices_.back().data + slices_.back().len == dst) {
+        slices_.back().len += len;
+        return;
+    }
+    slices_.push_back({ scratch_, dst, len, -1, 0 });
+}
+
+void OutputChain::AppendShared(shared_ptr<const void> owner, const char* data, size_t len) {
+    if(len == 0) { return; }
+    assert(data);
+    slices_.push_back({ std::move(owner), data, len, -1, 0 });
+    bytes_ += len;
+}
+
+void OutputChain::AppendFile(shared_ptr<const void> owner, int fd, off_t offset, size_t len) {
+    if(len == 0) { return; }
+    assert(fd >= 0);
+    slices_.push_back({ std::move(owner), nullptr, len, fd, offset });
+    bytes_ += len;
+}
+
+void OutputChain::Clear() {
+    slices_.clear();
+    bytes_ = 0;
+    scratch_.reset();
+    scratchUsed_ = 0;
+}
+
+// 从链头去掉已经发出去的len字节，发完的片段释放引用
+void OutputChain::Consume(size_t len) {
+    assert(len <= bytes_);
+    bytes_ -= len;
+    while(len > 0) {
+        Slice& head = slices_.front();
+        size_t n = min(len, head.len);
+        if(head.fd >= 0) { head.offset += n; }
+        else { head.data += n; }
+        head.len -= n;
+        len -= n;
+        if(head.len == 0) { slices_.pop_front(); }
+    }
+    // 全部发完就把暂存块也还掉，空闲连接不占着它
+    if(slices_.empty()) {
+        scratch_.reset();
+        scratchUsed_ = 0;
+    }
+}
+
+ssize_t OutputChain::WriteFd(int fd, int* saveErrno) {
+    if(slices_.empty()) { return 0; }
+    ssize_t len = -1;
+    Slice& head = slices_.front();
+    if(head.fd >= 0) {
+        off_t offset = head.offset;
+        len = sendfile(fd, head.fd, &offset, head.len);
+    } else {
+        // 连续的内存片段合成一次writev
+        struct iovec iov[IOV_BATCH];
+        len = writev(fd, iov, FillIov(iov, IOV_BATCH));
+    }
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    Consume(len);
+    return len;
+}
+
+int OutputChain::FillIov(struct iovec* iov, int max) const {
+    int cnt = 0;
+    for(const Slice& slice: slices_) {
+        if(slice.fd >= 0 || cnt == max) { break; }
+        iov[cnt].iov_base = const_cast<char*>(slice.data);
+        iov[cnt].iov_len = slice.len;
+        cnt++;
+    }
+    return cnt;
+}
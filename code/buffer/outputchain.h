@@ -0,0 +1,75 @@
+#ifndef OUTPUT_CHAIN_H
+#define OUTPUT_CHAIN_H
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>  // writev()
+#include <errno.h>
+#include <assert.h>
+
+#include "buffer.h"
+
+/* 输出链: 待发送的数据由若干片段组成，每个片段持有来源的引用计数，
+   可以是自有字节(从Buffer整块转交)、共享的内存(mmap的文件、缓存的片段)或文件区间。
+   连续的内存片段一次writev最多IOV_BATCH段发出，文件区间用sendfile发送。
+   片段发完才释放引用，排队中的多个响应互不影响 */
+class OutputChain {
+public:
+    // 一次writev最多的段数。iovec数组放在栈上，IOV_MAX(1024)段要16K，一批流水线响应也用不了那么多
+    static const int IOV_BATCH = 64;
+
+    OutputChain();
+    ~OutputChain() = default;
+
+    OutputChain(const OutputChain&) = delete;
+    OutputChain& operator=(const OutputChain&) = delete;
+
+    // 取走buff中的可读数据，存储整块转交给输出链，不拷贝，发完后还给缓冲池
+    void Append(Buffer& buff);
+    // 拷贝追加，小片段拷进共用的暂存块，紧接着上一段时直接合并
+    void Append(const char* data, size_t len);
+    void Append(const std::string& str);
+    // 引用owner持有的一段内存，不拷贝，owner在这段数据发完前一直保持有效
+    void AppendShared(std::shared_ptr<const void> owner, const char* data, size_t len);
+    // 文件fd中[offset, offset + len)的区间，owner负责在最后关闭fd
+    void AppendFile(std::shared_ptr<const void> owner, int fd, off_t offset, size_t len);
+
+    // 还没发出去的字节数
+    size_t Bytes() const { return bytes_; }
+    size_t SliceCount() const { return slices_.size(); }
+    bool Empty() const { return slices_.empty(); }
+
+    // 释放所有片段
+    void Clear();
+
+    // 发送链头的数据: 内存片段合成一次writev，链头是文件区间时调用一次sendfile
+    ssize_t WriteFd(int fd, int* saveErrno);
+
+    // 链头连续的内存片段填进iov，遇到文件区间或满max段为止，返回段数。链头是文件区间时返回0
+    int FillIov(struct iovec* iov, int max) const;
+    // 从链头去掉已经发出去的len字节。由调用者自己发送(如io_uring的sendmsg)时，完成后调用
+    void Consume(size_t len);
+
+private:
+    struct Slice {
+        std::shared_ptr<const void> owner;
+        const char* data;   // 内存片段的起始地址，文件区间为nullptr
+        size_t len;
+        int fd;             // 文件区间的fd，内存片段为-1
+        off_t offset;       // 文件区间的当前偏移
+    };
+
+    static std::shared_ptr<BufferStorage> MakeBlock_(BufferStorage&& storage);
+
+    std::deque<Slice> slices_;
+    size_t bytes_;
+
+    // 暂存块: 拷贝追加的小片段都放在这里，多个片段共享一块存储
+    std::shared_ptr<BufferStorage> scratch_;
+    size_t scratchUsed_;
+};
+
+#endif //OUTPUT_CHAIN_H
@@ -0,0 +1,67 @@
+#ifndef READ_SIZER_H
+#define READ_SIZER_H
+
+#include <cstddef>
+#include <algorithm>
+
+/* 自适应读大小: 按一个连接之前每次读到的字节数决定下次给多大的可写空间。
+   读满了给定空间说明数据还多，下次直接放大一档；连续两次只用了不到小一档的量就缩小一档。
+   档位和BufferPool的块大小一致，可写空间直接从缓冲池取 */
+class ReadSizer {
+public:
+    enum { MIN_HINT = 4096, MAX_HINT = 65536, SCALE = 4 };
+
+    struct Stats {
+        size_t reads;      // 读到数据的次数
+        size_t bytes;      // 读到的总字节数
+        size_t lastBytes;  // 最近一次读到的字节数
+        size_t maxBytes;   // 单次读到的最大字节数
+        size_t fullReads;  // 读满了给定空间的次数
+        size_t grows;      // 放大的次数
+        size_t shrinks;    // 缩小的次数
+        size_t hint;       // 下次读给的可写空间
+    };
+
+    ReadSizer() { Reset(); }
+
+    void Reset() {
+        stats_ = Stats();
+        stats_.hint = MIN_HINT;
+        smallReads_ = 0;
+    }
+
+    size_t Hint() const { return stats_.hint; }
+
+    // 记录一次读: 给了offered字节的可写空间，读到len字节
+    void Record(size_t len, size_t offered) {
+        if(len == 0) { return; }
+        stats_.reads++;
+        stats_.bytes += len;
+        stats_.lastBytes = len;
+        stats_.maxBytes = std::max(stats_.maxBytes, len);
+        if(len >= offered) {
+            stats_.fullReads++;
+            smallReads_ = 0;
+            if(stats_.hint < MAX_HINT) {
+                stats_.hint = std::min<size_t>(stats_.hint * SCALE, MAX_HINT);
+                stats_.grows++;
+            }
+        } else if(stats_.hint > MIN_HINT && len <= stats_.hint / SCALE) {
+            if(++smallReads_ >= 2) {
+                stats_.hint /= SCALE;
+                stats_.shrinks++;
+                smallReads_ = 0;
+            }
+        } else {
+            smallReads_ = 0;
+        }
+    }
+
+    const Stats& GetStats() const { return stats_; }
+
+private:
+    Stats stats_;
+    int smallReads_;  // 连续偏小的次数
+};
+
+#endif //READ_SIZER_H
@@ -0,0 +1,69 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cstddef>
+
+// 单反应堆模式下的线程池实现
+enum POOL_TYPE {
+    QUEUE_POOL = 0,      // 一把锁保护的共享任务队列
+    WORK_STEALING_POOL,  // 每线程一个无锁队列，空闲时互相窃取
+};
+
+// 反应堆模式
+enum REACTOR_MODE {
+    SINGLE_REACTOR = 0,  // 单个epoll主线程 + 线程池处理读写
+    MULTI_REACTOR,       // 主反应堆负责accept，N个从反应堆各自负责连接的读写
+    COROUTINE_REACTOR,   // 单个协程事件循环，一个连接一个协程，阻塞操作交给阻塞线程池
+};
+
+// I/O 多路复用后端
+enum IO_BACKEND {
+    EPOLL_BACKEND = 0,  // epoll
+    URING_BACKEND,      // io_uring，多反应堆模式下为完成通知的UringReactor，内核不支持时运行时回退到epoll
+};
+
+// 静态文件的发送方式
+enum FILE_SEND_MODE {
+    SENDFILE_SEND = 0,  // 不建立映射: 大文件sendfile从页缓存直接发到套接字，小文件读进响应头后面一起writev
+    MMAP_SEND,          // mmap后和响应头一起writev，每个响应一次mmap/munmap
+};
+
+/* 构造函数参数之外的可选配置，字段都有默认值 */
+struct Config {
+    // 反应堆模式
+    int reactorMode = SINGLE_REACTOR;
+    // 从反应堆(线程)数量，<= 0 时使用线程池数量
+    int subReactorNum = 0;
+    // 多反应堆模式下每个从反应堆各开一个SO_REUSEPORT监听套接字，由内核分散新连接
+    bool reusePort = false;
+    // listen() 的全连接队列长度
+    int listenBacklog = 6;
+    // 预分配的连接槽位数(fd上限)，<= 0 时取进程的打开文件数上限，最多65536
+    int maxFd = 0;
+    // I/O 多路复用后端
+    int ioBackend = EPOLL_BACKEND;
+    // 静态文件的发送方式
+    int fileSendMode = SENDFILE_SEND;
+    // sendfile方式下小于该字节数的文件不单独sendfile，读进响应缓冲区，流水线的一批响应仍然一次writev发出
+    size_t sendfileMinSize = 16 << 10;
+    // 单反应堆模式下的线程池实现
+    int poolType = QUEUE_POOL;
+    // 共享队列线程池的最大线程数，大于构造参数threadNum时开启弹性伸缩，threadNum作为下限
+    int poolMaxThreads = 0;
+    // 任务排队时间p95超过该值(毫秒)时扩容
+    int poolWaitTargetMs = 5;
+    // 弹性线程空闲超过该值(毫秒)后退出
+    int poolIdleMs = 30000;
+    // 执行数据库等阻塞操作的线程数，<= 0 时与数据库连接池数量相同
+    int blockingThreads = 0;
+    // 请求体的最大字节数(Content-Length或分块传输累计)，超过返回400
+    size_t maxBodySize = 8 << 20;
+    // 注册POST /upload上传演示路由。没有鉴权，任何客户端都能往uploadDir写文件，默认关闭
+    bool enableUpload = false;
+    // 边收边处理的请求体(如multipart上传)的最大字节数，不占内存，但每个请求都要占这么多磁盘
+    size_t maxUploadSize = 8 << 20;
+    // multipart上传的文件先写到这个目录下的临时文件
+    const char* uploadDir = "/tmp";
+};
+
+#endif //CONFIG_H
@@ -0,0 +1,135 @@
+#include "coloop.h"
+#include <limits.h>  // INT_MAX
+
+using namespace std;
+
+// Sleep用的定时器id从这里开始，和按fd编号的I/O超时错开
+static const int SLEEP_TIMER_BASE = 1 << 20;
+
+CoLoop::CoLoop(int ioBackend):
+    poller_(Poller::Create(ioBackend)), timer_(new HeapTimer()), isClose_(false), nextTimerId_(0) {
+    wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(wakeupFd_ >= 0);
+    poller_->AddFd(wakeupFd_, EPOLLIN, &wakeupFd_);
+}
+
+CoLoop::~CoLoop() {
+    // 还挂起着的顶层协程直接销毁，嵌套的子协程随CoTask一起销毁
+    vector<void*> roots(roots_.begin(), roots_.end());
+    roots_.clear();
+    for(void* frame: roots) { coroutine_handle<>::from_address(frame).destroy(); }
+    close(wakeupFd_);
+}
+
+CoLoop::Detached CoLoop::RunDetached_(CoLoop*, CoTask<void> task) {
+    co_await task;
+}
+
+void CoLoop::Spawn(CoTask<void> task) {
+    RunDetached_(this, std::move(task));
+}
+
+void CoLoop::Post(Task&& task) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        tasks_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    ::write(wakeupFd_, &one, sizeof(one));
+}
+
+void CoLoop::Stop() {
+    isClose_ = true;
+    uint64_t one = 1;
+    ::write(wakeupFd_, &one, sizeof(one));
+}
+
+void CoLoop::Forget(int fd) {
+    if(fd >= 0 && static_cast<size_t>(fd) < registered_.size() && registered_[fd]) {
+        poller_->DelFd(fd);
+        registered_[fd] = 0;
+    }
+}
+
+void CoLoop::Run() {
+    while(!isClose_) {
+        // 定时器回调只把协程放进ready_，在tick外恢复，协程里再增删定时器不会打乱堆
+        int timeMS = timer_->GetNextTick();
+        RunReady_();
+        if(isClose_) { break; }
+        int eventCnt = poller_->Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++) {
+            void* ptr = poller_->GetEventPtr(i);
+            if(ptr == &wakeupFd_) {
+                HandleWakeup_();
+                continue;
+            }
+            IoAwaiter* aw = static_cast<IoAwaiter*>(ptr);
+            if(aw->timeoutMs_ >= 0) { timer_->cancel(aw->fd_); }
+            aw->revents_ = poller_->GetEvents(i);
+            aw->handle_.resume();
+        }
+    }
+}
+
+void CoLoop::RunReady_() {
+    while(!ready_.empty()) {
+        vector<coroutine_handle<>> ready;
+        ready.swap(ready_);
+        for(auto h: ready) { h.resume(); }
+    }
+}
+
+void CoLoop::HandleWakeup_() {
+    uint64_t cnt = 0;
+    ::read(wakeupFd_, &cnt, sizeof(cnt));
+    vector<Task> tasks;
+    {
+        lock_guard<mutex> locker(mtx_);
+        tasks.swap(tasks_);
+    }
+    for(auto& task: tasks) {
+        task();
+    }
+}
+
+int CoLoop::NextTimerId_() {
+    nextTimerId_ = (nextTimerId_ + 1) % (INT_MAX - SLEEP_TIMER_BASE);
+    return SLEEP_TIMER_BASE + nextTimerId_;
+}
+
+// ONESHOT注册，每次等待只触发一次，事件指针就是挂起中的等待对象
+void CoLoop::Arm_(IoAwaiter* aw) {
+    int fd = aw->fd_;
+    if(static_cast<size_t>(fd) >= registered_.size()) {
+        registered_.resize(fd + 1, 0);
+    }
+    uint32_t events = aw->events_ | EPOLLONESHOT;
+    if(registered_[fd]) {
+        poller_->ModFd(fd, events, aw);
+    } else {
+        poller_->AddFd(fd, events, aw);
+        registered_[fd] = 1;
+    }
+}
+
+// 超时: 先从Poller移除，保证之后不会再用到这个等待对象
+void CoLoop::OnIoTimeout_(IoAwaiter* aw) {
+    Forget(aw->fd_);
+    aw->timedOut_ = true;
+    ready_.push_back(aw->handle_);
+}
+
+void CoLoop::IoAwaiter::await_suspend(coroutine_handle<> h) {
+    handle_ = h;
+    loop_->Arm_(this);
+    if(timeoutMs_ >= 0) {
+        IoAwaiter* self = this;
+        loop_->timer_->add(fd_, timeoutMs_, [self] { self->loop_->OnIoTimeout_(self); });
+    }
+}
+
+void CoLoop::SleepAwaiter::await_suspend(coroutine_handle<> h) {
+    CoLoop* loop = loop_;
+    loop->timer_->add(loop->NextTimerId_(), ms_, [loop, h] { loop->ready_.push_back(h); });
+}
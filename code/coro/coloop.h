@@ -0,0 +1,158 @@
+#ifndef CO_LOOP_H
+#define CO_LOOP_H
+
+#include <coroutine>
+#include <optional>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <sys/eventfd.h> // eventfd()
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "cotask.h"
+#include "../config/config.h"
+#include "../log/log.h"
+#include "../pool/task.h"
+#include "../server/poller.h"
+#include "../timer/heaptimer.h"
+
+/* 协程事件循环: 在Poller和HeapTimer之上提供可co_await的等待，
+   协程挂起时只占一个协程帧，不占线程。
+   Readable/Writable/Sleep/Spawn只能在事件循环线程上调用，Post和Stop可以在任意线程调用 */
+class CoLoop {
+public:
+    explicit CoLoop(int ioBackend = EPOLL_BACKEND);
+
+    ~CoLoop();
+
+    void Run();
+
+    void Stop();
+
+    // 启动一个顶层协程，立即执行到第一次挂起，结束后自动释放
+    void Spawn(CoTask<void> task);
+
+    // 把任务投递到事件循环线程执行
+    void Post(Task&& task);
+
+    // fd关闭前必须调用，从Poller中移除
+    void Forget(int fd);
+
+    // 等待fd可读/可写，超时返回false，timeoutMs < 0 不超时
+    class IoAwaiter {
+    public:
+        IoAwaiter(CoLoop* loop, int fd, uint32_t events, int timeoutMs)
+            : loop_(loop), fd_(fd), events_(events), timeoutMs_(timeoutMs), timedOut_(false), revents_(0) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const noexcept { return !timedOut_; }
+    private:
+        friend class CoLoop;
+        CoLoop* loop_;
+        int fd_;
+        uint32_t events_;
+        int timeoutMs_;
+        bool timedOut_;
+        uint32_t revents_;
+        std::coroutine_handle<> handle_;
+    };
+
+    IoAwaiter Readable(int fd, int timeoutMs = -1) { return IoAwaiter(this, fd, EPOLLIN | EPOLLRDHUP, timeoutMs); }
+
+    IoAwaiter Writable(int fd, int timeoutMs = -1) { return IoAwaiter(this, fd, EPOLLOUT, timeoutMs); }
+
+    // 挂起ms毫秒
+    class SleepAwaiter {
+    public:
+        SleepAwaiter(CoLoop* loop, int ms) : loop_(loop), ms_(ms) {}
+        bool await_ready() const noexcept { return ms_ <= 0; }
+        void await_suspend(std::coroutine_handle<> h);
+        void await_resume() const noexcept {}
+    private:
+        CoLoop* loop_;
+        int ms_;
+    };
+
+    SleepAwaiter Sleep(int ms) { return SleepAwaiter(this, ms); }
+
+    // 把阻塞调用放到线程池执行，完成后回到事件循环线程恢复，co_await的结果是fn的返回值
+    template<class Pool, class F>
+    class OffloadAwaiter {
+        typedef std::invoke_result_t<F&> R;
+        typedef std::conditional_t<std::is_void_v<R>, char, std::optional<R>> Result;
+    public:
+        OffloadAwaiter(CoLoop* loop, Pool* pool, F fn) : loop_(loop), pool_(pool), fn_(std::move(fn)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            handle_ = h;
+            OffloadAwaiter* self = this;
+            pool_->AddTask([self] {
+                if constexpr (std::is_void_v<R>) { self->fn_(); }
+                else { self->result_.emplace(self->fn_()); }
+                // 投递之后协程随时可能在事件循环线程上恢复并销毁本对象，不能再访问self
+                std::coroutine_handle<> h = self->handle_;
+                self->loop_->Post([h] { h.resume(); });
+            });
+        }
+        R await_resume() {
+            if constexpr (!std::is_void_v<R>) { return std::move(*result_); }
+        }
+    private:
+        CoLoop* loop_;
+        Pool* pool_;
+        F fn_;
+        Result result_;
+        std::coroutine_handle<> handle_;
+    };
+
+    template<class Pool, class F>
+    OffloadAwaiter<Pool, F> Offload(Pool& pool, F fn) { return OffloadAwaiter<Pool, F>(this, &pool, std::move(fn)); }
+
+    // 当前挂起未结束的顶层协程数
+    size_t CoroutineCount() const { return roots_.size(); }
+
+private:
+    // 顶层协程，挂在CoLoop上，析构时销毁还没结束的
+    struct Detached {
+        struct promise_type {
+            promise_type(CoLoop* loop, CoTask<void>&) : loop(loop) {}
+            ~promise_type() { loop->roots_.erase(std::coroutine_handle<promise_type>::from_promise(*this).address()); }
+            Detached get_return_object() {
+                loop->roots_.insert(std::coroutine_handle<promise_type>::from_promise(*this).address());
+                return {};
+            }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() { std::terminate(); }
+            CoLoop* loop;
+        };
+    };
+
+    static Detached RunDetached_(CoLoop* loop, CoTask<void> task);
+
+    void Arm_(IoAwaiter* aw);
+    void OnIoTimeout_(IoAwaiter* aw);
+    void HandleWakeup_();
+    void RunReady_();
+    int NextTimerId_();
+
+    std::unique_ptr<Poller> poller_;
+    std::unique_ptr<HeapTimer> timer_;
+    int wakeupFd_;
+    std::atomic<bool> isClose_;
+
+    std::vector<char> registered_;                 // fd是否已加入Poller
+    std::vector<std::coroutine_handle<>> ready_;   // 定时器到期、等待恢复的协程
+    std::unordered_set<void*> roots_;              // 未结束的顶层协程帧
+    int nextTimerId_;
+
+    std::mutex mtx_;            // 保护 tasks_
+    std::vector<Task> tasks_;   // 其他线程投递过来的任务
+};
+
+#endif //CO_LOOP_H
@@ -0,0 +1,117 @@
+#ifndef CO_TASK_H
+#define CO_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/* 惰性启动的协程任务: 创建后不执行，被co_await时才开始，
+   结束时通过对称转移直接恢复等待它的协程，嵌套调用不会加深栈 */
+template<class T = void>
+class CoTask;
+
+struct CoPromiseBase {
+    std::coroutine_handle<> continuation;  // 等待本任务的协程
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template<class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template<class T>
+class CoTask {
+public:
+    struct promise_type : CoPromiseBase {
+        std::optional<T> value;
+
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        template<class U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+    };
+
+    CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    CoTask& operator=(CoTask&& other) noexcept {
+        if(this != &other) {
+            if(handle_) { handle_.destroy(); }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+
+    ~CoTask() { if(handle_) { handle_.destroy(); } }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        handle_.promise().continuation = cont;
+        return handle_;
+    }
+
+    T await_resume() {
+        if(handle_.promise().exception) { std::rethrow_exception(handle_.promise().exception); }
+        return std::move(*handle_.promise().value);
+    }
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template<>
+class CoTask<void> {
+public:
+    struct promise_type : CoPromiseBase {
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        void return_void() {}
+    };
+
+    CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    CoTask& operator=(CoTask&& other) noexcept {
+        if(this != &other) {
+            if(handle_) { handle_.destroy(); }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+
+    ~CoTask() { if(handle_) { handle_.destroy(); } }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        handle_.promise().continuation = cont;
+        return handle_;
+    }
+
+    void await_resume() {
+        if(handle_.promise().exception) { std::rethrow_exception(handle_.promise().exception); }
+    }
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+#endif //CO_TASK_H
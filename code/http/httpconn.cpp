@@ -1,5 +1,5 @@
-
 #include "httpconn.h"
+#include "router.h"
 #include <string>
 using namespace std;
 
@@ -7,11 +7,18 @@ using namespace std;
 std::string HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+int HttpConn::maxPipeline = 32;
 
-HttpConn::HttpConn() {
+// 连接槽位是预先按fd分配的，缓冲区只在有数据收发时从缓冲池取，空闲时归还
+HttpConn::HttpConn(): readBuff_(0), writeBuff_(0) {
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    gen_ = 0;
+    busy_ = false;
+    expired_ = false;
+    keepAlive_ = false;
+    readPaused_ = false;
 };
 
 HttpConn::~HttpConn() { 
@@ -25,17 +32,34 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     fd_ = fd;
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    readSizer_.Reset();
+    request_.Init();
+    keepAlive_ = false;
+    readPaused_ = false;
+    gen_++;
+    expired_ = false;
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
-void HttpConn::Close() {
+void HttpConn::Close(bool closeFd) {
     response_.UnmapFile();
-    if(isClose_ == false){
-        isClose_ = true; 
+    // 定时器和工作线程可能同时关闭同一条连接，只有一个能关成功
+    if(isClose_.exchange(true) == false){
+        gen_++;
         userCount--;
-        close(fd_);
+        // 缓冲区要在close之前归还: fd一关，槽位就可能被其他线程上accept到的新连接使用
+        readBuff_.RetrieveAll();
+        readBuff_.ReleaseSpace();
+        writeBuff_.RetrieveAll();
+        writeBuff_.ReleaseSpace();
+        output_.Clear();
+        const ReadSizer::Stats& stats = readSizer_.GetStats();
+        LOG_DEBUG("Client[%d] reads:%zu bytes:%zu max:%zu full:%zu grow:%zu shrink:%zu hint:%zu", fd_,
+                  stats.reads, stats.bytes, stats.maxBytes, stats.fullReads, stats.grows, stats.shrinks, stats.hint);
+        // 日志同样要在close之前打，之后fd_和地址可能已经是新连接的
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        if(closeFd) { close(fd_); }
     }
 }
 
@@ -57,74 +81,112 @@ int HttpConn::GetPort() const {
 
 ssize_t HttpConn::read(int* saveErrno) {
     ssize_t len = -1;
+    readPaused_ = false;
     // ET模型循环读
     do {
-        // 缓冲区读数据
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        // 缓冲区读数据，可写空间的大小按这个连接之前的读量自适应
+        len = readBuff_.ReadFd(fd_, saveErrno, readSizer_.Hint());
         if (len <= 0) {
             break;
         }
+        readSizer_.Record(len, readBuff_.WritableBytes() + len);
+        // 大的请求体边收边交给请求处理，缓冲区攒够了先停下，剩下的留在套接字里，每条连接占的内存有上限
+        if(readBuff_.ReadableBytes() >= READ_HIGH_WATER) {
+            readPaused_ = true;
+            break;
+        }
     } while (isET);
+    // 什么也没读到就不占着缓冲区
+    readBuff_.ReleaseSpace();
     return len;
 }
 
+void HttpConn::Input(const char* data, size_t len, size_t offered) {
+    readBuff_.Append(data, len);
+    readSizer_.Record(len, offered);
+}
+
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
     do {
-        // 分散去写
-        len = writev(fd_, iov_, iovCnt_);
+        // 输出链一次writev发出链头连续的片段，发完的片段随即释放
+        len = output_.WriteFd(fd_, saveErrno);
         if(len <= 0) {
-            *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        }
-        else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
-        }
+        if(output_.Empty()) { break; } /* 传输结束 */
     } while(isET || ToWriteBytes() > 10240);
     return len;
 }
 
 bool HttpConn::process() {
-    request_.Init();
-    // 判断是否有数据可读
-    if(readBuff_.ReadableBytes() <= 0) {
-        return false;
-    }
-    // 解析成功了
-    else if(request_.parse(readBuff_)) {
-        LOG_DEBUG("%s", request_.path().c_str());
-        // 响应成功 200
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {
-        // 响应错误 400
-        response_.Init(srcDir, request_.path(), false, 400);
+    // 流水线: 客户端连着发来的请求一次都解析完，响应按顺序排在输出链上，一起writev发出
+    int queued = 0;
+    while(queued < maxPipeline) {
+        // 从上次断开的地方接着解析，不够一个完整请求就等下次读
+        HttpRequest::HTTP_CODE ret = request_.parse(readBuff_);
+        if(ret == HttpRequest::NO_REQUEST) {
+            break;
+        }
+        // 解析成功了
+        else if(ret == HttpRequest::GET_REQUEST) {
+            LOG_DEBUG("%s", request_.path().c_str());
+            // 按路由表处理，没有匹配的路由就按路径返回静态文件
+            Router::Instance()->Dispatch(request_);
+            // 需要阻塞处理，先不生成响应，前面排队的响应和它的响应由ProcessBlocking之后一起发
+            if(request_.NeedBlocking()) {
+                return false;
+            }
+            // 响应成功 200
+            response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        } else {
+            // 响应错误 400
+            response_.Init(srcDir, request_.path(), false, 400);
+        }
+        PrepareResponse_();
+        queued++;
+        // 不保持连接，发完就关，后面的请求不再处理
+        if(!keepAlive_) {
+            break;
+        }
     }
+    // 读缓冲区里没有剩下的数据就先还给缓冲池
+    readBuff_.ReleaseSpace();
+    writeBuff_.ReleaseSpace();
+    return queued > 0;
+}
+
+// 在阻塞任务线程池中执行: 完成路由登记的阻塞处理，然后生成响应
+void HttpConn::ProcessBlocking() {
+    assert(request_.NeedBlocking());
+    request_.RunBlocking();
+    response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+    PrepareResponse_();
+    readBuff_.ReleaseSpace();
+    writeBuff_.ReleaseSpace();
+}
+
+void HttpConn::PrepareResponse_() {
+    keepAlive_ = response_.IsKeepAlive();
+    // 处理函数已经执行完，没移走的上传文件不再需要
+    request_.RemoveUploads();
     // 响应对象
     response_.MakeResponse(writeBuff_);
-    /* 响应头 */
-    // 地址
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    // 长度
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-
-    /* 文件 */
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+    if(output_.Empty()) {
+        /* 响应头，存储整块转交给输出链 */
+        output_.Append(writeBuff_);
+    } else {
+        /* 前面还有排队的响应: 响应头拷进输出链的暂存块，一批响应头共用一块存储 */
+        output_.Append(writeBuff_.Peek(), writeBuff_.ReadableBytes());
+        writeBuff_.RetrieveAll();
+    }
+
+    /* 文件: sendfile方式挂文件区间，mmap方式引用映射，都不拷贝 */
+    if(response_.FileLen() > 0 && response_.FileFd() >= 0) {
+        output_.AppendFile(response_.OpenedFile(), response_.FileFd(), 0, response_.FileLen());
+    }
+    else if(response_.FileLen() > 0  && response_.File()) {
+        output_.AppendShared(response_.MappedFile(), response_.File(), response_.FileLen());
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , output_.SliceCount(), ToWriteBytes());
 }
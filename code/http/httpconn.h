@@ -7,13 +7,24 @@
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <atomic>
+#include <thread>
 
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
+#include "../buffer/outputchain.h"
+#include "../buffer/readsizer.h"
 #include "httprequest.h"
 #include "httpresponse.h"
 
+/* 连接句柄: fd + 代数。fd会被复用，代数在每次建立和关闭连接时加一，
+   定时器回调和线程池任务持有句柄，触发时校验，过期句柄不会碰到新连接 */
+struct ConnHandle {
+    int fd;
+    uint32_t gen;
+};
+
 class HttpConn {
 public:
     HttpConn();
@@ -26,46 +37,100 @@ public:
 
     ssize_t write(int* saveErrno);
 
-    void Close();
+    /* 完成通知(io_uring)模式: 内核已经把数据收进自己的缓冲区，拷进读缓冲区；
+       要发的链头内存片段由反应堆用sendmsg提交，完成后用Sent去掉已发出的字节 */
+    // offered是内核缓冲区的大小，用来统计读量
+    void Input(const char* data, size_t len, size_t offered);
+    int FillSend(struct iovec* iov, int max) const { return output_.FillIov(iov, max); }
+    void Sent(size_t len) { output_.Consume(len); }
+
+    // closeFd为false时只释放连接，fd由调用者关闭(如提交io_uring的close请求)
+    void Close(bool closeFd = true);
 
     int GetFd() const;
 
+    ConnHandle Handle() const { return { fd_, gen_.load() }; }
+
+    // 句柄仍然指向当前这条连接
+    bool IsValid(const ConnHandle& handle) const {
+        return !isClose_ && handle.fd == fd_ && handle.gen == gen_.load();
+    }
+
+    bool IsClose() const { return isClose_; }
+
+    /* 线程池处理连接期间持有busy标记，定时器碰到正在处理的连接只标记过期，
+       由工作线程处理完后关闭，避免连接在使用中被关闭、fd被新连接复用 */
+    bool TryAcquire() {
+        bool expected = false;
+        return busy_.compare_exchange_strong(expected, true);
+    }
+    void Acquire() { while(!TryAcquire()) { std::this_thread::yield(); } }
+    void Release() { busy_ = false; }
+    void SetExpired() { expired_ = true; }
+    bool IsExpired() const { return expired_; }
+
     int GetPort() const;
 
     const char* GetIP() const;
     
     sockaddr_in GetAddr() const;
     
+    // 解析读缓冲区里所有完整的请求(最多maxPipeline个)，响应按顺序挂到输出链上，有响应要发送时返回true
     bool process();
 
+    // process返回false且IsPending时，请求有阻塞处理(如查数据库)，交给阻塞任务线程池执行ProcessBlocking生成响应
+    bool IsPending() const { return request_.NeedBlocking(); }
+
+    void ProcessBlocking();
+
     int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+        return output_.Bytes(); 
     }
 
+    // 最后一个排队的响应是否保持连接
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return keepAlive_;
     }
 
+    // 上次read因为读缓冲区满了提前停下，套接字里可能还有数据。ET模式下要重新注册一次事件才会再通知
+    bool IsReadPaused() const { return readPaused_; }
+
+    // 读缓冲区攒到了高水位，先处理掉再读
+    bool IsReadFull() const { return readBuff_.ReadableBytes() >= READ_HIGH_WATER; }
+
+    // 这个连接的读统计，用来调整自适应读的策略
+    const ReadSizer::Stats& GetReadStats() const { return readSizer_.GetStats(); }
+
+    // 读缓冲区里攒到这么多字节就先停止读，等处理掉再读
+    static const size_t READ_HIGH_WATER = HttpRequest::MAX_HEADER_BYTES + ReadSizer::MAX_HINT;
+
     static bool isET;
+    // 流水线请求一次最多处理多少个，剩下的等这一批发完再处理
+    static int maxPipeline;
     // static const char* srcDir;          //资源的目录
     static std::string srcDir;          //资源的目录
     static std::atomic<int> userCount;  //总的客户端的连接数1
     
 private:
-   
+    void PrepareResponse_();
+
     int fd_;
     struct  sockaddr_in addr_;
 
-    bool isClose_;
-    
-    int iovCnt_;
-    struct iovec iov_[2];
+    std::atomic<bool> isClose_;
+    std::atomic<uint32_t> gen_;  // 连接代数
+    std::atomic<bool> busy_;     // 是否有工作线程正在处理
+    std::atomic<bool> expired_;  // 处理期间定时器已到期
     
     Buffer readBuff_;  // 读缓冲区，保存请求数据的内容
-    Buffer writeBuff_; // 写缓冲区，保存响应数据的内容
+    Buffer writeBuff_; // 写缓冲区，生成响应头，生成完整块交给输出链
+    OutputChain output_;  // 待发送的响应: 响应头、文件映射等片段
+    ReadSizer readSizer_; // 自适应读大小和读统计
 
     HttpRequest request_;
     HttpResponse response_;
+    bool keepAlive_;
+    bool readPaused_;
 };
 
 
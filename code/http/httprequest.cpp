@@ -1,114 +1,445 @@
 
 #include "httprequest.h"
+#include <array>
+#include <memory>
+#include <strings.h>  // strncasecmp()
+#include "httpscan.h"
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
+HttpRequest::BodyHandlerFactory HttpRequest::bodyHandlerFactory;
+size_t HttpRequest::maxBodySize = 8 << 20;
+size_t HttpRequest::maxStreamBodySize = 8 << 20;
 
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+// RFC 9110 token字符: 方法名、头部字段名
+static constexpr std::array<bool, 256> MakeTcharTable() {
+    std::array<bool, 256> table{};
+    for(int ch = '0'; ch <= '9'; ch++) { table[ch] = true; }
+    for(int ch = 'a'; ch <= 'z'; ch++) { table[ch] = true; }
+    for(int ch = 'A'; ch <= 'Z'; ch++) { table[ch] = true; }
+    for(unsigned char ch: std::string_view("!#$%&'*+-.^_`|~")) { table[ch] = true; }
+    return table;
+}
+static constexpr std::array<bool, 256> TCHAR = MakeTcharTable();
+
+static inline bool IsTchar(char ch) { return TCHAR[static_cast<unsigned char>(ch)]; }
+
+// 请求目标: 可见字符，不能有空白和控制字符
+static inline bool IsTargetChar(char ch) { return ch > 0x20 && ch < 0x7f; }
+
+static inline bool IsOws(char ch) { return ch == ' ' || ch == '\t'; }
+
+// 不用isdigit: 字段值里允许0x80以上的obs-text，char为负数时传给isdigit是未定义行为
+static inline bool IsDigit(char ch) { return ch >= '0' && ch <= '9'; }
 
 void HttpRequest::Init() {
     method_ = path_ = version_ = body_ = "";
     // 默认解析请求首行
     state_ = REQUEST_LINE;
-    header_.clear();
+    fieldNum_ = 0;
+    moreFields_.clear();
+    memset(known_, 0, sizeof(known_));
     post_.clear();
+    json_.Clear();
+    base_ = nullptr;
+    parsed_ = scanned_ = 0;
+    contentLen_ = 0;
+    chunked_ = false;
+    chunkLeft_ = bodyLen_ = 0;
+    // 先释放处理函数，没传完的临时文件由它删除
+    bodyHandler_ = nullptr;
+    RemoveUploads();
+    keepAlive_ = false;
+    blocking_ = nullptr;
 }
 
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    return keepAlive_;
+}
+
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// 逗号分隔的列表(如Connection)里有没有token，不区分大小写
+static bool HasToken(std::string_view list, std::string_view token) {
+    while(!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        while(!item.empty() && IsOws(item.front())) { item.remove_prefix(1); }
+        while(!item.empty() && IsOws(item.back())) { item.remove_suffix(1); }
+        if(EqualsIgnoreCase(item, token)) { return true; }
+        if(comma == std::string_view::npos) { break; }
+        list.remove_prefix(comma + 1);
     }
     return false;
 }
 
+// 常用请求头的名字长度各不相同，按长度分支后只需比较一次
+int HttpRequest::KnownHeader_(std::string_view name) {
+    int header = -1;
+    std::string_view known;
+    switch(name.size())
+    {
+    case 4:  header = HOST;              known = "Host"; break;
+    case 5:  header = RANGE;             known = "Range"; break;
+    case 6:  header = COOKIE;            known = "Cookie"; break;
+    case 10: header = CONNECTION;        known = "Connection"; break;
+    case 12: header = CONTENT_TYPE;      known = "Content-Type"; break;
+    case 13: header = IF_NONE_MATCH;     known = "If-None-Match"; break;
+    case 14: header = CONTENT_LENGTH;    known = "Content-Length"; break;
+    case 15: header = ACCEPT_ENCODING;   known = "Accept-Encoding"; break;
+    case 17: header = TRANSFER_ENCODING; known = "Transfer-Encoding"; break;
+    default: return -1;
+    }
+    return EqualsIgnoreCase(name, known) ? header : -1;
+}
+
+void HttpRequest::AddField_(std::string_view name, std::string_view value, int known) {
+    Field field = { static_cast<uint32_t>(name.data() - base_), static_cast<uint32_t>(name.size()),
+                    static_cast<uint32_t>(value.data() - base_), static_cast<uint32_t>(value.size()) };
+    if(fieldNum_ < INLINE_FIELDS) {
+        fields_[fieldNum_] = field;
+    } else {
+        moreFields_.push_back(field);
+    }
+    fieldNum_++;
+    // 同名的只记第一个
+    if(known >= 0 && known_[known] == 0) {
+        known_[known] = fieldNum_;
+    }
+}
+
+std::string_view HttpRequest::GetHeader(HEADER header) const {
+    assert(header >= 0 && header < HEADER_NUM);
+    if(known_[header] == 0) { return std::string_view(); }
+    return FieldValue_(GetField_(known_[header] - 1));
+}
+
+std::string_view HttpRequest::GetHeader(std::string_view name) const {
+    int known = KnownHeader_(name);
+    if(known >= 0) { return GetHeader(static_cast<HEADER>(known)); }
+    for(size_t i = 0; i < fieldNum_; i++) {
+        const Field& field = GetField_(i);
+        if(EqualsIgnoreCase(std::string_view(base_ + field.nameOff, field.nameLen), name)) {
+            return FieldValue_(field);
+        }
+    }
+    return std::string_view();
+}
+
 // 真正的业务逻辑
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n";
-    if(buff.ReadableBytes() <= 0) {
-        return false;
+// 直接在读缓冲区上按行扫描，请求行和请求头不逐行拷贝
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
+    // 上一个请求已经处理完，开始解析下一个
+    if(state_ == FINISH) {
+        Init();
     }
+    // 两次调用之间读缓冲区可能搬移过，只按偏移找上次的位置
+    base_ = buff.Peek();
+    const char* end = buff.BeginWriteConst();
     // 有限状态机，解析请求，只要还有数据，并且状态还是没有完成，就继续执行下去。（状态需要转变）
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 获取一行数据，以\r\n为结束标志
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buff.Peek(), lineEnd); 
+    while(state_ != FINISH) {
+        const char* pos = base_ + parsed_;
+        if(state_ != REQUEST_LINE && state_ != HEADERS) {
+            // 请求体收齐了才算完整
+            HTTP_CODE ret = ParseBody_(buff);
+            if(ret != GET_REQUEST) {
+                return ret;
+            }
+            break;
+        }
+        // 一行里第一个控制字符就是行尾，必须是CRLF。
+        // 裸LF和字段值里的非法字符在这一遍扫描里一起查出来
+        // 从上次扫到的位置继续找，客户端逐字节发送时每个字节也只扫一遍
+        const char* ctl = HttpScan::FindCtl(base_ + scanned_, end);
+        if(ctl == end || (*ctl == '\r' && ctl + 1 == end)) {
+            scanned_ = ctl - base_;
+            if(scanned_ > MAX_HEADER_BYTES) {
+                LOG_ERROR("Request header too large");
+                return BAD_REQUEST;
+            }
+            return NO_REQUEST;
+        }
+        if(ctl[0] != '\r' || ctl[1] != '\n') {
+            LOG_ERROR("Invalid character in request");
+            return BAD_REQUEST;
+        }
+        std::string_view line(pos, ctl - pos);
+        parsed_ = scanned_ = ctl + 2 - base_;
+        // 整个请求头一次读到时不会走上面不完整的分支，完整的行也要算进上限
+        if(parsed_ > MAX_HEADER_BYTES) {
+            LOG_ERROR("Request header too large");
+            return BAD_REQUEST;
+        }
         switch(state_)
         {
         case REQUEST_LINE:
+            // 请求行之前的空行忽略
+            if(line.empty()) { break; }
             if(!ParseRequestLine_(line)) {
-                return false;
+                return BAD_REQUEST;
             }
-            ParsePath_();
             break;    
         case HEADERS:
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH;
+            if(!ParseHeader_(line)) {
+                return BAD_REQUEST;
             }
             break;
-        case BODY:
-            ParseBody_(line);
-            break;
         default:
             break;
         }
-        // 解析完成了
-        if(lineEnd == buff.BeginWrite()) { break; }
-        buff.RetrieveUntil(lineEnd + 2);
     }
+    // RFC 9112 9.3: HTTP/1.1默认保持连接，除非带Connection: close；HTTP/1.0要明确带keep-alive
+    if(version_ == "1.1") {
+        keepAlive_ = !HasToken(GetHeader(CONNECTION), "close");
+    } else {
+        keepAlive_ = HasToken(GetHeader(CONNECTION), "keep-alive");
+    }
+    buff.Retrieve(parsed_);
     LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    return GET_REQUEST;
+}
+
+// request-line = method SP request-target SP HTTP-version
+bool HttpRequest::ParseRequestLine_(std::string_view line) {
+    // GET / HTTP/1.1
+    size_t i = 0, n = line.size();
+    while(i < n && IsTchar(line[i])) { i++; }
+    if(i == 0 || i == n || line[i] != ' ') {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    std::string_view method = line.substr(0, i);
+    size_t targetBegin = ++i;
+    while(i < n && IsTargetChar(line[i])) { i++; }
+    if(i == targetBegin || i == n || line[i] != ' ') {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    std::string_view target = line.substr(targetBegin, i - targetBegin);
+    // HTTP-version = "HTTP/" DIGIT "." DIGIT
+    std::string_view version = line.substr(i + 1);
+    if(version.size() != 8 || version.substr(0, 5) != "HTTP/" || !IsDigit(version[5])
+       || version[6] != '.' || !IsDigit(version[7])) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    method_.assign(method.data(), method.size());
+    path_.assign(target.data(), target.size());
+    version_.assign(version.data() + 5, 3);
+    state_ = HEADERS;
     return true;
 }
 
-void HttpRequest::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html"; 
+// field-line = field-name ":" OWS field-value OWS，空行表示请求头结束
+bool HttpRequest::ParseHeader_(std::string_view line) {
+    if(line.empty()) {
+        return OnHeadersEnd_();
+    }
+    // 字段名是token，和冒号之间不能有空白；以空白开头的是已废弃的折行，不接受。
+    // 字段值里的字符在parse找行尾时已经查过
+    size_t i = HttpScan::FindChar(line.data(), line.data() + line.size(), ':') - line.data();
+    size_t n = line.size();
+    if(i == 0 || i == n) {
+        LOG_ERROR("Header Error");
+        return false;
+    }
+    for(size_t j = 0; j < i; j++) {
+        if(!IsTchar(line[j])) {
+            LOG_ERROR("Header Error");
+            return false;
+        }
+    }
+    std::string_view name = line.substr(0, i);
+    size_t valueBegin = i + 1, valueEnd = n;
+    while(valueBegin < valueEnd && IsOws(line[valueBegin])) { valueBegin++; }
+    while(valueEnd > valueBegin && IsOws(line[valueEnd - 1])) { valueEnd--; }
+    std::string_view value = line.substr(valueBegin, valueEnd - valueBegin);
+    int known = KnownHeader_(name);
+    if(known == HOST && HasHeader(HOST)) {
+        LOG_ERROR("Duplicate Host header");
+        return false;
+    }
+    // 只看第一个Transfer-Encoding的话，chunked后面再跟一个gzip也会按chunked解析，
+    // 而前面的代理可能按最后一个理解请求体，造成请求走私。只接受一个
+    if(known == TRANSFER_ENCODING && HasHeader(TRANSFER_ENCODING)) {
+        LOG_ERROR("Duplicate Transfer-Encoding header");
+        return false;
+    }
+    if(known == CONTENT_LENGTH) {
+        if(value.empty() || value.size() > 18) {
+            LOG_ERROR("Content-Length Error");
+            return false;
+        }
+        size_t len = 0;
+        for(char ch: value) {
+            if(!IsDigit(ch)) {
+                LOG_ERROR("Content-Length Error");
+                return false;
+            }
+            len = len * 10 + (ch - '0');
+        }
+        // 多个Content-Length必须一致
+        if(HasHeader(CONTENT_LENGTH) && len != contentLen_) {
+            LOG_ERROR("Content-Length Error");
+            return false;
+        }
+        contentLen_ = len;
     }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
+    AddField_(name, value, known);
+    return true;
+}
+
+// 请求头结束: 确定有没有请求体、按什么方式传输
+bool HttpRequest::OnHeadersEnd_() {
+    // HTTP/1.1请求必须带Host
+    if(version_ == "1.1" && !HasHeader(HOST)) {
+        LOG_ERROR("Missing Host header");
+        return false;
+    }
+    if(HasHeader(TRANSFER_ENCODING)) {
+        // 只支持单独一个chunked；和Content-Length同时出现时两边对长度的理解可能不一致，直接拒绝
+        if(!EqualsIgnoreCase(GetHeader(TRANSFER_ENCODING), "chunked") || HasHeader(CONTENT_LENGTH)) {
+            LOG_ERROR("Unsupported Transfer-Encoding");
+            return false;
+        }
+        chunked_ = true;
+    }
+    if(!chunked_ && contentLen_ == 0) {
+        state_ = FINISH;
+        return true;
+    }
+    if(bodyHandlerFactory) {
+        bodyHandler_ = bodyHandlerFactory(*this);
+    }
+    // 有处理函数时上限不同，选好处理函数再检查
+    if(contentLen_ > BodyLimit_()) {
+        LOG_WARN("Request body too large: %zu", contentLen_);
+        return false;
+    }
+    // 攒在body_里时长度已知就一次分配好
+    if(!bodyHandler_ && !chunked_) {
+        body_.reserve(contentLen_);
+    }
+    state_ = chunked_ ? CHUNK_SIZE : BODY;
+    return true;
+}
+
+// 请求体从parsed_开始。交出去的数据和分块格式的字节处理完就从读缓冲区去掉，
+// 只留下还不完整的一行，请求头的位置不变
+HttpRequest::HTTP_CODE HttpRequest::ParseBody_(Buffer& buff) {
+    const char* begin = base_ + parsed_;
+    const char* pos = begin;
+    const char* end = buff.BeginWriteConst();
+    while(state_ != FINISH) {
+        if(state_ == BODY || state_ == CHUNK_DATA) {
+            size_t left = state_ == BODY ? contentLen_ - bodyLen_ : chunkLeft_;
+            size_t len = std::min(left, static_cast<size_t>(end - pos));
+            if(!OnBody_(pos, len)) {
+                return BAD_REQUEST;
+            }
+            pos += len;
+            if(len < left) {
+                if(state_ == CHUNK_DATA) { chunkLeft_ -= len; }
                 break;
             }
+            if(state_ == CHUNK_DATA) {
+                chunkLeft_ = 0;
+                state_ = CHUNK_CRLF;
+            } else if(!OnBodyEnd_()) {
+                return BAD_REQUEST;
+            }
+            continue;
+        }
+        // 块大小行、块数据后的CRLF和尾部字段都是以CRLF结尾的行
+        const char* lf = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if(!lf) {
+            if(static_cast<size_t>(end - pos) > MAX_CHUNK_LINE) {
+                LOG_ERROR("Chunk line too long");
+                return BAD_REQUEST;
+            }
+            break;
+        }
+        if(lf == pos || lf[-1] != '\r') {
+            LOG_ERROR("Bare LF in chunked body");
+            return BAD_REQUEST;
+        }
+        std::string_view line(pos, lf - 1 - pos);
+        pos = lf + 1;
+        if(state_ == CHUNK_SIZE) {
+            if(!ParseChunkSize_(line)) {
+                return BAD_REQUEST;
+            }
+        } else if(state_ == CHUNK_CRLF) {
+            if(!line.empty()) {
+                LOG_ERROR("Chunk data longer than chunk size");
+                return BAD_REQUEST;
+            }
+            state_ = CHUNK_SIZE;
+        } else if(line.empty()) {
+            // 尾部字段不使用，空行表示请求结束
+            if(!OnBodyEnd_()) {
+                return BAD_REQUEST;
+            }
         }
     }
+    if(state_ != FINISH) {
+        buff.Erase(parsed_, pos - begin);
+        return NO_REQUEST;
+    }
+    parsed_ = pos - base_;
+    return GET_REQUEST;
 }
 
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    // GET / HTTP/1.1
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
+// chunk-size [ chunk-ext ]，块大小是十六进制，块扩展忽略
+bool HttpRequest::ParseChunkSize_(std::string_view line) {
+    size_t i = 0, size = 0;
+    for(; i < line.size() && isxdigit(static_cast<unsigned char>(line[i])); i++) {
+        // 15位十六进制已经远超请求体上限，再多就会溢出
+        if(i == 15) {
+            LOG_ERROR("Chunk size Error");
+            return false;
+        }
+        size = size * 16 + (IsDigit(line[i]) ? line[i] - '0' : (line[i] | 0x20) - 'a' + 10);
+    }
+    if(i == 0 || (i < line.size() && line[i] != ';' && !IsOws(line[i]))) {
+        LOG_ERROR("Chunk size Error");
+        return false;
+    }
+    if(size == 0) {
+        state_ = TRAILERS;
         return true;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    if(size > BodyLimit_() - bodyLen_) {
+        LOG_WARN("Request body too large: %zu", bodyLen_ + size);
+        return false;
+    }
+    chunkLeft_ = size;
+    state_ = CHUNK_DATA;
+    return true;
 }
 
-void HttpRequest::ParseHeader_(const string& line) {
-    // 解析键值对
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+bool HttpRequest::OnBody_(const char* data, size_t len) {
+    if(len == 0) { return true; }
+    bodyLen_ += len;
+    if(bodyLen_ > BodyLimit_()) {
+        LOG_WARN("Request body too large: %zu", bodyLen_);
+        return false;
     }
-    else {
-        state_ = BODY;
+    if(bodyHandler_) {
+        return bodyHandler_(data, len);
     }
+    body_.append(data, len);
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
-    ParsePost_();
+bool HttpRequest::OnBodyEnd_() {
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    if(bodyHandler_) {
+        return bodyHandler_(nullptr, 0);
+    }
+    LOG_DEBUG("Body:%s, len:%d", body_.c_str(), body_.size());
+    return ParsePost_();
 }
 
 int HttpRequest::ConverHex(char ch) {
@@ -117,23 +448,33 @@ int HttpRequest::ConverHex(char ch) {
     return ch;
 }
 
-void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+// 媒体类型不区分大小写，后面可以带charset等参数
+std::string_view HttpRequest::MediaType_() const {
+    std::string_view type = GetHeader(CONTENT_TYPE);
+    type = type.substr(0, type.find(';'));
+    while(!type.empty() && IsOws(type.back())) { type.remove_suffix(1); }
+    return type;
+}
+
+bool HttpRequest::IsFormUrlencoded() const {
+    return EqualsIgnoreCase(MediaType_(), "application/x-www-form-urlencoded");
+}
+
+// application/json和application/problem+json这类结构化后缀
+bool HttpRequest::IsJson() const {
+    std::string_view type = MediaType_();
+    return EqualsIgnoreCase(type, "application/json") ||
+           (type.size() > 5 && EqualsIgnoreCase(type.substr(type.size() - 5), "+json"));
+}
+
+// 表单字段先解码好，路由处理函数用GetPost取；JSON就地解析，用Json()取。格式错误返回false
+bool HttpRequest::ParsePost_() {
+    if(method_ == "POST" && IsFormUrlencoded()) {
         ParseFromUrlencoded_();
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
-            }
-        }
-    }   
+    } else if(IsJson()) {
+        return json_.Parse(body_);
+    }
+    return true;
 }
 
 void HttpRequest::ParseFromUrlencoded_() {
@@ -178,65 +519,32 @@ void HttpRequest::ParseFromUrlencoded_() {
     }
 }
 
-bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    MYSQL* sql;
-    SqlConnRAII(&sql,  SqlConnPool::Instance());
-    assert(sql);
-    
-    bool flag = false;
-    unsigned int j = 0;
-    char order[256] = { 0 };
-    MYSQL_FIELD *fields = nullptr;
-    MYSQL_RES *res = nullptr;
-    
-    if(!isLogin) { flag = true; }
-    /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
-
-    if(mysql_query(sql, order)) { 
-        mysql_free_result(res);
-        return false; 
-    }
-    res = mysql_store_result(sql);
-    j = mysql_num_fields(res);
-    fields = mysql_fetch_fields(res);
-
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
-        /* 注册行为 且 用户名未被使用*/
-        if(isLogin) {
-            if(pwd == password) { flag = true; }
-            else {
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        } 
-        else { 
-            flag = false; 
-            LOG_DEBUG("user used!");
-        }
+HttpRequest::BodyHandler HttpRequest::FormDataHandler() {
+    std::string boundary;
+    if(method_ != "POST" || !MultipartParser::GetBoundary(GetHeader(CONTENT_TYPE), &boundary)) {
+        return nullptr;
     }
-    mysql_free_result(res);
-
-    /* 注册行为 且 用户名未被使用*/
-    if(!isLogin && flag == true) {
-        LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
-            flag = false; 
+    // 处理函数归本请求所有，Init时释放，所以可以直接写post_和files_
+    auto upload = std::make_shared<FormUpload>(boundary, &post_, &files_);
+    return [upload](const char* data, size_t len) {
+        return len == 0 ? upload->Finish() : upload->Feed(data, len);
+    };
+}
+
+void HttpRequest::RemoveUploads() {
+    for(auto& file: files_) {
+        if(!file.path.empty() && unlink(file.path.c_str()) < 0) {
+            LOG_WARN("Remove upload file %s error: %s", file.path.c_str(), strerror(errno));
         }
-        flag = true;
     }
-    SqlConnPool::Instance()->FreeConn(sql);
-    LOG_DEBUG( "UserVerify success!!");
-    return flag;
+    files_.clear();
+}
+
+void HttpRequest::RunBlocking() {
+    assert(blocking_);
+    auto task = std::move(blocking_);
+    blocking_ = nullptr;
+    task(*this);
 }
 
 std::string HttpRequest::path() const{
@@ -3,23 +3,28 @@
 #define HTTP_REQUEST_H
 
 #include <unordered_map>
-#include <unordered_set>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <vector>
+#include <functional>
 #include <errno.h>     
-#include <mysql/mysql.h>  //mysql
+#include <stdint.h>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
-#include "../pool/sqlconnRAII.h"
+#include "multipart.h"
+#include "json.h"
 
 class HttpRequest {
 public:
     enum PARSE_STATE {
         REQUEST_LINE,  //正在解析请求行
         HEADERS,       //头
-        BODY,          //体
+        BODY,          //体，按Content-Length
+        CHUNK_SIZE,    //分块传输: 块大小行
+        CHUNK_DATA,    //块数据
+        CHUNK_CRLF,    //块数据后的CRLF
+        TRAILERS,      //最后一块之后的尾部字段
         FINISH,        //完成
     };
 
@@ -35,49 +40,149 @@ public:
     };
     
     HttpRequest() { Init(); }
-    ~HttpRequest() = default;
+    ~HttpRequest() { RemoveUploads(); }
+
+    // 请求头最多占的字节数，超过按400处理
+    static const size_t MAX_HEADER_BYTES = 65536;
+    // 分块传输中块大小行和尾部字段行的最大长度
+    static const size_t MAX_CHUNK_LINE = 1024;
+
+    /* 流式请求体: 请求头解析完、有请求体时由bodyHandlerFactory按请求选一个处理函数(可以为空)，
+       之后请求体(分块传输时是解码后的数据)每到一段就交给它，收完后再以len为0调用一次；返回false中止请求。
+       交出去的数据随即从读缓冲区去掉，每条连接最多只缓存一次读到的请求体。
+       没有处理函数时请求体攒在body_里，解析完后用body()取 */
+    using BodyHandler = std::function<bool(const char* data, size_t len)>;
+    using BodyHandlerFactory = std::function<BodyHandler(HttpRequest& request)>;
+    static BodyHandlerFactory bodyHandlerFactory;
+    // 攒在body_里的请求体的最大字节数，Content-Length或分块累计超过时按400处理
+    static size_t maxBodySize;
+    // 交给处理函数的请求体(如上传文件)不占内存，上限单独设置
+    static size_t maxStreamBodySize;
 
     void Init();
-    bool parse(Buffer& buff);
+    // 按RFC 9112增量解析: 数据不够一个完整请求(请求头加上Content-Length长的请求体)时返回NO_REQUEST，
+    // 保留解析状态和扫描位置，下次读到数据后从断开处继续；完整返回GET_REQUEST，不合法返回BAD_REQUEST。
+    // 请求完整之前buff中的数据不回收，完整后整个请求从buff中回收。上一个请求完成后再调用就开始解析下一个
+    HTTP_CODE parse(Buffer& buff);
 
     std::string path() const;
     std::string& path();
     std::string method() const;
     std::string version() const;
+    const std::string& body() const { return body_; }
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
 
     bool IsKeepAlive() const;
 
-    /* 
-    todo 
-    void HttpConn::ParseFormData() {}
-    void HttpConn::ParseJson() {}
-    */
+    // 常用请求头，解析时按名字识别一次，之后按下标直接取
+    enum HEADER {
+        HOST = 0,
+        CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        ACCEPT_ENCODING,
+        IF_NONE_MATCH,
+        RANGE,
+        COOKIE,
+        TRANSFER_ENCODING,
+        HEADER_NUM,
+    };
 
-private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    // 请求头的值，没有时返回空。指向读缓冲区，在读缓冲区再次写入或归还之前有效
+    std::string_view GetHeader(HEADER header) const;
+    bool HasHeader(HEADER header) const { return known_[header] != 0; }
+    // 按名字查，不区分大小写。同名的有多个时返回第一个
+    std::string_view GetHeader(std::string_view name) const;
+    size_t HeaderCount() const { return fieldNum_; }
+
+    // 已经读到一个完整请求
+    bool IsFinished() const { return state_ == FINISH; }
+
+    // 请求体是application/x-www-form-urlencoded，GetPost能取到表单字段
+    bool IsFormUrlencoded() const;
+    // 请求体是JSON时在解析请求时就地解析好(格式错误按400处理)，用Json()取。
+    // 值指向body()，在下一个请求开始之前有效；文档的存储随请求对象复用，不用每次分配
+    bool IsJson() const;
+    JsonValue Json() const { return json_.Root(); }
+
+    // multipart/form-data请求体的处理函数，路由的BodyFactory返回它即可: 文件部分边收边写进临时文件，
+    // 普通字段用GetPost取。不是multipart/form-data时返回空，请求体照常攒在body()里
+    BodyHandler FormDataHandler();
+    // 上传完的文件。临时文件在响应生成后删除，要保留的由处理函数移走(rename)并清空path
+    std::vector<UploadFile>& files() { return files_; }
+    void RemoveUploads();
+
+    // 会阻塞的处理(如查数据库)不在工作线程里做: 路由处理函数用SetBlocking登记，
+    // 由阻塞任务线程池调用RunBlocking完成，之后再生成响应
+    void SetBlocking(std::function<void(HttpRequest&)> task) { blocking_ = std::move(task); }
+    bool NeedBlocking() const { return static_cast<bool>(blocking_); }
+    void RunBlocking();
 
-    void ParsePath_();
-    void ParsePost_();
+private:
+    bool ParseRequestLine_(std::string_view line);
+    bool ParseHeader_(std::string_view line);
+    bool OnHeadersEnd_();
+    HTTP_CODE ParseBody_(Buffer& buff);
+    bool ParseChunkSize_(std::string_view line);
+    bool OnBody_(const char* data, size_t len);
+    bool OnBodyEnd_();
+    size_t BodyLimit_() const { return bodyHandler_ ? maxStreamBodySize : maxBodySize; }
+
+    std::string_view MediaType_() const;
+    bool ParsePost_();
     void ParseFromUrlencoded_();
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
-
     // 解析状态
     PARSE_STATE state_;
     // 请求方法，请求路径，协议版本，请求体
     std::string method_, path_, version_, body_;
-    // 请求头
-    std::unordered_map<std::string, std::string> header_;
+    // 请求头的名字和值，记录相对请求起始的偏移，读缓冲区扩容搬移数据后仍然有效
+    struct Field {
+        uint32_t nameOff, nameLen;
+        uint32_t valueOff, valueLen;
+    };
+    static const size_t INLINE_FIELDS = 24;
+
+    static int KnownHeader_(std::string_view name);
+    void AddField_(std::string_view name, std::string_view value, int known);
+    const Field& GetField_(size_t i) const {
+        return i < INLINE_FIELDS ? fields_[i] : moreFields_[i - INLINE_FIELDS];
+    }
+    std::string_view FieldValue_(const Field& field) const {
+        return std::string_view(base_ + field.valueOff, field.valueLen);
+    }
+
+    // 请求头: 前INLINE_FIELDS个放在对象里，多出来的放进moreFields_，清空时不释放，解析请求头不用分配内存
+    Field fields_[INLINE_FIELDS];
+    std::vector<Field> moreFields_;
+    size_t fieldNum_;
+    // 常用请求头在fields_中的下标+1，0表示没有
+    uint32_t known_[HEADER_NUM];
+    // 最近一次parse时请求在读缓冲区中的起始地址
+    const char* base_;
+    // 已经解析完的字节数，和当前行已经扫描过的字节数，都相对请求起始
+    size_t parsed_, scanned_;
+    // 请求体长度，来自Content-Length
+    size_t contentLen_;
+    // 分块传输，当前块还没收到的字节数
+    bool chunked_;
+    size_t chunkLeft_;
+    // 已经收到的请求体字节数
+    size_t bodyLen_;
+    // 流式请求体的处理函数，为空时攒在body_里
+    BodyHandler bodyHandler_;
+    // 解析完成时确定，之后不再依赖读缓冲区
+    bool keepAlive_;
     // post请求保单数据
     std::unordered_map<std::string, std::string> post_;
+    // multipart上传的文件
+    std::vector<UploadFile> files_;
+    // JSON请求体
+    JsonDoc json_;
+    // 待完成的阻塞处理
+    std::function<void(HttpRequest&)> blocking_;
 
-    // 默认的网页
-    static const std::unordered_set<std::string> DEFAULT_HTML;
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
     // 转换成十六进制
     static int ConverHex(char ch);
 };
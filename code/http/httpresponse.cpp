@@ -38,11 +38,13 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 404, "/404.html" },
 };
 
+int HttpResponse::fileSendMode = SENDFILE_SEND;
+size_t HttpResponse::sendfileMinSize = 16 << 10;
+
 HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
 };
 
@@ -54,30 +56,33 @@ HttpResponse::~HttpResponse() {
 void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
     assert(srcDir != "");
 
-    if(mmFile_) { UnmapFile(); }
+    UnmapFile();
 
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
     /* 判断请求的资源文件 */
-    // index.html
-    // 拼接成服务器资源的路径,判断如果访问的事一个文件夹返回404
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
-        code_ = 404;
-    }
-    // 如果没有权限访问,返回403
-    else if(!(mmFileStat_.st_mode & S_IROTH)) {
-        code_ = 403;
-    }
-    // code是默认值，-1的话就是成功了
-    else if(code_ == -1) { 
-        code_ = 200; 
+    // 调用者给出的错误码(如请求不合法的400)直接返回对应的错误页面，不再按请求路径找文件，
+    // 否则路径是目录或不存在时会被改成404
+    if(code_ == -1 || code_ == 200) {
+        // index.html
+        // 拼接成服务器资源的路径,判断如果访问的事一个文件夹返回404
+        if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+            code_ = 404;
+        }
+        // 如果没有权限访问,返回403
+        else if(!(mmFileStat_.st_mode & S_IROTH)) {
+            code_ = 403;
+        }
+        // code是默认值，-1的话就是成功了
+        else {
+            code_ = 200;
+        }
     }
     ErrorHtml_();
     AddStateLine_(buff);
@@ -86,7 +91,7 @@ void HttpResponse::MakeResponse(Buffer& buff) {
 }
 
 char* HttpResponse::File() {
-    return mmFile_;
+    return mmFile_.get();
 }
 
 size_t HttpResponse::FileLen() const {
@@ -133,25 +138,68 @@ void HttpResponse::AddContent_(Buffer& buff) {
         return; 
     }
 
+    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
+    /* sendfile: 只留着fd，发送时内核从页缓存直接拷到套接字，
+       不建立映射，也就没有munmap时各线程的TLB shootdown */
+    if(fileSendMode == SENDFILE_SEND && static_cast<size_t>(mmFileStat_.st_size) >= sendfileMinSize) {
+        fileFd_ = std::make_shared<FileHandle>(srcFd);
+        buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+        return;
+    }
+    /* 小文件: 直接读到响应头后面，输出链上只有一段内存，流水线的一批响应还是一次writev，
+       不会每个响应多一次sendfile。读完才写响应头，读失败时还能改成错误页 */
+    if(fileSendMode == SENDFILE_SEND) {
+        size_t size = mmFileStat_.st_size;
+        string header = "Content-length: " + to_string(size) + "\r\n\r\n";
+        buff.EnsureWriteable(header.size() + size);
+        char* dst = buff.BeginWrite();
+        bool ok = ReadFull_(srcFd, dst + header.size(), size);
+        close(srcFd);
+        if(!ok) {
+            ErrorContent(buff, "File NotFound!");
+            return;
+        }
+        memcpy(dst, header.data(), header.size());
+        buff.HasWritten(header.size() + size);
+        // 内容已经在缓冲区里，不再需要文件
+        mmFileStat_.st_size = 0;
+        return;
+    }
+
     /* 将文件映射到内存提高文件的访问速度 
         MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
+    void* mmRet = mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
+    close(srcFd);
+    if(mmRet == MAP_FAILED) {
         ErrorContent(buff, "File NotFound!");
         return; 
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
+    // 映射由引用计数管理，输出链还在发送时即使响应已经重新Init，映射也不会被释放
+    size_t size = mmFileStat_.st_size;
+    mmFile_ = std::shared_ptr<char>(static_cast<char*>(mmRet), [size](char* addr) { munmap(addr, size); });
     // 响应头部结束
     buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
 }
 
-void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
+// 从头读满len字节，文件变短或出错时返回false
+bool HttpResponse::ReadFull_(int fd, char* dst, size_t len) {
+    size_t done = 0;
+    while(done < len) {
+        ssize_t n = pread(fd, dst + done, len - done, done);
+        if(n < 0 && errno == EINTR) { continue; }
+        if(n <= 0) {
+            LOG_ERROR("Read file error: %s", n < 0 ? strerror(errno) : "file truncated");
+            return false;
+        }
+        done += n;
     }
+    return true;
+}
+
+// 只放掉本对象的引用，最后一个引用释放时解除映射、关闭文件
+void HttpResponse::UnmapFile() {
+    mmFile_.reset();
+    fileFd_.reset();
 }
 
 string HttpResponse::GetFileType_() {
@@ -3,6 +3,7 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <memory>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
@@ -10,6 +11,7 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../config/config.h"
 
 class HttpResponse {
 public:
@@ -18,16 +20,29 @@ public:
 
     void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
     void MakeResponse(Buffer& buff);
+    // 放掉本对象对文件映射或文件描述符的引用
     void UnmapFile();
     char* File();
+    // 文件映射的引用，交给输出链后即使本对象UnmapFile，映射也要等发送完才解除
+    std::shared_ptr<char> MappedFile() const { return mmFile_; }
+    // sendfile方式下打开的大文件，没有时为-1。引用同样交给输出链，发送完才关闭
+    int FileFd() const { return fileFd_ ? fileFd_->fd : -1; }
+    std::shared_ptr<const void> OpenedFile() const { return fileFd_; }
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
 
+    // 静态文件的发送方式，见FILE_SEND_MODE
+    static int fileSendMode;
+    // sendfile方式下小于该字节数的文件直接读进响应缓冲区
+    static size_t sendfileMinSize;
+    bool IsKeepAlive() const { return isKeepAlive_; }
+
 private:
     void AddStateLine_(Buffer &buff);
     void AddHeader_(Buffer &buff);
     void AddContent_(Buffer &buff);
+    static bool ReadFull_(int fd, char* dst, size_t len);
 
     void ErrorHtml_();
     std::string GetFileType_();
@@ -42,8 +57,15 @@ private:
     // 资源的目录
     std::string srcDir_;
     
-    // 文件内存映射的指针
-    char* mmFile_; 
+    // 文件内存映射，引用计数归零时munmap
+    std::shared_ptr<char> mmFile_;
+    // sendfile方式下打开的文件，引用计数归零时close
+    struct FileHandle {
+        int fd;
+        explicit FileHandle(int fd): fd(fd) {}
+        ~FileHandle() { close(fd); }
+    };
+    std::shared_ptr<FileHandle> fileFd_;
     // 文件的状态信息
     struct stat mmFileStat_;
 
@@ -0,0 +1,185 @@
+#include "httpscan.h"
+#include <string.h>  // memchr()
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+// 控制字符(HTAB除外)和DEL
+static bool IsCtl(unsigned char ch) {
+    return (ch < 0x20 && ch != '\t') || ch == 0x7f;
+}
+
+static const char* FindCtlScalar(const char* begin, const char* end) {
+    for(; begin < end; begin++) {
+        if(IsCtl(static_cast<unsigned char>(*begin))) { return begin; }
+    }
+    return end;
+}
+
+static const char* FindCharScalar(const char* begin, const char* end, char ch) {
+    const void* pos = memchr(begin, ch, end - begin);
+    return pos ? static_cast<const char*>(pos) : end;
+}
+
+static const char* FindJsonSpecialScalar(const char* begin, const char* end) {
+    for(; begin < end; begin++) {
+        unsigned char ch = static_cast<unsigned char>(*begin);
+        if(ch < 0x20 || ch == '"' || ch == '\\') { return begin; }
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+
+// pcmpestri按区间比较: [0x00,0x08] [0x0a,0x1f] [0x7f,0x7f]，一条指令得到16字节里第一个命中的下标
+__attribute__((target("sse4.2")))
+static const char* FindCtlSse42(const char* begin, const char* end) {
+    static const char RANGES[16] = { 0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f };
+    const __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i*>(RANGES));
+    while(end - begin >= 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        int idx = _mm_cmpestri(ranges, 6, data, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx != 16) { return begin + idx; }
+        begin += 16;
+    }
+    return FindCtlScalar(begin, end);
+}
+
+__attribute__((target("sse4.2")))
+static const char* FindCharSse42(const char* begin, const char* end, char ch) {
+    const __m128i target = _mm_set1_epi8(ch);
+    while(end - begin >= 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(data, target));
+        if(mask) { return begin + __builtin_ctz(mask); }
+        begin += 16;
+    }
+    return FindCharScalar(begin, end, ch);
+}
+
+// 区间 [0x00,0x1f] ['"','"'] ['\\','\\']
+__attribute__((target("sse4.2")))
+static const char* FindJsonSpecialSse42(const char* begin, const char* end) {
+    static const char RANGES[16] = { 0x00, 0x1f, '"', '"', '\\', '\\' };
+    const __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i*>(RANGES));
+    while(end - begin >= 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        int idx = _mm_cmpestri(ranges, 6, data, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx != 16) { return begin + idx; }
+        begin += 16;
+    }
+    return FindJsonSpecialScalar(begin, end);
+}
+
+// 有符号比较: 0 <= x < 0x20 的是控制字符(0x80以上是负数，不算)，再去掉HTAB、加上DEL
+__attribute__((target("avx2")))
+static const char* FindCtlAvx2(const char* begin, const char* end) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i minus = _mm256_set1_epi8(-1);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    while(end - begin >= 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i ctl = _mm256_and_si256(_mm256_cmpgt_epi8(space, data), _mm256_cmpgt_epi8(data, minus));
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(data, tab), ctl);
+        ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(data, del));
+        unsigned mask = _mm256_movemask_epi8(ctl);
+        if(mask) { return begin + __builtin_ctz(mask); }
+        begin += 32;
+    }
+    return FindCtlSse42(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char* FindCharAvx2(const char* begin, const char* end, char ch) {
+    const __m256i target = _mm256_set1_epi8(ch);
+    while(end - begin >= 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, target));
+        if(mask) { return begin + __builtin_ctz(mask); }
+        begin += 32;
+    }
+    return FindCharSse42(begin, end, ch);
+}
+
+// 无符号 x < 0x20 即 min(x, 0x1f) == x
+__attribute__((target("avx2")))
+static const char* FindJsonSpecialAvx2(const char* begin, const char* end) {
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i slash = _mm256_set1_epi8('\\');
+    while(end - begin >= 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_min_epu8(data, ctl), data);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, quote));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, slash));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if(mask) { return begin + __builtin_ctz(mask); }
+        begin += 32;
+    }
+    return FindJsonSpecialSse42(begin, end);
+}
+
+#endif // HTTP_SCAN_X86
+
+HttpScan::ISA HttpScan::isa_ = HttpScan::Detect_();
+const char* (*HttpScan::findCtl_)(const char*, const char*) = FindCtlScalar;
+const char* (*HttpScan::findChar_)(const char*, const char*, char) = FindCharScalar;
+const char* (*HttpScan::findJsonSpecial_)(const char*, const char*) = FindJsonSpecialScalar;
+
+HttpScan::ISA HttpScan::Detect_() {
+    ISA isa = SCALAR;
+    if(Supported(AVX2)) { isa = AVX2; }
+    else if(Supported(SSE42)) { isa = SSE42; }
+    UseIsa(isa);
+    return isa;
+}
+
+bool HttpScan::Supported(ISA isa) {
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    // AVX2实现的尾部用SSE4.2处理
+    if(isa == AVX2) { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"); }
+    if(isa == SSE42) { return __builtin_cpu_supports("sse4.2"); }
+#endif
+    return isa == SCALAR;
+}
+
+bool HttpScan::UseIsa(ISA isa) {
+    if(!Supported(isa)) { return false; }
+    switch(isa)
+    {
+#ifdef HTTP_SCAN_X86
+    case AVX2:
+        findCtl_ = FindCtlAvx2;
+        findChar_ = FindCharAvx2;
+        findJsonSpecial_ = FindJsonSpecialAvx2;
+        break;
+    case SSE42:
+        findCtl_ = FindCtlSse42;
+        findChar_ = FindCharSse42;
+        findJsonSpecial_ = FindJsonSpecialSse42;
+        break;
+#endif
+    default:
+        findCtl_ = FindCtlScalar;
+        findChar_ = FindCharScalar;
+        findJsonSpecial_ = FindJsonSpecialScalar;
+        break;
+    }
+    isa_ = isa;
+    return true;
+}
+
+const char* HttpScan::IsaName(ISA isa) {
+    switch(isa)
+    {
+    case AVX2: return "avx2";
+    case SSE42: return "sse4.2";
+    default: return "scalar";
+    }
+}
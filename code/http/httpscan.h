@@ -0,0 +1,49 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <cstddef>
+
+/* 请求解析用的字节扫描: 一次比较16(SSE4.2)或32(AVX2)字节，找行尾、冒号、非法字符和JSON字符串的结尾。
+   启动时按CPU支持的指令集选择实现，都不支持(或非x86)时用逐字节查表 */
+class HttpScan {
+public:
+    enum ISA {
+        SCALAR,
+        SSE42,
+        AVX2,
+    };
+
+    // [begin, end)中第一个控制字符(HTAB除外)或DEL的位置，没有返回end。
+    // CR、LF也是控制字符，所以返回的就是行尾，在它之前的字节都是合法的字段值
+    static const char* FindCtl(const char* begin, const char* end) {
+        return findCtl_(begin, end);
+    }
+
+    // [begin, end)中第一个ch的位置，没有返回end
+    static const char* FindChar(const char* begin, const char* end, char ch) {
+        return findChar_(begin, end, ch);
+    }
+
+    // [begin, end)中第一个'"'、'\\'或小于0x20的字节，没有返回end。
+    // JSON字符串里这之前的字节原样保留，解析时用来跳过字符串内容，序列化时找要转义的字符
+    static const char* FindJsonSpecial(const char* begin, const char* end) {
+        return findJsonSpecial_(begin, end);
+    }
+
+    static ISA Isa() { return isa_; }
+    static const char* IsaName(ISA isa);
+    // CPU是否支持该实现
+    static bool Supported(ISA isa);
+    // 切换实现，CPU不支持时返回false。只用于测试和基准测试
+    static bool UseIsa(ISA isa);
+
+private:
+    static ISA Detect_();
+
+    static ISA isa_;
+    static const char* (*findCtl_)(const char* begin, const char* end);
+    static const char* (*findChar_)(const char* begin, const char* end, char ch);
+    static const char* (*findJsonSpecial_)(const char* begin, const char* end);
+};
+
+#endif //HTTP_SCAN_H
@@ -0,0 +1,457 @@
+#include "json.h"
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <string.h>
+#include "httpscan.h"
+#include "../log/log.h"
+using namespace std;
+
+static inline bool IsJsonWs(char ch) { return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t'; }
+
+static inline const char* SkipWs(const char* p, const char* end) {
+    while(p < end && IsJsonWs(*p)) { p++; }
+    return p;
+}
+
+static inline bool IsDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+static int HexValue(char ch) {
+    if(IsDigit(ch)) { return ch - '0'; }
+    ch |= 0x20;
+    if(ch >= 'a' && ch <= 'f') { return ch - 'a' + 10; }
+    return -1;
+}
+
+// 4位十六进制，格式在解析时已经检查过
+static unsigned Hex4(const char* p) {
+    return (HexValue(p[0]) << 12) | (HexValue(p[1]) << 8) | (HexValue(p[2]) << 4) | HexValue(p[3]);
+}
+
+// 解码字符串的转义序列，解码出的字节依次交给out。单独的代理项换成U+FFFD
+template<typename Out>
+static bool Unescape(string_view raw, Out out) {
+    const char* p = raw.data();
+    const char* end = p + raw.size();
+    while(p < end) {
+        const char* slash = static_cast<const char*>(memchr(p, '\\', end - p));
+        const char* stop = slash ? slash : end;
+        for(; p < stop; p++) {
+            if(!out(*p)) { return false; }
+        }
+        if(!slash) { break; }
+        char ch = p[1];
+        p += 2;
+        switch(ch)
+        {
+        case 'b': ch = '\b'; break;
+        case 'f': ch = '\f'; break;
+        case 'n': ch = '\n'; break;
+        case 'r': ch = '\r'; break;
+        case 't': ch = '\t'; break;
+        case 'u': {
+            unsigned cp = Hex4(p);
+            p += 4;
+            if(cp >= 0xd800 && cp <= 0xdbff && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                unsigned low = Hex4(p + 2);
+                if(low >= 0xdc00 && low <= 0xdfff) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    p += 6;
+                }
+            }
+            if(cp >= 0xd800 && cp <= 0xdfff) { cp = 0xfffd; }
+            char utf8[4];
+            int n;
+            if(cp < 0x80) { utf8[0] = cp; n = 1; }
+            else if(cp < 0x800) { utf8[0] = 0xc0 | (cp >> 6); utf8[1] = 0x80 | (cp & 0x3f); n = 2; }
+            else if(cp < 0x10000) {
+                utf8[0] = 0xe0 | (cp >> 12); utf8[1] = 0x80 | ((cp >> 6) & 0x3f); utf8[2] = 0x80 | (cp & 0x3f); n = 3;
+            } else {
+                utf8[0] = 0xf0 | (cp >> 18); utf8[1] = 0x80 | ((cp >> 12) & 0x3f);
+                utf8[2] = 0x80 | ((cp >> 6) & 0x3f); utf8[3] = 0x80 | (cp & 0x3f); n = 4;
+            }
+            for(int i = 0; i < n; i++) {
+                if(!out(utf8[i])) { return false; }
+            }
+            continue;
+        }
+        default: break;  // '"' '\\' '/'
+        }
+        if(!out(ch)) { return false; }
+    }
+    return true;
+}
+
+/* ---------------- JsonValue ---------------- */
+
+JsonValue::TYPE JsonValue::Type() const {
+    return static_cast<TYPE>(doc_->nodes_[idx_].type);
+}
+
+bool JsonValue::GetBool(bool def) const {
+    if(!IsValid() || Type() != BOOL) { return def; }
+    return doc_->nodes_[idx_].size != 0;
+}
+
+bool JsonValue::TryGetInt(int64_t* value) const {
+    if(!IsNumber()) { return false; }
+    string_view raw = Raw();
+    auto res = from_chars(raw.data(), raw.data() + raw.size(), *value);
+    return res.ec == errc() && res.ptr == raw.data() + raw.size();
+}
+
+int64_t JsonValue::GetInt(int64_t def) const {
+    int64_t value;
+    return TryGetInt(&value) ? value : def;
+}
+
+double JsonValue::GetDouble(double def) const {
+    if(!IsNumber()) { return def; }
+    string_view raw = Raw();
+    double value;
+    auto res = from_chars(raw.data(), raw.data() + raw.size(), value);
+    // 超出范围时from_chars不给值
+    if(res.ec == errc::result_out_of_range) {
+        return raw[0] == '-' ? -numeric_limits<double>::infinity() : numeric_limits<double>::infinity();
+    }
+    return res.ec == errc() ? value : def;
+}
+
+string_view JsonValue::Raw() const {
+    if(!IsString() && !IsNumber()) { return string_view(); }
+    const JsonDoc::Node& node = doc_->nodes_[idx_];
+    return string_view(doc_->base_ + node.off, node.len);
+}
+
+bool JsonValue::HasEscape() const {
+    return IsValid() && (doc_->nodes_[idx_].flags & JsonDoc::ESCAPED);
+}
+
+string JsonValue::GetString() const {
+    if(!HasEscape()) { return string(Raw()); }
+    string str;
+    Unescape(Raw(), [&str](char ch) { str.push_back(ch); return true; });
+    return str;
+}
+
+bool JsonValue::Equals(string_view str) const {
+    if(!IsString()) { return false; }
+    if(!HasEscape()) { return Raw() == str; }
+    size_t i = 0;
+    bool same = Unescape(Raw(), [&str, &i](char ch) { return i < str.size() && str[i++] == ch; });
+    return same && i == str.size();
+}
+
+size_t JsonValue::Size() const {
+    if(!IsArray() && !IsObject()) { return 0; }
+    return doc_->nodes_[idx_].size;
+}
+
+JsonValue JsonValue::operator[](size_t i) const {
+    if(!IsArray()) { return JsonValue(); }
+    JsonValue value = First();
+    for(; i > 0 && value.IsValid(); i--) { value = value.Next(); }
+    return value;
+}
+
+JsonValue JsonValue::operator[](string_view key) const {
+    if(!IsObject()) { return JsonValue(); }
+    for(JsonValue value = First(); value.IsValid(); value = value.Next()) {
+        if(value.Name().Equals(key)) { return value; }
+    }
+    return JsonValue();
+}
+
+JsonValue JsonValue::First() const {
+    if(Size() == 0) { return JsonValue(); }
+    // 对象的第一个节点是键
+    return JsonValue(doc_, idx_ + (Type() == OBJECT ? 2 : 1));
+}
+
+JsonValue JsonValue::Next() const {
+    if(!IsValid() || idx_ == 0) { return JsonValue(); }
+    const JsonDoc::Node& node = doc_->nodes_[idx_];
+    if(node.flags & JsonDoc::LAST) { return JsonValue(); }
+    return JsonValue(doc_, node.next + ((node.flags & JsonDoc::MEMBER) ? 1 : 0));
+}
+
+JsonValue JsonValue::Name() const {
+    if(!IsValid() || !(doc_->nodes_[idx_].flags & JsonDoc::MEMBER)) { return JsonValue(); }
+    return JsonValue(doc_, idx_ - 1);
+}
+
+/* ---------------- JsonDoc ---------------- */
+
+void JsonDoc::Push_(JsonValue::TYPE type, uint8_t flags, const char* begin, size_t len, uint32_t size) {
+    uint32_t idx = nodes_.size();
+    nodes_.push_back(Node{static_cast<uint8_t>(type), flags, static_cast<uint32_t>(begin - base_),
+                          static_cast<uint32_t>(len), idx + 1, size});
+}
+
+bool JsonDoc::Parse(string_view text) {
+    nodes_.clear();
+    base_ = text.data();
+    if(text.size() > numeric_limits<uint32_t>::max()) {
+        LOG_ERROR("Json too large: %zu", text.size());
+        return false;
+    }
+    const char* p = text.data();
+    const char* end = p + text.size();
+    // 还没关闭的容器，和它最后一个子节点
+    struct Level {
+        uint32_t node;
+        uint32_t last;
+    };
+    Level stack[MAX_DEPTH];
+    size_t depth = 0;
+    uint8_t flags = 0;
+    bool ok = true;
+    p = SkipWs(p, end);
+    while(ok) {
+        // 一个值的开头
+        if(p == end) { ok = false; break; }
+        uint32_t idx = nodes_.size();
+        if(depth > 0) {
+            stack[depth - 1].last = idx;
+            nodes_[stack[depth - 1].node].size++;
+        }
+        char ch = *p;
+        if(ch == '{' || ch == '[') {
+            if(depth == MAX_DEPTH) {
+                LOG_ERROR("Json nested too deep");
+                ok = false;
+                break;
+            }
+            Push_(ch == '{' ? JsonValue::OBJECT : JsonValue::ARRAY, flags, p, 0);
+            stack[depth++] = {idx, idx};
+            p = SkipWs(p + 1, end);
+            if(p < end && *p != (ch == '{' ? '}' : ']')) {
+                // 非空容器，接着解析第一个元素/成员
+                flags = 0;
+                if(ch == '{') {
+                    ok = Key_(p, end);
+                    flags = MEMBER;
+                }
+                continue;
+            }
+        } else {
+            ok = Scalar_(p, end, flags);
+            p = SkipWs(p, end);
+        }
+        // 一个值结束: 逗号接着下一个，右括号关闭容器，可能连着关闭好几层
+        while(ok) {
+            if(depth == 0) {
+                ok = (p == end);
+                if(ok) { return true; }
+                break;
+            }
+            Level& top = stack[depth - 1];
+            Node& node = nodes_[top.node];
+            bool object = node.type == JsonValue::OBJECT;
+            if(p == end) { ok = false; break; }
+            if(*p == ',') {
+                p = SkipWs(p + 1, end);
+                flags = 0;
+                if(object) {
+                    ok = Key_(p, end);
+                    flags = MEMBER;
+                }
+                break;
+            }
+            if(*p != (object ? '}' : ']')) { ok = false; break; }
+            if(top.last != top.node) { nodes_[top.last].flags |= LAST; }
+            node.len = p + 1 - base_ - node.off;
+            node.next = nodes_.size();
+            depth--;
+            p = SkipWs(p + 1, end);
+        }
+    }
+    LOG_ERROR("Json parse error at offset %zu", static_cast<size_t>(p - base_));
+    nodes_.clear();
+    return false;
+}
+
+// 键和冒号，p停在值的开头
+bool JsonDoc::Key_(const char*& p, const char* end) {
+    if(p == end || *p != '"' || !String_(p, end, 0)) { return false; }
+    p = SkipWs(p, end);
+    if(p == end || *p != ':') { return false; }
+    p = SkipWs(p + 1, end);
+    return true;
+}
+
+// p指向开头的引号，成功后指向结尾引号之后
+bool JsonDoc::String_(const char*& p, const char* end, uint8_t flags) {
+    const char* begin = ++p;
+    while(true) {
+        p = HttpScan::FindJsonSpecial(p, end);
+        if(p == end) { return false; }
+        if(*p == '"') { break; }
+        if(*p != '\\' || end - p < 2) { return false; }  // 控制字符要转义
+        flags |= ESCAPED;
+        char ch = p[1];
+        if(ch == 'u') {
+            if(end - p < 6) { return false; }
+            for(int i = 2; i < 6; i++) {
+                if(HexValue(p[i]) < 0) { return false; }
+            }
+            p += 6;
+        } else if(strchr("\"\\/bfnrt", ch) && ch != '\0') {
+            p += 2;
+        } else {
+            return false;
+        }
+    }
+    Push_(JsonValue::STRING, flags, begin, p - begin);
+    p++;
+    return true;
+}
+
+bool JsonDoc::Scalar_(const char*& p, const char* end, uint8_t flags) {
+    const char* begin = p;
+    switch(*p)
+    {
+    case '"':
+        return String_(p, end, flags);
+    case 't':
+    case 'f':
+    case 'n': {
+        string_view word = *p == 't' ? "true" : (*p == 'f' ? "false" : "null");
+        if(static_cast<size_t>(end - p) < word.size() || memcmp(p, word.data(), word.size()) != 0) {
+            return false;
+        }
+        p += word.size();
+        if(word == "null") { Push_(JsonValue::NUL, flags, begin, word.size()); }
+        else { Push_(JsonValue::BOOL, flags, begin, word.size(), word == "true"); }
+        return true;
+    }
+    default:
+        break;
+    }
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    if(p < end && *p == '-') { p++; }
+    if(p == end || !IsDigit(*p)) { return false; }
+    if(*p == '0') { p++; }
+    else { while(p < end && IsDigit(*p)) { p++; } }
+    if(p < end && *p == '.') {
+        p++;
+        if(p == end || !IsDigit(*p)) { return false; }
+        while(p < end && IsDigit(*p)) { p++; }
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if(p < end && (*p == '+' || *p == '-')) { p++; }
+        if(p == end || !IsDigit(*p)) { return false; }
+        while(p < end && IsDigit(*p)) { p++; }
+    }
+    Push_(JsonValue::NUMBER, flags, begin, p - begin);
+    return true;
+}
+
+/* ---------------- JsonWriter ---------------- */
+
+void JsonWriter::Value_() {
+    if(afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+    if(depth_ == 0) { return; }
+    uint64_t bit = 1ULL << (depth_ - 1);
+    if(comma_ & bit) { buff_.Append(",", 1); }
+    comma_ |= bit;
+}
+
+void JsonWriter::Open_(char ch) {
+    assert(depth_ < 64);
+    Value_();
+    buff_.Append(&ch, 1);
+    depth_++;
+    comma_ &= ~(1ULL << (depth_ - 1));
+}
+
+void JsonWriter::Close_(char ch) {
+    assert(depth_ > 0 && !afterKey_);
+    depth_--;
+    buff_.Append(&ch, 1);
+}
+
+JsonWriter& JsonWriter::Key(string_view key) {
+    Value_();
+    buff_.Append("\"", 1);
+    Escaped_(key);
+    buff_.Append("\":", 2);
+    afterKey_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(string_view str) {
+    Value_();
+    buff_.Append("\"", 1);
+    Escaped_(str);
+    buff_.Append("\"", 1);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    Value_();
+    buff_.EnsureWriteable(24);
+    char* begin = buff_.BeginWrite();
+    buff_.HasWritten(to_chars(begin, begin + 24, value).ptr - begin);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Double(double value) {
+    if(!isfinite(value)) { return Null(); }
+    Value_();
+    buff_.EnsureWriteable(32);
+    char* begin = buff_.BeginWrite();
+    buff_.HasWritten(to_chars(begin, begin + 32, value).ptr - begin);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    Value_();
+    if(value) { buff_.Append("true", 4); }
+    else { buff_.Append("false", 5); }
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null() {
+    Value_();
+    buff_.Append("null", 4);
+    return *this;
+}
+
+// 不用转义的一段直接拷进缓冲区，只有引号、反斜杠和控制字符逐个处理
+void JsonWriter::Escaped_(string_view str) {
+    static const char HEX[] = "0123456789abcdef";
+    const char* p = str.data();
+    const char* end = p + str.size();
+    while(p < end) {
+        const char* special = HttpScan::FindJsonSpecial(p, end);
+        buff_.Append(p, special - p);
+        if(special == end) { break; }
+        char esc[6] = { '\\', 0 };
+        size_t len = 2;
+        switch(*special)
+        {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = HEX[(*special >> 4) & 0xf];
+            esc[5] = HEX[*special & 0xf];
+            len = 6;
+            break;
+        }
+        buff_.Append(esc, len);
+        p = special + 1;
+    }
+}
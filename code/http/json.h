@@ -0,0 +1,145 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+
+#include "../buffer/buffer.h"
+
+class JsonDoc;
+
+// JSON文档中的一个值，只是文档加下标，可以随意拷贝。不存在的值(找不到的键、越界的下标)IsValid为false，
+// 取值时返回默认值。字符串和数字都指向原文，在文档重新解析或原文释放之前有效
+class JsonValue {
+public:
+    enum TYPE {
+        NUL = 0,
+        BOOL,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT,
+    };
+
+    JsonValue(): doc_(nullptr), idx_(0) {}
+
+    bool IsValid() const { return doc_ != nullptr; }
+    TYPE Type() const;
+    bool IsNull() const { return IsValid() && Type() == NUL; }
+    bool IsString() const { return IsValid() && Type() == STRING; }
+    bool IsNumber() const { return IsValid() && Type() == NUMBER; }
+    bool IsArray() const { return IsValid() && Type() == ARRAY; }
+    bool IsObject() const { return IsValid() && Type() == OBJECT; }
+
+    bool GetBool(bool def = false) const;
+    // 不是整数或超出范围时返回false
+    bool TryGetInt(int64_t* value) const;
+    int64_t GetInt(int64_t def) const;
+    double GetDouble(double def = 0) const;
+    // 字符串的原文(不含引号，转义序列原样保留)，数字的原文，其他类型为空
+    std::string_view Raw() const;
+    // 字符串里有转义序列，没有时Raw()就是字符串的值
+    bool HasEscape() const;
+    // 解码后的字符串，有转义时才分配内存
+    std::string GetString() const;
+    // 和解码后的字符串比较，不分配内存
+    bool Equals(std::string_view str) const;
+
+    // 数组的元素数或对象的成员数
+    size_t Size() const;
+    // 数组的第i个元素，要走过前面的元素，顺序访问用First/Next
+    JsonValue operator[](size_t i) const;
+    JsonValue operator[](int i) const { return (*this)[static_cast<size_t>(i)]; }
+    // 对象的成员，同名的有多个时取第一个
+    JsonValue operator[](std::string_view key) const;
+    JsonValue operator[](const char* key) const { return (*this)[std::string_view(key)]; }
+    // 第一个元素/成员的值，和下一个兄弟，没有时IsValid为false
+    JsonValue First() const;
+    JsonValue Next() const;
+    // 对象成员的值对应的键，不是成员时IsValid为false
+    JsonValue Name() const;
+
+private:
+    friend class JsonDoc;
+    JsonValue(const JsonDoc* doc, uint32_t idx): doc_(doc), idx_(idx) {}
+
+    const JsonDoc* doc_;
+    uint32_t idx_;
+};
+
+/* 就地解析JSON(RFC 8259): 按先序把值记到一个数组里，容器记下子树结束的位置，字符串和数字只记在原文里的位置。
+   字符串内容用HttpScan一次跳过16/32字节。数组清空时不释放，同一个文档反复解析不再分配内存 */
+class JsonDoc {
+public:
+    // 嵌套的最大层数
+    static const size_t MAX_DEPTH = 64;
+
+    // 解析text，不拷贝，text要在文档使用期间一直有效。格式错误返回false，Root()不可用
+    bool Parse(std::string_view text);
+    void Clear() { nodes_.clear(); }
+    bool Empty() const { return nodes_.empty(); }
+    JsonValue Root() const { return nodes_.empty() ? JsonValue() : JsonValue(this, 0); }
+
+private:
+    friend class JsonValue;
+
+    enum FLAG {
+        ESCAPED = 1,  // 字符串里有转义序列
+        LAST = 2,     // 容器的最后一个元素/成员
+        MEMBER = 4,   // 对象成员的值，前一个节点是键
+    };
+
+    struct Node {
+        uint8_t type;
+        uint8_t flags;
+        uint32_t off;   // 在原文中的偏移，字符串不含引号
+        uint32_t len;
+        uint32_t next;  // 子树之后的下一个节点
+        uint32_t size;  // 容器的元素/成员数，true/false记在这里
+    };
+
+    bool String_(const char*& p, const char* end, uint8_t flags);
+    bool Scalar_(const char*& p, const char* end, uint8_t flags);
+    bool Key_(const char*& p, const char* end);
+    void Push_(JsonValue::TYPE type, uint8_t flags, const char* begin, size_t len, uint32_t size = 0);
+
+    std::vector<Node> nodes_;
+    const char* base_ = nullptr;
+};
+
+/* 把JSON直接写进Buffer(比如连接的写缓冲区)，不经过中间的string。
+   逗号按层自动加，对象里先Key再写值。数字用to_chars，非有限的浮点数写成null */
+class JsonWriter {
+public:
+    explicit JsonWriter(Buffer& buff): buff_(buff), depth_(0), comma_(0), afterKey_(false) {}
+
+    JsonWriter& BeginObject() { Open_('{'); return *this; }
+    JsonWriter& EndObject() { Close_('}'); return *this; }
+    JsonWriter& BeginArray() { Open_('['); return *this; }
+    JsonWriter& EndArray() { Close_(']'); return *this; }
+    JsonWriter& Key(std::string_view key);
+    JsonWriter& String(std::string_view str);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Double(double value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& Null();
+
+    // 所有容器都已经关闭
+    bool Complete() const { return depth_ == 0 && !afterKey_; }
+
+private:
+    void Value_();
+    void Open_(char ch);
+    void Close_(char ch);
+    void Escaped_(std::string_view str);
+
+    Buffer& buff_;
+    size_t depth_;
+    // 第i位表示第i层已经有值，下一个值前要加逗号
+    uint64_t comma_;
+    bool afterKey_;
+};
+
+#endif //JSON_H
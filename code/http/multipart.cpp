@@ -0,0 +1,333 @@
+#include "multipart.h"
+#include <string.h>
+#include <strings.h>  // strncasecmp()
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>   // mkstemp()
+#include "../log/log.h"
+using namespace std;
+
+static inline bool IsOws(char ch) { return ch == ' ' || ch == '\t'; }
+
+static string_view Trim(string_view s) {
+    while(!s.empty() && IsOws(s.front())) { s.remove_prefix(1); }
+    while(!s.empty() && IsOws(s.back())) { s.remove_suffix(1); }
+    return s;
+}
+
+static bool EqualsIgnoreCase(string_view a, string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// 从"; key=value; key="quoted value""中取下一个参数，rest随之后移。没有参数了返回false
+static bool NextParam(string_view& rest, string_view* key, string* value) {
+    while(!rest.empty() && (rest.front() == ';' || IsOws(rest.front()))) { rest.remove_prefix(1); }
+    if(rest.empty()) { return false; }
+    size_t end = rest.find_first_of("=;");
+    *key = Trim(rest.substr(0, end));
+    value->clear();
+    if(end == string_view::npos || rest[end] == ';') {
+        rest.remove_prefix(end == string_view::npos ? rest.size() : end);
+        return true;
+    }
+    rest.remove_prefix(end + 1);
+    while(!rest.empty() && IsOws(rest.front())) { rest.remove_prefix(1); }
+    if(!rest.empty() && rest.front() == '"') {
+        // quoted-string，反斜杠转义下一个字符
+        size_t i = 1;
+        for(; i < rest.size() && rest[i] != '"'; i++) {
+            if(rest[i] == '\\' && i + 1 < rest.size()) { i++; }
+            value->push_back(rest[i]);
+        }
+        rest.remove_prefix(min(i + 1, rest.size()));
+    } else {
+        end = rest.find(';');
+        value->assign(Trim(rest.substr(0, end)));
+        rest.remove_prefix(end == string_view::npos ? rest.size() : end);
+    }
+    return true;
+}
+
+MultipartParser::MultipartParser(string_view boundary):
+    state_(PREAMBLE), delim_("\r\n--"), headerBytes_(0), skip_(false) {
+    delim_.append(boundary);
+    // 第一个分隔符前面可以没有CRLF，当作请求体前面有一个
+    carry_ = "\r\n";
+}
+
+bool MultipartParser::GetBoundary(string_view contentType, string* boundary) {
+    size_t semi = contentType.find(';');
+    if(!EqualsIgnoreCase(Trim(contentType.substr(0, semi)), "multipart/form-data")) {
+        return false;
+    }
+    if(semi == string_view::npos) { return false; }
+    string_view rest = contentType.substr(semi);
+    string_view key;
+    string value;
+    while(NextParam(rest, &key, &value)) {
+        if(EqualsIgnoreCase(key, "boundary")) {
+            if(value.empty() || value.size() > MAX_BOUNDARY || value.back() == ' ') {
+                LOG_ERROR("Invalid multipart boundary");
+                return false;
+            }
+            *boundary = move(value);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MultipartParser::Feed(const char* data, size_t len) {
+    while(len > 0) {
+        switch(state_)
+        {
+        case PREAMBLE:
+        case PART_DATA: {
+            bool found = false;
+            size_t used = ScanData_(data, len, &found);
+            if(state_ == ERROR) { return false; }
+            data += used;
+            len -= used;
+            if(found) {
+                if(state_ == PART_DATA && !skip_ && !OnPartEnd_()) {
+                    state_ = ERROR;
+                    return false;
+                }
+                skip_ = false;
+                state_ = DELIMITER_END;
+                carry_.clear();
+                headerBytes_ = 0;
+            }
+            break;
+        }
+        case DELIMITER_END:
+        case PART_HEADERS: {
+            // 分隔符所在行和部分的头部按行处理，行不完整时先存起来
+            const char* lf = static_cast<const char*>(memchr(data, '\n', len));
+            size_t n = lf ? lf - data + 1 : len;
+            headerBytes_ += n;
+            if(headerBytes_ > MAX_PART_HEADER) {
+                LOG_ERROR("Multipart header too large");
+                state_ = ERROR;
+                return false;
+            }
+            if(!lf) {
+                carry_.append(data, len);
+                return true;
+            }
+            string_view line(data, n);
+            if(!carry_.empty()) {
+                carry_.append(data, n);
+                line = carry_;
+            }
+            data += n;
+            len -= n;
+            line.remove_suffix(1);
+            if(!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+            if(state_ == DELIMITER_END) {
+                if(line.substr(0, 2) == "--") {
+                    state_ = EPILOGUE;
+                } else if(!Trim(line).empty()) {
+                    LOG_ERROR("Invalid multipart delimiter line");
+                    state_ = ERROR;
+                    return false;
+                } else {
+                    part_ = MultipartPart();
+                    state_ = PART_HEADERS;
+                }
+            } else if(line.empty()) {
+                // 表单里没有选文件的文件框，浏览器也会发一个filename=""的空部分
+                if(part_.hasFilename && part_.filename.empty()) {
+                    skip_ = true;
+                } else if(!OnPartBegin_(part_)) {
+                    state_ = ERROR;
+                    return false;
+                }
+                state_ = PART_DATA;
+            } else if(!ParseHeaderLine_(line)) {
+                state_ = ERROR;
+                return false;
+            }
+            carry_.clear();
+            break;
+        }
+        case EPILOGUE:
+            return true;
+        case ERROR:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MultipartParser::Finish() {
+    // 结束分隔符"--"之后可以直接结束，没有CRLF
+    if(state_ == DELIMITER_END && carry_.compare(0, 2, "--") == 0) {
+        state_ = EPILOGUE;
+    }
+    if(state_ != EPILOGUE) {
+        LOG_ERROR("Multipart body ended early");
+        state_ = ERROR;
+        return false;
+    }
+    return true;
+}
+
+size_t MultipartParser::ScanData_(const char* data, size_t len, bool* found) {
+    if(!carry_.empty()) {
+        // 上一段留下的字节补上这一段开头，看分隔符是不是跨在两段之间
+        size_t old = carry_.size();
+        size_t n = min(len, delim_.size());
+        carry_.append(data, n);
+        size_t pos = carry_.find(delim_);
+        if(pos != string::npos) {
+            if(!Emit_(carry_.data(), pos)) { return 0; }
+            *found = true;
+            return pos + delim_.size() - old;
+        }
+        if(n == len) {
+            size_t keep = PartialDelimiter_(carry_.data(), carry_.size());
+            if(!Emit_(carry_.data(), carry_.size() - keep)) { return 0; }
+            carry_.erase(0, carry_.size() - keep);
+            return len;
+        }
+        // 补了一整个分隔符的长度还没找到，分隔符不会从留下的字节里开始
+        carry_.resize(old);
+        if(!Emit_(carry_.data(), old)) { return 0; }
+        carry_.clear();
+    }
+    const char* pos = static_cast<const char*>(memmem(data, len, delim_.data(), delim_.size()));
+    if(pos) {
+        if(!Emit_(data, pos - data)) { return 0; }
+        *found = true;
+        return pos - data + delim_.size();
+    }
+    size_t keep = PartialDelimiter_(data, len);
+    if(!Emit_(data, len - keep)) { return 0; }
+    carry_.assign(data + len - keep, keep);
+    return len;
+}
+
+bool MultipartParser::Emit_(const char* data, size_t len) {
+    if(len == 0 || state_ == PREAMBLE || skip_) { return true; }
+    if(!OnPartData_(data, len)) {
+        state_ = ERROR;
+        return false;
+    }
+    return true;
+}
+
+size_t MultipartParser::PartialDelimiter_(const char* data, size_t len) const {
+    size_t k = min(len, delim_.size() - 1);
+    for(; k > 0; k--) {
+        if(data[len - k] == '\r' && memcmp(data + len - k, delim_.data(), k) == 0) { break; }
+    }
+    return k;
+}
+
+bool MultipartParser::ParseHeaderLine_(string_view line) {
+    size_t colon = line.find(':');
+    if(colon == string_view::npos || colon == 0 || IsOws(line[0])) {
+        LOG_ERROR("Invalid multipart header");
+        return false;
+    }
+    string_view name = line.substr(0, colon);
+    string_view value = Trim(line.substr(colon + 1));
+    if(EqualsIgnoreCase(name, "Content-Disposition")) {
+        // form-data; name="field"; filename="a.txt"
+        string_view rest = value.substr(min(value.find(';'), value.size()));
+        string_view key;
+        string param;
+        while(NextParam(rest, &key, &param)) {
+            if(EqualsIgnoreCase(key, "name")) {
+                part_.name = move(param);
+            } else if(EqualsIgnoreCase(key, "filename")) {
+                part_.filename = move(param);
+                part_.hasFilename = true;
+            }
+        }
+    } else if(EqualsIgnoreCase(name, "Content-Type")) {
+        part_.contentType.assign(value);
+    }
+    return true;
+}
+
+string FormUpload::tmpDir = "/tmp";
+
+FormUpload::FormUpload(string_view boundary, unordered_map<string, string>* fields,
+                       vector<UploadFile>* files):
+    MultipartParser(boundary), fields_(fields), files_(files), fieldsBytes_(0), fd_(-1) {}
+
+FormUpload::~FormUpload() {
+    CloseFile_(true);
+}
+
+bool FormUpload::OnPartBegin_(const MultipartPart& part) {
+    if(!part.hasFilename) {
+        fieldName_ = part.name;
+        fieldValue_.clear();
+        return true;
+    }
+    string path = tmpDir + "/upload-XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if(fd_ < 0) {
+        LOG_ERROR("Create upload file in %s error: %s", tmpDir.c_str(), strerror(errno));
+        return false;
+    }
+    file_.name = part.name;
+    file_.filename = part.filename;
+    file_.contentType = part.contentType;
+    file_.path = move(path);
+    file_.size = 0;
+    return true;
+}
+
+bool FormUpload::OnPartData_(const char* data, size_t len) {
+    if(fd_ < 0) {
+        if(fieldValue_.size() + len > MAX_FIELD_BYTES || fieldsBytes_ + len > MAX_FIELDS_BYTES) {
+            LOG_WARN("Form field too large: %s", fieldName_.c_str());
+            return false;
+        }
+        fieldValue_.append(data, len);
+        fieldsBytes_ += len;
+        return true;
+    }
+    // 直接从读缓冲区写进文件
+    while(len > 0) {
+        ssize_t n = write(fd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Write upload file %s error: %s", file_.path.c_str(), strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+        file_.size += n;
+    }
+    return true;
+}
+
+bool FormUpload::OnPartEnd_() {
+    if(fd_ < 0) {
+        if(!fieldName_.empty()) {
+            (*fields_)[fieldName_] = fieldValue_;
+        }
+        return true;
+    }
+    CloseFile_(false);
+    LOG_DEBUG("Upload %s(%s) %zu bytes -> %s", file_.name.c_str(), file_.filename.c_str(),
+              file_.size, file_.path.c_str());
+    files_->push_back(move(file_));
+    file_ = UploadFile();
+    return true;
+}
+
+void FormUpload::CloseFile_(bool remove) {
+    if(fd_ < 0) { return; }
+    close(fd_);
+    fd_ = -1;
+    if(remove) {
+        unlink(file_.path.c_str());
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stddef.h>
+
+// multipart的一个部分的头部信息
+struct MultipartPart {
+    std::string name;          // Content-Disposition的name
+    std::string filename;      // Content-Disposition的filename，客户端给的，不能直接当路径用
+    std::string contentType;   // 没有时为空，按text/plain处理
+    bool hasFilename = false;  // 有filename参数的是文件，filename为空的(没有选文件)整个部分跳过
+};
+
+/* multipart/form-data(RFC 7578/2046)流式解析: 请求体每到一段调用一次Feed，收完调用Finish。
+   部分的数据直接以输入的指针交给OnPartData_，不拷贝；只有可能是分隔符开头的尾部几十字节
+   和部分的头部行需要留到下一段，每个请求占的内存和上传大小无关 */
+class MultipartParser {
+public:
+    // boundary最长70个字符
+    static const size_t MAX_BOUNDARY = 70;
+    // 一个部分的头部最多占的字节数
+    static const size_t MAX_PART_HEADER = 8192;
+
+    explicit MultipartParser(std::string_view boundary);
+    virtual ~MultipartParser() = default;
+
+    // 从Content-Type中取boundary，不是multipart/form-data或boundary不合法时返回false
+    static bool GetBoundary(std::string_view contentType, std::string* boundary);
+
+    // 格式错误或处理函数返回false时返回false，之后不能再调用
+    bool Feed(const char* data, size_t len);
+    // 请求体结束，没有读到结束分隔符时返回false
+    bool Finish();
+
+protected:
+    // 返回false中止解析
+    virtual bool OnPartBegin_(const MultipartPart& part) = 0;
+    virtual bool OnPartData_(const char* data, size_t len) = 0;
+    virtual bool OnPartEnd_() = 0;
+
+private:
+    enum STATE {
+        PREAMBLE,       // 第一个分隔符之前，丢弃
+        DELIMITER_END,  // 分隔符之后: "--"表示结束，否则到行尾
+        PART_HEADERS,
+        PART_DATA,
+        EPILOGUE,       // 结束分隔符之后，丢弃
+        ERROR,
+    };
+
+    // 在数据里找分隔符，之前的字节是部分的数据(序言里的丢弃)。找到返回用掉的字节数，没找到返回len
+    size_t ScanData_(const char* data, size_t len, bool* found);
+    bool Emit_(const char* data, size_t len);
+    // data以delim_的前缀结尾时，返回前缀的长度
+    size_t PartialDelimiter_(const char* data, size_t len) const;
+    bool ParseHeaderLine_(std::string_view line);
+
+    STATE state_;
+    // "\r\n--" + boundary
+    std::string delim_;
+    // 上一段末尾可能是分隔符开头的字节，或还不完整的一行
+    std::string carry_;
+    size_t headerBytes_;
+    MultipartPart part_;
+    // 当前部分被跳过，数据丢弃，也不调用OnPart*_
+    bool skip_;
+};
+
+// 上传的文件，已经写进临时文件
+struct UploadFile {
+    std::string name;
+    std::string filename;
+    std::string contentType;
+    std::string path;          // 临时文件路径，为空表示已经被移走
+    size_t size = 0;
+};
+
+/* multipart/form-data上传: 文件部分用write直接从读缓冲区写进临时文件，普通字段存进fields。
+   文件在部分结束时关闭，完整的才放进files；中途失败时未完成的临时文件在析构时删除 */
+class FormUpload : public MultipartParser {
+public:
+    FormUpload(std::string_view boundary, std::unordered_map<std::string, std::string>* fields,
+               std::vector<UploadFile>* files);
+    ~FormUpload() override;
+
+    // 临时文件所在目录
+    static std::string tmpDir;
+    // 普通字段的值最长的字节数，所有字段加起来最多MAX_FIELDS_BYTES
+    static const size_t MAX_FIELD_BYTES = 64 << 10;
+    static const size_t MAX_FIELDS_BYTES = 1 << 20;
+
+protected:
+    bool OnPartBegin_(const MultipartPart& part) override;
+    bool OnPartData_(const char* data, size_t len) override;
+    bool OnPartEnd_() override;
+
+private:
+    void CloseFile_(bool remove);
+
+    std::unordered_map<std::string, std::string>* fields_;
+    std::vector<UploadFile>* files_;
+    size_t fieldsBytes_;
+    // 正在写的文件
+    int fd_;
+    UploadFile file_;
+    // 正在收的普通字段
+    std::string fieldName_;
+    std::string fieldValue_;
+};
+
+#endif //MULTIPART_H
@@ -0,0 +1,127 @@
+#include "router.h"
+#include <cassert>
+
+Router* Router::Instance() {
+    static Router router;
+    return &router;
+}
+
+Router::Router(): root_(new Node()) {}
+
+Router::~Router() = default;
+
+void Router::Add(const std::string& method, const std::string& pattern, Handler handler, BodyFactory body) {
+    assert(handler);
+    if(pattern.empty() || pattern[0] != '/') {
+        LOG_ERROR("Route pattern must start with '/': %s", pattern.c_str());
+        return;
+    }
+    Node* node = root_.get();
+    std::string_view rest(pattern);
+    rest.remove_prefix(1);
+    while(!rest.empty()) {
+        size_t slash = rest.find('/');
+        std::string_view segment = rest.substr(0, slash);
+        rest = slash == std::string_view::npos ? std::string_view() : rest.substr(slash + 1);
+        if(segment == "*") {
+            // 前缀只能是最后一段
+            if(!rest.empty()) {
+                LOG_ERROR("Route '*' must be the last segment: %s", pattern.c_str());
+                return;
+            }
+            node->prefix.push_back({method, std::move(handler), std::move(body)});
+            return;
+        }
+        if(segment.size() > 1 && segment[0] == ':') {
+            if(!node->param) {
+                node->param.reset(new Node());
+                node->paramName = std::string(segment.substr(1));
+            } else if(node->paramName != segment.substr(1)) {
+                LOG_WARN("Route %s: parameter renamed, keep :%s", pattern.c_str(), node->paramName.c_str());
+            }
+            node = node->param.get();
+            continue;
+        }
+        Node* child = const_cast<Node*>(node->Child(segment));
+        if(!child) {
+            child = new Node();
+            node->children.emplace_back(std::string(segment), std::unique_ptr<Node>(child));
+        }
+        node = child;
+    }
+    node->routes.push_back({method, std::move(handler), std::move(body)});
+}
+
+const Router::Node* Router::Node::Child(std::string_view segment) const {
+    for(auto& child: children) {
+        if(child.first.size() == segment.size() && child.first == segment) { return child.second.get(); }
+    }
+    return nullptr;
+}
+
+void Router::Clear() {
+    root_.reset(new Node());
+}
+
+// 具体方法优先于"*"
+const Router::Route* Router::FindMethod_(const std::vector<Route>& routes, std::string_view method) {
+    const Route* any = nullptr;
+    for(auto& route: routes) {
+        if(route.method == method) { return &route; }
+        if(route.method == "*") { any = &route; }
+    }
+    return any;
+}
+
+const Router::Route* Router::Match_(std::string_view method, std::string_view path, RouteParams* params) const {
+    // 查询串不参与匹配；绝对形式和"*"这种请求目标没有路由
+    path = path.substr(0, path.find('?'));
+    if(path.empty() || path[0] != '/') { return nullptr; }
+    path.remove_prefix(1);
+    return MatchNode_(root_.get(), method, path, params);
+}
+
+// path是node以下剩余的路径。精确段走不通时退回参数段，再退回这一层的前缀
+const Router::Route* Router::MatchNode_(const Node* node, std::string_view method, std::string_view path,
+                                        RouteParams* params) const {
+    const Route* route = nullptr;
+    if(path.empty()) {
+        route = FindMethod_(node->routes, method);
+        if(route) { return route; }
+    } else {
+        size_t slash = path.find('/');
+        std::string_view segment = path.substr(0, slash);
+        std::string_view rest = slash == std::string_view::npos ? std::string_view() : path.substr(slash + 1);
+        const Node* child = node->Child(segment);
+        if(child) {
+            route = MatchNode_(child, method, rest, params);
+            if(route) { return route; }
+        }
+        if(node->param && !segment.empty()) {
+            params->Add(node->paramName, segment);
+            route = MatchNode_(node->param.get(), method, rest, params);
+            if(route) { return route; }
+            params->PopBack();
+        }
+    }
+    route = FindMethod_(node->prefix, method);
+    if(route) {
+        params->Add("*", path);
+    }
+    return route;
+}
+
+bool Router::Dispatch(HttpRequest& request) const {
+    RouteParams params;
+    const Route* route = Match_(request.method(), request.path(), &params);
+    if(!route) { return false; }
+    route->handler(request, params);
+    return true;
+}
+
+HttpRequest::BodyHandler Router::MakeBodyHandler(HttpRequest& request) const {
+    RouteParams params;
+    const Route* route = Match_(request.method(), request.path(), &params);
+    if(!route || !route->body) { return nullptr; }
+    return route->body(request, params);
+}
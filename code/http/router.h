@@ -0,0 +1,104 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "httprequest.h"
+
+// 路径参数，如"/user/:id"匹配"/user/42"得到id=42。值指向请求路径，在请求处理完之前有效。
+// 参数放在对象内部，匹配时不分配内存，超过MAX_PARAMS个的丢掉(PopBack仍按添加次数配对)
+class RouteParams {
+public:
+    static constexpr size_t MAX_PARAMS = 8;
+
+    std::string_view Get(std::string_view name) const {
+        for(size_t i = 0; i < Size(); i++) {
+            if(params_[i].Name() == name) { return params_[i].Value(); }
+        }
+        return std::string_view();
+    }
+    size_t Size() const { return size_ < MAX_PARAMS ? size_ : MAX_PARAMS; }
+    void Add(std::string_view name, std::string_view value) {
+        if(size_ < MAX_PARAMS) {
+            params_[size_] = {name.data(), name.size(), value.data(), value.size()};
+        }
+        size_++;
+    }
+    void PopBack() { size_--; }
+    void Clear() { size_ = 0; }
+
+private:
+    // 没有默认初始化，每次匹配不用先清零整个数组
+    struct Param {
+        const char* name;
+        size_t nameLen;
+        const char* value;
+        size_t valueLen;
+        std::string_view Name() const { return std::string_view(name, nameLen); }
+        std::string_view Value() const { return std::string_view(value, valueLen); }
+    };
+    Param params_[MAX_PARAMS];
+    size_t size_ = 0;
+};
+
+// 路由表: 启动时注册 方法 + 路径模式 -> 处理函数，之后只读，各线程并发查找不加锁。
+// 路径按'/'分段组成前缀树，匹配时逐段向下走，不用和每条路由逐个比较。
+// 路径模式:
+//   "/login"      精确匹配
+//   "/user/:id"   一段参数，值放进RouteParams
+//   "/static/*"   前缀匹配，"/static/"下的所有路径，剩下的部分放进参数"*"
+// 同一路径上精确段优先于参数段，参数段优先于前缀；方法"*"匹配任意方法，具体方法优先。
+// 没有匹配的请求按静态文件处理
+class Router {
+public:
+    // 请求完整后在工作线程中调用，可以改写path()决定返回的文件；有阻塞操作时用SetBlocking交给阻塞线程池。
+    // params指向请求路径，改写path()之后不能再用
+    using Handler = std::function<void(HttpRequest& request, const RouteParams& params)>;
+    // 请求头解析完、有请求体时调用，返回流式请求体的处理函数；为空时请求体攒在body()里。
+    // 上传文件用request.FormDataHandler()。params只在调用期间有效，处理函数要用时自己拷贝
+    using BodyFactory = std::function<HttpRequest::BodyHandler(HttpRequest& request, const RouteParams& params)>;
+
+    static Router* Instance();
+
+    Router();
+    ~Router();
+
+    void Add(const std::string& method, const std::string& pattern, Handler handler, BodyFactory body = nullptr);
+    // 清空路由表
+    void Clear();
+
+    // 找到路由就调用它的处理函数并返回true，没有返回false
+    bool Dispatch(HttpRequest& request) const;
+    // 请求体的处理函数，没有路由或路由没有给时返回空
+    HttpRequest::BodyHandler MakeBodyHandler(HttpRequest& request) const;
+
+private:
+    struct Route {
+        std::string method;
+        Handler handler;
+        BodyFactory body;
+    };
+
+    struct Node {
+        // 子节点。每层的分支都不多，按段长度和内容顺序比较比算哈希快
+        std::vector<std::pair<std::string, std::unique_ptr<Node>>> children;
+        const Node* Child(std::string_view segment) const;
+        std::unique_ptr<Node> param;   // ":name"段
+        std::string paramName;
+        std::vector<Route> routes;     // 路径在这里结束的路由
+        std::vector<Route> prefix;     // "*"，这一层以下的所有路径
+    };
+
+    static const Route* FindMethod_(const std::vector<Route>& routes, std::string_view method);
+    const Route* Match_(std::string_view method, std::string_view path, RouteParams* params) const;
+    const Route* MatchNode_(const Node* node, std::string_view method, std::string_view path,
+                            RouteParams* params) const;
+
+    std::unique_ptr<Node> root_;
+};
+
+#endif //ROUTER_H
@@ -0,0 +1,117 @@
+#include "routes.h"
+using namespace std;
+
+const char* const Routes::PAGES[] = {
+    "/index", "/register", "/login", "/welcome", "/video", "/picture",
+};
+
+void Routes::Register(Router* router, bool enableUpload) {
+    assert(router);
+    router->Add("*", "/", [](HttpRequest& request, const RouteParams&) {
+        request.path() = "/index.html";
+    });
+    for(const char* page: PAGES) {
+        string file = string(page) + ".html";
+        router->Add("*", page, [file](HttpRequest& request, const RouteParams&) {
+            request.path() = file;
+        });
+    }
+    // 表单提交的登录/注册要查数据库，登记成阻塞处理；其他的直接返回页面
+    const pair<const char*, bool> forms[] = {
+        {"/login", true}, {"/login.html", true}, {"/register", false}, {"/register.html", false},
+    };
+    for(auto& form: forms) {
+        bool isLogin = form.second;
+        router->Add("POST", form.first, [isLogin](HttpRequest& request, const RouteParams&) {
+            request.path() = isLogin ? "/login.html" : "/register.html";
+            if(request.IsFormUrlencoded()) {
+                request.SetBlocking([isLogin](HttpRequest& req) { Verify_(req, isLogin); });
+            }
+        });
+    }
+    // multipart/form-data上传: 文件边收边写进临时文件，不占内存。没有鉴权，只在配置打开时注册
+    if(!enableUpload) { return; }
+    router->Add("POST", "/upload", [](HttpRequest& request, const RouteParams&) {
+        Upload_(request);
+    }, [](HttpRequest& request, const RouteParams&) {
+        return request.FormDataHandler();
+    });
+}
+
+void Routes::Upload_(HttpRequest& request) {
+    for(const UploadFile& file: request.files()) {
+        LOG_INFO("Upload %s: %s(%s) %zu bytes", file.name.c_str(), file.filename.c_str(),
+                 file.contentType.c_str(), file.size);
+    }
+    request.path() = request.files().empty() ? "/error.html" : "/welcome.html";
+}
+
+void Routes::Verify_(HttpRequest& request, bool isLogin) {
+    if(UserVerify(request.GetPost("username"), request.GetPost("password"), isLogin)) {
+        request.path() = "/welcome.html";
+    }
+    else {
+        request.path() = "/error.html";
+    }
+}
+
+bool Routes::UserVerify(const string &name, const string &pwd, bool isLogin) {
+    if(name == "" || pwd == "") { return false; }
+    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+    MYSQL* sql;
+    SqlConnRAII(&sql,  SqlConnPool::Instance());
+    assert(sql);
+    
+    bool flag = false;
+    unsigned int j = 0;
+    char order[256] = { 0 };
+    MYSQL_FIELD *fields = nullptr;
+    MYSQL_RES *res = nullptr;
+    
+    if(!isLogin) { flag = true; }
+    /* 查询用户及密码 */
+    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
+    LOG_DEBUG("%s", order);
+
+    if(mysql_query(sql, order)) { 
+        mysql_free_result(res);
+        return false; 
+    }
+    res = mysql_store_result(sql);
+    j = mysql_num_fields(res);
+    fields = mysql_fetch_fields(res);
+
+    while(MYSQL_ROW row = mysql_fetch_row(res)) {
+        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
+        string password(row[1]);
+        /* 注册行为 且 用户名未被使用*/
+        if(isLogin) {
+            if(pwd == password) { flag = true; }
+            else {
+                flag = false;
+                LOG_DEBUG("pwd error!");
+            }
+        } 
+        else { 
+            flag = false; 
+            LOG_DEBUG("user used!");
+        }
+    }
+    mysql_free_result(res);
+
+    /* 注册行为 且 用户名未被使用*/
+    if(!isLogin && flag == true) {
+        LOG_DEBUG("regirster!");
+        bzero(order, 256);
+        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
+        LOG_DEBUG( "%s", order);
+        if(mysql_query(sql, order)) { 
+            LOG_DEBUG( "Insert error!");
+            flag = false; 
+        }
+        flag = true;
+    }
+    SqlConnPool::Instance()->FreeConn(sql);
+    LOG_DEBUG( "UserVerify success!!");
+    return flag;
+}
@@ -0,0 +1,29 @@
+#ifndef ROUTES_H
+#define ROUTES_H
+
+#include <string>
+#include <mysql/mysql.h>  //mysql
+
+#include "router.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/sqlconnRAII.h"
+
+// 本站的路由: 页面别名、登录/注册和文件上传。启动时注册一次
+class Routes {
+public:
+    // enableUpload为true时才注册POST /upload，见Config::enableUpload
+    static void Register(Router* router, bool enableUpload = false);
+
+private:
+    // 不带后缀的页面名，"/login"返回"/login.html"
+    static const char* const PAGES[];
+
+    static void Verify_(HttpRequest& request, bool isLogin);
+    // 上传演示: 记下收到的文件，返回欢迎页，没有文件时返回错误页。
+    // 没有移走的临时文件在响应生成后删除，要保留的在这里rename到别处并清空path
+    static void Upload_(HttpRequest& request);
+    // 查数据库，在阻塞任务线程池中执行
+    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+};
+
+#endif //ROUTES_H
@@ -4,15 +4,37 @@
  * @copyleft Apache 2.0
  */ 
 #include <unistd.h>
+#include <stdlib.h>
 #include <string>
 #include "server/webserver.h"
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    Config config;                     /* 其余可选配置见 config/config.h */
+    if(argc > 1) {
+        config.reactorMode = atoi(argv[1]);  /* 0 单反应堆+线程池 1 主从多反应堆 2 协程 */
+    }
+    if(argc > 2) {
+        config.reusePort = atoi(argv[2]);    /* 1 每个从反应堆一个SO_REUSEPORT监听套接字 */
+    }
+    if(argc > 3) {
+        config.ioBackend = atoi(argv[3]);    /* 0 epoll 1 io_uring */
+    }
+    if(argc > 4) {
+        config.poolType = atoi(argv[4]);     /* 0 共享队列线程池 1 工作窃取线程池 */
+    }
+    if(argc > 5) {
+        config.poolMaxThreads = atoi(argv[5]); /* 共享队列线程池弹性伸缩的最大线程数 */
+    }
+    if(argc > 6) {
+        config.fileSendMode = atoi(argv[6]);   /* 0 sendfile 1 mmap+writev */
+    }
 
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 4, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 4, true, 1, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        config);
     server.Start();
 } 
   
\ No newline at end of file
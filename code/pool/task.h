@@ -0,0 +1,183 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>      // std::max_align_t
+#include <assert.h>
+#include <new>          // placement new
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+/* 只能移动的任务对象，可调用对象直接构造在内部固定大小的缓冲区里，
+   不像std::function那样在捕获较大时去堆上分配。
+   捕获超过CAPACITY字节(或过度对齐、移动可能抛异常)时退回堆上分配，缓冲区里只放指针，
+   热路径上的任务应该只捕获句柄或指针，保持在缓冲区内 */
+class Task {
+public:
+    static const size_t CAPACITY = 48;
+
+    // 可调用类型F能否直接放进内部缓冲区
+    template<class F>
+    static constexpr bool FitsInline() {
+        typedef typename std::decay<F>::type Fn;
+        return sizeof(Fn) <= CAPACITY && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    Task() noexcept : ops_(nullptr) {}
+
+    Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        if constexpr(FitsInline<Fn>()) {
+            ops_ = &OpsFor<Fn>::ops;
+            new (&storage_) Fn(std::forward<F>(f));
+        } else {
+            ops_ = &HeapOpsFor<Fn>::ops;
+            new (&storage_) Fn*(new Fn(std::forward<F>(f)));
+        }
+    }
+
+    Task(Task&& other) noexcept : ops_(other.ops_) {
+        if(ops_) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            Reset_();
+            ops_ = other.ops_;
+            if(ops_) {
+                ops_->move(&storage_, &other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept {
+        Reset_();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { Reset_(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(&storage_);
+    }
+
+private:
+    typedef typename std::aligned_storage<CAPACITY, alignof(std::max_align_t)>::type Storage;
+
+    // 每种可调用类型一张静态函数表，代替虚函数
+    struct Ops {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);   // 移动构造到dst并析构src
+        void (*destroy)(void* self);
+    };
+
+    template<class Fn>
+    struct OpsFor {
+        static void Invoke(void* self) { (*static_cast<Fn*>(self))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* self) { static_cast<Fn*>(self)->~Fn(); }
+        static const Ops ops;
+    };
+
+    // 放不进缓冲区的可调用对象在堆上，缓冲区里只存指针，移动时只搬指针
+    template<class Fn>
+    struct HeapOpsFor {
+        static Fn*& Ptr(void* self) { return *static_cast<Fn**>(self); }
+        static void Invoke(void* self) { (*Ptr(self))(); }
+        static void Move(void* dst, void* src) { new (dst) Fn*(Ptr(src)); }
+        static void Destroy(void* self) { delete Ptr(self); }
+        static const Ops ops;
+    };
+
+    void Reset_() {
+        if(ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    Storage storage_;
+    const Ops* ops_;
+};
+
+template<class Fn>
+const Task::Ops Task::OpsFor<Fn>::ops = { &Task::OpsFor<Fn>::Invoke, &Task::OpsFor<Fn>::Move, &Task::OpsFor<Fn>::Destroy };
+
+template<class Fn>
+const Task::Ops Task::HeapOpsFor<Fn>::ops = { &Task::HeapOpsFor<Fn>::Invoke, &Task::HeapOpsFor<Fn>::Move, &Task::HeapOpsFor<Fn>::Destroy };
+
+/* 预分配的环形队列，本身不加锁，由线程池的互斥量保护。
+   满了才按两倍扩容，稳定运行后入队出队都不分配内存 */
+template<class T>
+class RingQueue {
+public:
+    explicit RingQueue(size_t capacity = 1024) : buffer_(RoundUp_(capacity)), head_(0), size_(0) {}
+
+    bool empty() const { return size_ == 0; }
+
+    size_t size() const { return size_; }
+
+    size_t capacity() const { return buffer_.size(); }
+
+    void push(T&& item) {
+        if(size_ == buffer_.size()) { Grow_(); }
+        buffer_[(head_ + size_) & (buffer_.size() - 1)] = std::move(item);
+        size_++;
+    }
+
+    T pop() {
+        assert(size_ > 0);
+        T item(std::move(buffer_[head_]));
+        head_ = (head_ + 1) & (buffer_.size() - 1);
+        size_--;
+        return item;
+    }
+
+    const T& front() const {
+        assert(size_ > 0);
+        return buffer_[head_];
+    }
+
+private:
+    static size_t RoundUp_(size_t n) {
+        size_t cap = 2;
+        while(cap < n) { cap <<= 1; }
+        return cap;
+    }
+
+    void Grow_() {
+        std::vector<T> buffer(buffer_.size() * 2);
+        for(size_t i = 0; i < size_; i++) {
+            buffer[i] = std::move(buffer_[(head_ + i) & (buffer_.size() - 1)]);
+        }
+        buffer_.swap(buffer);
+        head_ = 0;
+    }
+
+    std::vector<T> buffer_;
+    size_t head_;
+    size_t size_;
+};
+
+typedef RingQueue<Task> TaskQueue;
+
+#endif //TASK_H
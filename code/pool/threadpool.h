@@ -2,45 +2,54 @@
  * @Author       : 晚乔最美
  * @Date         : 2023-06-15
  * @copyleft Apache 2.0
- */ 
+ */
 
 #ifndef THREADPOOL_H // 如果 THREADPOOL_H 未定义（防止头文件被重复包含）
 #define THREADPOOL_H // 定义 THREADPOOL_H
 
 #include <mutex> // 包含互斥量相关的头文件
 #include <condition_variable> // 包含条件变量相关的头文件
-#include <queue> // 包含队列相关的头文件
 #include <thread> // 包含线程相关的头文件
 #include <functional> // 包含函数对象相关的头文件
+#include <chrono> // 计算任务排队时间
+#include <vector> // 保存工作线程
+#include <algorithm> // std::nth_element
+#include "task.h" // 任务对象和预分配的环形任务队列
+#include "../log/log.h" // 伸缩时记录日志
 
 class ThreadPool { // 线程池类的声明开始
 public: // 公有成员部分
 
-    explicit ThreadPool(size_t threadCount = 8) // 构造函数，指定默认线程数量为8
-        : pool_(std::make_shared<Pool>()) { // 初始化线程池对象，使用std::make_shared创建Pool结构体的智能指针
-        assert(threadCount > 0); // 断言，确保线程数量大于0
-
-        // 创建threadCount个子线程
-        for (size_t i = 0; i < threadCount; i++) { // 循环创建指定数量的子线程
-            
-            std::thread([pool = pool_] { // 创建一个子线程，并捕获线程池的共享指针
-                std::unique_lock<std::mutex> locker(pool->mtx); // 创建互斥锁，并锁定互斥量
-                while (true) { // 无限循环
-                    if (!pool->tasks.empty()) { // 如果任务队列不为空
-                        auto task = std::move(pool->tasks.front()); // 获取队列首个任务，并移动到局部变量中
-                        pool->tasks.pop(); // 从队列中移除任务
-                        locker.unlock(); // 解锁互斥量
-                        task(); // 执行任务
-                        locker.lock(); // 再次锁定互斥量
-                    } else if (pool->isClosed) { // 如果任务队列为空且线程池已关闭
-                        break; // 退出循环
-                    } else {
-                        pool->cond.wait(locker); // 使用条件变量等待通知
-                    }
-                }
-            }
-            
-            ).detach(); // 设置线程为分离状态，使其在结束时自动释放资源
+    // 线程池运行状态
+    struct Stats {
+        size_t threads;      // 当前线程数
+        size_t idle;         // 空闲线程数
+        size_t queued;       // 排队中的任务数
+        long waitP95Us;      // 最近一批任务排队时间的p95，微秒
+        long waitMaxUs;      // 最近一批任务的最长排队时间，微秒
+        unsigned long done;  // 已取出执行的任务总数
+    };
+
+    explicit ThreadPool(size_t threadCount = 8, size_t queueCapacity = 1024) // 构造函数，指定默认线程数量为8，任务队列预分配queueCapacity个槽位
+        : ThreadPool(threadCount, threadCount, 0, 0, queueCapacity) {} // 固定线程数，不伸缩
+
+    // 弹性模式: 线程数在[minThreads, maxThreads]之间，
+    // 排队时间p95超过waitTargetMs时加线程，线程空闲超过idleMs时退出(不少于minThreads)
+    ThreadPool(size_t minThreads, size_t maxThreads, int waitTargetMs, int idleMs, size_t queueCapacity = 1024)
+        : pool_(std::make_shared<Pool>(queueCapacity)) { // 初始化线程池对象，使用std::make_shared创建Pool结构体的智能指针
+        assert(minThreads > 0 && maxThreads >= minThreads); // 断言，确保线程数量大于0
+        pool_->minThreads = minThreads;
+        pool_->maxThreads = maxThreads;
+        pool_->waitTargetUs = waitTargetMs * 1000L;
+        pool_->idleMs = idleMs;
+
+        std::lock_guard<std::mutex> locker(pool_->mtx);
+        // 创建minThreads个子线程，线程不再detach，析构时逐个join
+        for (size_t i = 0; i < minThreads; i++) {
+            Spawn_(pool_.get());
+        }
+        if (IsElastic()) {
+            pool_->monitor = std::thread(Monitor_, pool_.get()); // 弹性模式下由监控线程决定是否扩容
         }
     }
 
@@ -55,6 +64,12 @@ public: // 公有成员部分
                 pool_->isClosed = true; // 设置线程池已关闭标志为true
             } // 结束临界区域
             pool_->cond.notify_all(); // 唤醒所有等待的线程
+            pool_->monitorCond.notify_all();
+            if (pool_->monitor.joinable()) { pool_->monitor.join(); }
+            // 关闭后不会再创建线程，工作线程执行完剩余任务后退出
+            for (auto& t : pool_->threads) {
+                if (t.joinable()) { t.join(); }
+            }
         }
     }
 
@@ -62,20 +77,162 @@ public: // 公有成员部分
     void AddTask(F&& task) { // 接受一个可调用对象作为参数
         {
             std::lock_guard<std::mutex> locker(pool_->mtx); // 创建互斥量锁定对象，自动释放锁
-            pool_->tasks.emplace(std::forward<F>(task)); // 将任务添加到任务队列中
+            pool_->tasks.push(Item{ Task(std::forward<F>(task)), Clock::now() }); // 将任务和入队时间添加到任务队列中，捕获直接放在Task内部，不分配内存
         }
         pool_->cond.notify_one(); // 唤醒一个等待的线程
     }
 
+    bool IsElastic() const { return pool_ && pool_->maxThreads > pool_->minThreads; }
+
+    Stats GetStats() const {
+        std::lock_guard<std::mutex> locker(pool_->mtx);
+        long p95 = 0, maxWait = 0;
+        WaitPercentile_(pool_.get(), p95, maxWait);
+        return { pool_->threadNum, pool_->idleNum, pool_->tasks.size(), p95, maxWait, pool_->done };
+    }
+
 private: // 私有成员部分
 
+    typedef std::chrono::steady_clock Clock;
+
+    struct Item {
+        Task task;                 // 任务
+        Clock::time_point enqueue; // 入队时间
+    };
+
+    enum {
+        WAIT_WINDOW = 256, // 统计排队时间的样本数
+        CHECK_MS = 50,     // 监控线程检查间隔
+    };
+
     struct Pool { // 内部结构体 Pool，用于管理线程池的相关信息
+        explicit Pool(size_t queueCapacity)
+            : isClosed(false), tasks(queueCapacity), minThreads(0), maxThreads(0), waitTargetUs(0), idleMs(0),
+              threadNum(0), idleNum(0), done(0), waits(WAIT_WINDOW, 0), waitCnt(0) {}
         std::mutex mtx; // 互斥锁，保护线程池相关数据结构
         std::condition_variable cond; // 条件变量，用于线程之间的同步
+        std::condition_variable monitorCond; // 监控线程定时等待用
         bool isClosed; // 标志位，表示线程池是否关闭
-        std::queue<std::function<void()>> tasks; // 任务队列，保存待执行的任务
+        RingQueue<Item> tasks; // 预分配的环形任务队列，保存待执行的任务
+
+        size_t minThreads;   // 最少线程数
+        size_t maxThreads;   // 最多线程数
+        long waitTargetUs;   // 排队时间p95目标
+        int idleMs;          // 空闲多久后退出
+
+        std::vector<std::thread> threads; // 工作线程，下标即槽位
+        std::vector<size_t> exited;       // 已退出、待join复用的槽位
+        std::thread monitor;              // 监控线程
+        size_t threadNum;                 // 存活线程数
+        size_t idleNum;                   // 空闲线程数
+        unsigned long done;               // 已取出的任务数
+        std::vector<long> waits;          // 最近WAIT_WINDOW个任务的排队时间，微秒
+        size_t waitCnt;                   // 累计样本数
     };
 
+    // 加一个工作线程，调用方持有锁
+    static void Spawn_(Pool* pool) {
+        size_t slot;
+        if (!pool->exited.empty()) {
+            // 能看到退出槽位说明该线程已经离开循环，只剩在锁外写日志和返回，这里join不会死锁
+            slot = pool->exited.back();
+            pool->exited.pop_back();
+            pool->threads[slot].join();
+        } else {
+            slot = pool->threads.size();
+            pool->threads.emplace_back();
+        }
+        pool->threadNum++;
+        pool->threads[slot] = std::thread(Work_, pool, slot);
+    }
+
+    static void Work_(Pool* pool, size_t slot) {
+        bool shrink = false;
+        std::unique_lock<std::mutex> locker(pool->mtx); // 创建互斥锁，并锁定互斥量
+        while (true) { // 无限循环
+            if (!pool->tasks.empty()) { // 如果任务队列不为空
+                Item item = pool->tasks.pop(); // 从队列中取出首个任务，移动到局部变量中
+                RecordWait_(pool, item.enqueue);
+                locker.unlock(); // 解锁互斥量
+                item.task(); // 执行任务
+                item.task = nullptr; // 在锁外析构任务的捕获
+                locker.lock(); // 再次锁定互斥量
+            } else if (pool->isClosed) { // 如果任务队列为空且线程池已关闭
+                break; // 退出循环
+            } else if (pool->maxThreads > pool->minThreads) {
+                // 弹性模式: 空闲超时且线程数多于下限时退出
+                pool->idleNum++;
+                bool timeout = pool->cond.wait_for(locker, std::chrono::milliseconds(pool->idleMs)) == std::cv_status::timeout;
+                pool->idleNum--;
+                if (timeout && pool->tasks.empty() && !pool->isClosed && pool->threadNum > pool->minThreads) {
+                    shrink = true;
+                    break;
+                }
+            } else {
+                pool->idleNum++;
+                pool->cond.wait(locker); // 使用条件变量等待通知
+                pool->idleNum--;
+            }
+        }
+        pool->threadNum--;
+        int threadNum = static_cast<int>(pool->threadNum);
+        if (!pool->isClosed) { pool->exited.push_back(slot); } // 关闭时由析构函数统一join
+        locker.unlock();
+        // 写日志可能阻塞，不占着线程池的锁
+        if (shrink) { LOG_INFO("ThreadPool shrink to %d threads", threadNum); }
+    }
+
+    static void RecordWait_(Pool* pool, Clock::time_point enqueue) {
+        long us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - enqueue).count();
+        pool->waits[pool->waitCnt % WAIT_WINDOW] = us;
+        pool->waitCnt++;
+        pool->done++;
+    }
+
+    // 计算窗口内排队时间的p95和最大值，调用方持有锁。
+    // 队首任务还没被取走也算一个样本，所有线程都被阻塞时也能发现排队
+    static void WaitPercentile_(Pool* pool, long& p95, long& maxWait) {
+        size_t n = std::min(pool->waitCnt, static_cast<size_t>(WAIT_WINDOW));
+        std::vector<long> samples(pool->waits.begin(), pool->waits.begin() + n);
+        if (!pool->tasks.empty()) {
+            samples.push_back(HeadWait_(pool));
+        }
+        p95 = maxWait = 0;
+        if (samples.empty()) { return; }
+        maxWait = *std::max_element(samples.begin(), samples.end());
+        auto nth = samples.begin() + (samples.size() - 1) * 95 / 100;
+        std::nth_element(samples.begin(), nth, samples.end());
+        p95 = *nth;
+    }
+
+    // 队首任务已经排了多久，微秒，调用方持有锁且队列非空
+    static long HeadWait_(Pool* pool) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - pool->tasks.front().enqueue).count();
+    }
+
+    // 监控线程: 每CHECK_MS看一次排队时间，超过目标且没有空闲线程时加一个线程。
+    // 工作线程全被阻塞时窗口里没有新样本，p95可能还是旧的小值，队首任务等得超过目标也要扩容
+    static void Monitor_(Pool* pool) {
+        std::unique_lock<std::mutex> locker(pool->mtx);
+        while (!pool->isClosed) {
+            pool->monitorCond.wait_for(locker, std::chrono::milliseconds(static_cast<int>(CHECK_MS)));
+            if (pool->isClosed) { break; }
+            long p95 = 0, maxWait = 0;
+            WaitPercentile_(pool, p95, maxWait);
+            if (!pool->tasks.empty() && (p95 > pool->waitTargetUs || HeadWait_(pool) > pool->waitTargetUs)
+                && pool->idleNum == 0 && pool->threadNum < pool->maxThreads) {
+                Spawn_(pool);
+                int threadNum = static_cast<int>(pool->threadNum);
+                // 用新的样本判断下一次扩容
+                pool->waitCnt = 0;
+                locker.unlock();
+                LOG_INFO("ThreadPool grow to %d threads, queue wait p95: %ldus, max: %ldus",
+                         threadNum, p95, maxWait);
+                locker.lock();
+            }
+        }
+    }
+
     std::shared_ptr<Pool> pool_; // 指向 Pool 结构体的智能指针，用于管理线程池的生命周期
 };
 
@@ -0,0 +1,222 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <assert.h>
+#include "task.h"
+
+/* 有界无锁多生产者多消费者环形队列(Vyukov)，每个槽位带序号，
+   入队和出队各自只CAS一个下标，任何线程都可以从中取任务(窃取) */
+template<class T>
+class MpmcRing {
+public:
+    explicit MpmcRing(size_t capacity)
+        : mask_(RoundUp_(capacity) - 1), cells_(new Cell[mask_ + 1]), enqPos_(0), deqPos_(0) {
+        for(size_t i = 0; i <= mask_; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(T&& item) {
+        Cell* cell;
+        size_t pos = enqPos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(dif == 0) {
+                if(enqPos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            } else if(dif < 0) {
+                return false;  // 满了
+            } else {
+                pos = enqPos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& item) {
+        Cell* cell;
+        size_t pos = deqPos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(dif == 0) {
+                if(deqPos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+            } else if(dif < 0) {
+                return false;  // 空的
+            } else {
+                pos = deqPos_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static size_t RoundUp_(size_t n) {
+        size_t cap = 2;
+        while(cap < n) { cap <<= 1; }
+        return cap;
+    }
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    char pad0_[64];
+    std::atomic<size_t> enqPos_;
+    char pad1_[64];                 // 两个下标分开缓存行，生产者和消费者互不干扰
+    std::atomic<size_t> deqPos_;
+};
+
+/* 工作窃取线程池: 每个工作线程一个无锁任务队列，
+   外部线程提交时轮流放入各个队列，工作线程自己提交的任务放入自己的队列，
+   自己的队列空了就去别的队列窃取，都空了在自己的条件变量上休眠，没有全局锁。
+   队列全满时外部线程让出CPU等待，工作线程就地执行任务。析构时先执行完已入队的任务再退出。
+   接口与ThreadPool相同，WebServer可以通过配置切换 */
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t threadCount = 8, size_t queueCapacity = 4096)
+        : isClosed_(false), sleepers_(0), next_(0) {
+        assert(threadCount > 0);
+        for(size_t i = 0; i < threadCount; i++) {
+            workers_.emplace_back(new Worker(queueCapacity));
+        }
+        for(size_t i = 0; i < threadCount; i++) {
+            workers_[i]->thread = std::thread(&WorkStealingPool::Run_, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        isClosed_ = true;
+        for(auto& w: workers_) { Unpark_(*w, true); }
+        for(auto& w: workers_) {
+            if(w->thread.joinable()) { w->thread.join(); }
+        }
+    }
+
+    template<class F>
+    void AddTask(F&& task) {
+        Task item(std::forward<F>(task));
+        size_t n = workers_.size();
+        // 工作线程内提交的任务优先放自己的队列
+        const Current& cur = Current_();
+        size_t start = (cur.pool == this) ? cur.index
+                     : next_.fetch_add(1, std::memory_order_relaxed) % n;
+        size_t i = start;
+        while(!workers_[i]->queue.TryPush(std::move(item))) {
+            i = (i + 1) % n;
+            if(i != start) { continue; }
+            // 所有队列都满了: 工作线程自己在这里等可能所有线程都在等，直接就地执行；
+            // 外部线程等工作线程消化
+            if(cur.pool == this) {
+                item();
+                return;
+            }
+            std::this_thread::yield();
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleepers_.load(std::memory_order_relaxed) > 0) {
+            // 优先唤醒任务所在队列的主人，其次随便唤醒一个
+            if(!Unpark_(*workers_[i], false)) {
+                for(auto& w: workers_) {
+                    if(Unpark_(*w, false)) { break; }
+                }
+            }
+        }
+    }
+
+    size_t ThreadCount() const { return workers_.size(); }
+
+private:
+    struct Worker {
+        explicit Worker(size_t capacity) : queue(capacity), parked(false) {}
+        MpmcRing<Task> queue;
+        std::atomic<bool> parked;
+        std::mutex mtx;              // 只用于本线程休眠
+        std::condition_variable cond;
+        std::thread thread;
+    };
+
+    struct Current {
+        WorkStealingPool* pool;
+        size_t index;
+    };
+
+    bool Unpark_(Worker& w, bool force) {
+        bool expected = true;
+        if(w.parked.compare_exchange_strong(expected, false)) {
+            sleepers_.fetch_sub(1);
+        } else if(!force) {
+            return false;
+        }
+        std::lock_guard<std::mutex> locker(w.mtx);
+        w.cond.notify_one();
+        return true;
+    }
+
+    // 先取自己的队列，再从下一个线程开始依次窃取
+    bool FindTask_(size_t self, Task& task) {
+        size_t n = workers_.size();
+        for(size_t k = 0; k < n; k++) {
+            if(workers_[(self + k) % n]->queue.TryPop(task)) { return true; }
+        }
+        return false;
+    }
+
+    // 当前线程所属的池和下标
+    static Current& Current_() {
+        static thread_local Current cur = { nullptr, 0 };
+        return cur;
+    }
+
+    void Run_(size_t self) {
+        Current_() = { this, self };
+        Worker& me = *workers_[self];
+        Task task;
+        while(true) {
+            if(FindTask_(self, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            if(isClosed_) { break; }
+            // 先登记休眠再检查一遍队列，与AddTask中的栅栏配合，不会丢失唤醒
+            me.parked = true;
+            sleepers_.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(FindTask_(self, task) || isClosed_) {
+                bool expected = true;
+                if(me.parked.compare_exchange_strong(expected, false)) { sleepers_.fetch_sub(1); }
+                if(task) {
+                    task();
+                    task = nullptr;
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> locker(me.mtx);
+            me.cond.wait(locker, [&] { return !me.parked || isClosed_; });
+        }
+        Current_() = { nullptr, 0 };
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> isClosed_;
+    std::atomic<int> sleepers_;       // 正在休眠的线程数
+    std::atomic<size_t> next_;        // 外部提交时轮询的下标
+};
+
+#endif //WORK_STEALING_POOL_H
@@ -14,18 +14,20 @@ Epoller::~Epoller() {
     close(epollFd_);
 }
 
-bool Epoller::AddFd(int fd, uint32_t events) {
+bool Epoller::AddFd(int fd, uint32_t events, void* ptr) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    if(ptr) { ev.data.ptr = ptr; }
+    else { ev.data.fd = fd; }
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
-bool Epoller::ModFd(int fd, uint32_t events) {
+bool Epoller::ModFd(int fd, uint32_t events, void* ptr) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    if(ptr) { ev.data.ptr = ptr; }
+    else { ev.data.fd = fd; }
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
@@ -45,6 +47,11 @@ int Epoller::GetEventFd(size_t i) const {
     return events_[i].data.fd;
 }
 
+void* Epoller::GetEventPtr(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return events_[i].data.ptr;
+}
+
 uint32_t Epoller::GetEvents(size_t i) const {
     assert(i < events_.size() && i >= 0);
     return events_[i].events;
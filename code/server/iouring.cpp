@@ -0,0 +1,128 @@
+#include "iouring.h"
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "../log/log.h"
+
+using namespace std;
+
+IoUring::IoUring():
+    ringFd_(-1), features_(0), sqes_((io_uring_sqe*)MAP_FAILED), sqRing_(MAP_FAILED), sqRingLen_(0),
+    cqRing_(MAP_FAILED), cqRingLen_(0), sqesLen_(0) {}
+
+IoUring::~IoUring() {
+    Teardown();
+}
+
+bool IoUring::Setup(unsigned entries, unsigned cqEntries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if(cqEntries > 0) {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = cqEntries;
+    }
+    ringFd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if(ringFd_ < 0) { return false; }
+    features_ = params.features;
+    if(!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        Teardown();
+        return false;
+    }
+
+    sqRingLen_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingLen_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        sqRingLen_ = cqRingLen_ = max(sqRingLen_, cqRingLen_);
+    }
+    sqRing_ = mmap(nullptr, sqRingLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd_, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED) { Teardown(); return false; }
+    if(single) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringFd_, IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED) { Teardown(); return false; }
+    }
+    sqesLen_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe*)mmap(nullptr, sqesLen_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ringFd_, IORING_OFF_SQES);
+    if(sqes_ == MAP_FAILED) { Teardown(); return false; }
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = (unsigned*)(sq + params.sq_off.head);
+    sqTail_ = (unsigned*)(sq + params.sq_off.tail);
+    sqMask_ = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sqEntries_ = *(unsigned*)(sq + params.sq_off.ring_entries);
+    // 提交数组固定为恒等映射，之后只需要推进tail
+    unsigned* array = (unsigned*)(sq + params.sq_off.array);
+    for(unsigned i = 0; i < sqEntries_; i++) { array[i] = i; }
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = (unsigned*)(cq + params.cq_off.head);
+    cqTail_ = (unsigned*)(cq + params.cq_off.tail);
+    cqMask_ = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+void IoUring::Teardown() {
+    if(sqes_ != MAP_FAILED && sqesLen_) { munmap(sqes_, sqesLen_); }
+    if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_) { munmap(cqRing_, cqRingLen_); }
+    if(sqRing_ != MAP_FAILED) { munmap(sqRing_, sqRingLen_); }
+    sqes_ = (io_uring_sqe*)MAP_FAILED;
+    sqesLen_ = 0;
+    sqRing_ = cqRing_ = MAP_FAILED;
+    if(ringFd_ >= 0) { close(ringFd_); }
+    ringFd_ = -1;
+}
+
+bool IoUring::HasOp(int opcode) const {
+    const int ops = 256;
+    vector<char> mem(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(mem.data());
+    if(Register(IORING_REGISTER_PROBE, probe, ops) < 0) {
+        return false;
+    }
+    return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+int IoUring::Enter(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs) {
+    io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if(timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                   flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+bool IoUring::Submit() {
+    while(Pending() > 0) {
+        int ret = Enter(Pending(), 0, 0, -1);
+        if(ret < 0 && errno == EINTR) { continue; }
+        // 完成队列积压(EBUSY)或内存不足(EAGAIN)时一个也没提交，留在队列里等收割完成事件后再提交
+        if(ret <= 0) {
+            LOG_ERROR("io_uring submit error: %s", ret < 0 ? strerror(errno) : "nothing submitted");
+            return false;
+        }
+    }
+    return true;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+    if(Pending() >= sqEntries_ && !Submit()) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes_[*sqTail_ & sqMask_];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::Register(unsigned opcode, void* arg, unsigned nrArgs) const {
+    return syscall(__NR_io_uring_register, ringFd_, opcode, arg, nrArgs);
+}
@@ -0,0 +1,78 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <linux/io_uring.h> // io_uring_sqe, io_uring_cqe
+#include <sys/mman.h>       // mmap()
+#include <sys/syscall.h>    // __NR_io_uring_setup
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+/* io_uring的提交队列和完成队列，直接用系统调用，不依赖liburing。
+   不加锁，由使用者保证同一时间只有一个线程操作(UringPoller用自己的锁，UringReactor只在本线程用)。
+   用法: GetSqe取一个清零的提交项填好后Commit，Submit/Enter把写好的提交项交给内核；
+   完成事件从CqHead到CqTail逐个取Cqe，处理完用CqAdvance归还 */
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // 需要EXT_ARG(带超时的等待, 5.11)和NODROP(完成队列满时不丢事件)，不支持时返回false。
+    // cqEntries为0时完成队列是提交队列的两倍
+    bool Setup(unsigned entries, unsigned cqEntries = 0);
+    void Teardown();
+    bool IsOk() const { return ringFd_ >= 0; }
+    // io_uring_setup返回的IORING_FEAT_*
+    unsigned Features() const { return features_; }
+
+    // 内核是否支持这个操作码(IORING_REGISTER_PROBE)
+    bool HasOp(int opcode) const;
+
+    // 取一个清零的提交项，队列满了先提交一次，提交不了返回空
+    io_uring_sqe* GetSqe();
+    void Commit() { __atomic_store_n(sqTail_, *sqTail_ + 1, __ATOMIC_RELEASE); }
+    // 已写入但内核还没取走的提交项个数
+    unsigned Pending() const { return *sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE); }
+    // 提交队列里的请求全部交给内核，EINTR时重试，出错返回false
+    bool Submit();
+    // io_uring_enter，timeoutMs < 0 时不设超时
+    int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs);
+
+    unsigned CqHead() const { return *cqHead_; }
+    unsigned CqTail() const { return __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE); }
+    const io_uring_cqe& Cqe(unsigned i) const { return cqes_[i & cqMask_]; }
+    void CqAdvance(unsigned head) { __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE); }
+    bool HasCqe() const { return CqTail() != CqHead(); }
+
+    // io_uring_register
+    int Register(unsigned opcode, void* arg, unsigned nrArgs) const;
+
+private:
+    int ringFd_;
+    unsigned features_;
+
+    // 提交队列
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned sqEntries_;
+    io_uring_sqe* sqes_;
+
+    // 完成队列
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe* cqes_;
+
+    void* sqRing_;
+    size_t sqRingLen_;
+    void* cqRing_;
+    size_t cqRingLen_;
+    size_t sqesLen_;
+};
+
+#endif //IO_URING_H
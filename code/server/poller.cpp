@@ -0,0 +1,17 @@
+#include "poller.h"
+#include "epoller.h"
+#include "uringpoller.h"
+#include "../config/config.h"
+#include "../log/log.h"
+
+Poller* Poller::Create(int backend, int maxEvent) {
+    if(backend == URING_BACKEND) {
+        UringPoller* poller = new UringPoller(maxEvent);
+        if(poller->IsOk()) {
+            return poller;
+        }
+        delete poller;
+        LOG_WARN("io_uring not supported, fall back to epoll");
+    }
+    return new Epoller(maxEvent);
+}
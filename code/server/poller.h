@@ -0,0 +1,34 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* I/O 多路复用后端的接口，语义与epoll一致：
+   事件位使用EPOLLIN/EPOLLOUT等，EPOLLONESHOT表示触发一次后需要ModFd重新注册。
+   注册时ptr为空，事件通过GetEventFd取fd；ptr不为空，事件通过GetEventPtr取回ptr */
+class Poller {
+public:
+    virtual ~Poller() = default;
+
+    virtual bool AddFd(int fd, uint32_t events, void* ptr = nullptr) = 0;
+
+    virtual bool ModFd(int fd, uint32_t events, void* ptr = nullptr) = 0;
+
+    virtual bool DelFd(int fd) = 0;
+
+    virtual int Wait(int timeoutMs = -1) = 0;
+
+    virtual int GetEventFd(size_t i) const = 0;
+
+    virtual void* GetEventPtr(size_t i) const = 0;
+
+    virtual uint32_t GetEvents(size_t i) const = 0;
+
+    virtual const char* Name() const = 0;
+
+    // 按后端类型(IO_BACKEND)创建，io_uring不可用时回退到epoll
+    static Poller* Create(int backend, int maxEvent = 1024);
+};
+
+#endif //POLLER_H
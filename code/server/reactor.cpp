@@ -0,0 +1,16 @@
+#include "reactor.h"
+#include "subreactor.h"
+#include "uringreactor.h"
+
+Reactor* Reactor::Create(int id, int timeoutMS, uint32_t connEvent,
+                         HttpConn* users, int maxFd, ThreadPool* blockingPool, int ioBackend) {
+    if(ioBackend == URING_BACKEND) {
+        UringReactor* reactor = new UringReactor(id, timeoutMS, users, maxFd, blockingPool);
+        if(reactor->IsOk()) {
+            return reactor;
+        }
+        delete reactor;
+        LOG_WARN("io_uring completion I/O not supported, fall back to poll-based SubReactor");
+    }
+    return new SubReactor(id, timeoutMS, connEvent, users, maxFd, blockingPool, ioBackend);
+}
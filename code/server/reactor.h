@@ -0,0 +1,34 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+class HttpConn;
+class ThreadPool;
+
+/* 多反应堆模式下的从反应堆接口: 一个线程一个事件循环，独占自己的连接。
+   SubReactor按就绪通知(epoll或io_uring的poll)由连接自己读写；
+   UringReactor按完成通知，读写请求都提交给io_uring */
+class Reactor {
+public:
+    virtual ~Reactor() = default;
+
+    virtual void Start() = 0;
+
+    virtual void Stop() = 0;
+
+    // 由主反应堆线程调用，把新连接交给本反应堆
+    virtual void AddConn(int fd, const sockaddr_in& addr) = 0;
+
+    // SO_REUSEPORT模式下本反应堆自己accept，须在Start之前调用，fd由本反应堆关闭
+    virtual void SetListenFd(int listenFd, uint32_t listenEvent, int maxConn) = 0;
+
+    virtual const char* Name() const = 0;
+
+    // 按后端类型(IO_BACKEND)创建: io_uring且内核支持完成语义的操作时用UringReactor，否则用SubReactor
+    static Reactor* Create(int id, int timeoutMS, uint32_t connEvent,
+                           HttpConn* users, int maxFd, ThreadPool* blockingPool, int ioBackend);
+};
+
+#endif //REACTOR_H
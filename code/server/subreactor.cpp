@@ -0,0 +1,267 @@
+#include "subreactor.h"
+
+using namespace std;
+
+SubReactor::SubReactor(int id, int timeoutMS, uint32_t connEvent,
+                       HttpConn* users, int maxFd, ThreadPool* blockingPool, int ioBackend):
+    id_(id), timeoutMS_(timeoutMS), connEvent_(connEvent & ~EPOLLONESHOT),
+    listenFd_(-1), listenEvent_(0), maxConn_(0), isClose_(false),
+    epoller_(Poller::Create(ioBackend)), timer_(new HeapTimer()), users_(users), maxFd_(maxFd),
+    blockingPool_(blockingPool) {
+    assert(blockingPool_);
+    // 连接只属于本线程，不需要EPOLLONESHOT，读写方向切换时才ModFd
+    wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(wakeupFd_ >= 0);
+    epoller_->AddFd(wakeupFd_, EPOLLIN, &wakeupFd_);
+}
+
+SubReactor::~SubReactor() {
+    Stop();
+    close(wakeupFd_);
+    if(listenFd_ >= 0) { close(listenFd_); }
+}
+
+void SubReactor::Start() {
+    thread_ = std::thread(&SubReactor::Loop_, this);
+}
+
+void SubReactor::Stop() {
+    isClose_ = true;
+    if(thread_.joinable()) {
+        uint64_t one = 1;
+        ::write(wakeupFd_, &one, sizeof(one));
+        thread_.join();
+    }
+}
+
+void SubReactor::AddConn(int fd, const sockaddr_in& addr) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        pending_.emplace_back(fd, addr);
+    }
+    uint64_t one = 1;
+    ::write(wakeupFd_, &one, sizeof(one));
+}
+
+void SubReactor::SetListenFd(int listenFd, uint32_t listenEvent, int maxConn) {
+    assert(listenFd >= 0 && !thread_.joinable());
+    listenFd_ = listenFd;
+    listenEvent_ = listenEvent;
+    maxConn_ = maxConn;
+    epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN, &listenFd_);
+}
+
+void SubReactor::Loop_() {
+    int timeMS = -1;
+    LOG_INFO("SubReactor[%d] start", id_);
+    while(!isClose_) {
+        if(timeoutMS_ > 0) {
+            timeMS = timer_->GetNextTick();
+        }
+        int eventCnt = epoller_->Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++) {
+            void* ptr = epoller_->GetEventPtr(i);
+            uint32_t events = epoller_->GetEvents(i);
+
+            if(ptr == &listenFd_) {
+                // 内核按四元组哈希分到本套接字的新连接
+                DealListen_();
+            }
+            else if(ptr == &wakeupFd_) {
+                // 主反应堆分发过来的新连接，或阻塞线程池投递回来的任务
+                HandleWakeup_();
+            }
+            else if(static_cast<HttpConn*>(ptr)->IsClose()) {
+                continue;
+            }
+            else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                CloseConn_(static_cast<HttpConn*>(ptr));
+            }
+            else if(events & EPOLLIN) {
+                HttpConn* client = static_cast<HttpConn*>(ptr);
+                ExtentTime_(client);
+                OnRead_(client);
+            }
+            else if(events & EPOLLOUT) {
+                HttpConn* client = static_cast<HttpConn*>(ptr);
+                ExtentTime_(client);
+                OnWrite_(client);
+            } else {
+                LOG_ERROR("Unexpected event");
+            }
+        }
+    }
+    CloseAll_();
+    LOG_INFO("SubReactor[%d] quit", id_);
+}
+
+void SubReactor::HandleWakeup_() {
+    uint64_t cnt = 0;
+    ::read(wakeupFd_, &cnt, sizeof(cnt));
+    vector<pair<int, sockaddr_in>> conns;
+    vector<Task> tasks;
+    {
+        lock_guard<mutex> locker(mtx_);
+        conns.swap(pending_);
+        tasks.swap(tasks_);
+    }
+    for(auto& item: conns) {
+        AddClient_(item.first, item.second);
+    }
+    for(auto& task: tasks) {
+        task();
+    }
+}
+
+void SubReactor::Post_(Task&& task) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        tasks_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    ::write(wakeupFd_, &one, sizeof(one));
+}
+
+void SubReactor::DealListen_() {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    do {
+        int fd = accept4(listenFd_, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK);
+        if(fd <= 0) { return; }
+        else if(HttpConn::userCount >= maxConn_ || fd >= maxFd_) {
+            const char* info = "Server busy!";
+            send(fd, info, strlen(info), 0);
+            close(fd);
+            LOG_WARN("Clients is full!");
+            return;
+        }
+        AddClient_(fd, addr);
+    } while(listenEvent_ & EPOLLET);
+}
+
+void SubReactor::AddClient_(int fd, const sockaddr_in& addr) {
+    assert(fd > 0 && fd < maxFd_);
+    HttpConn* client = &users_[fd];
+    client->init(fd, addr);
+    conns_.insert(fd);
+    if(timeoutMS_ > 0) {
+        timer_->add(fd, timeoutMS_, std::bind(&SubReactor::OnTimeout_, this, client->Handle()));
+    }
+    epoller_->AddFd(fd, EPOLLIN | connEvent_, client);
+}
+
+void SubReactor::CloseConn_(HttpConn* client) {
+    assert(client);
+    LOG_INFO("Client[%d] quit!", client->GetFd());
+    epoller_->DelFd(client->GetFd());
+    writing_.erase(client->GetFd());
+    conns_.erase(client->GetFd());
+    client->Close();
+}
+
+// 阻塞线程池在从反应堆之前就已经停掉(见~WebServer)，这里不会再有任务用到这些连接，
+// 正在查库的连接也一起关闭；还没来得及加入的新连接只关闭fd
+void SubReactor::CloseAll_() {
+    vector<pair<int, sockaddr_in>> conns;
+    {
+        lock_guard<mutex> locker(mtx_);
+        conns.swap(pending_);
+        tasks_.clear();
+    }
+    for(auto& item: conns) {
+        close(item.first);
+    }
+    for(int fd: conns_) {
+        HttpConn* client = &users_[fd];
+        if(blocking_.count(fd) == 0) { epoller_->DelFd(fd); }
+        if(!client->IsClose()) { client->Close(); }
+    }
+    conns_.clear();
+    writing_.clear();
+    blocking_.clear();
+}
+
+// 定时器按fd记录，fd可能已经关闭甚至被别的反应堆复用，用句柄校验
+void SubReactor::OnTimeout_(ConnHandle handle) {
+    HttpConn* client = &users_[handle.fd];
+    if(!client->IsValid(handle)) { return; }
+    if(blocking_.count(handle.fd)) {
+        // 阻塞线程池还在用这个连接，等它回来再关
+        client->SetExpired();
+    } else {
+        CloseConn_(client);
+    }
+}
+
+void SubReactor::ExtentTime_(HttpConn* client) {
+    assert(client);
+    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+}
+
+void SubReactor::OnRead_(HttpConn* client) {
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn_(client);
+        return;
+    }
+    OnProcess_(client);
+}
+
+void SubReactor::OnProcess_(HttpConn* client) {
+    if(client->process()) {
+        // 响应生成后直接在本线程尝试写，大部分响应一次writev就能发完
+        OnWrite_(client);
+    } else if(client->IsPending()) {
+        StartBlocking_(client);
+    } else if(writing_.erase(client->GetFd()) || client->IsReadPaused()) {
+        // 切回读；或者上次读缓冲区满了提前停下，ET下重新注册一次，套接字里剩下的数据会再通知
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, client);
+    }
+}
+
+// 需要查数据库: 连接先从epoll摘掉，交给阻塞线程池，查完投递回本线程继续写
+void SubReactor::StartBlocking_(HttpConn* client) {
+    int fd = client->GetFd();
+    epoller_->DelFd(fd);
+    writing_.erase(fd);
+    blocking_.insert(fd);
+    ConnHandle handle = client->Handle();
+    blockingPool_->AddTask([this, handle] {
+        HttpConn* client = &users_[handle.fd];
+        if(client->IsValid(handle)) { client->ProcessBlocking(); }
+        Post_([this, handle] { OnBlockingDone_(handle); });
+    });
+}
+
+void SubReactor::OnBlockingDone_(ConnHandle handle) {
+    blocking_.erase(handle.fd);
+    HttpConn* client = &users_[handle.fd];
+    if(!client->IsValid(handle)) { return; }
+    if(client->IsExpired()) {
+        CloseConn_(client);
+        return;
+    }
+    epoller_->AddFd(handle.fd, EPOLLIN | connEvent_, client);
+    OnWrite_(client);
+}
+
+void SubReactor::OnWrite_(HttpConn* client) {
+    int writeErrno = 0;
+    ssize_t ret = client->write(&writeErrno);
+    if(client->ToWriteBytes() == 0) {
+        /* 传输完成 */
+        if(client->IsKeepAlive()) {
+            OnProcess_(client);
+            return;
+        }
+    }
+    else if(ret > 0 || writeErrno == EAGAIN) {
+        /* 继续传输，只在第一次写不完时切换到EPOLLOUT */
+        if(writing_.insert(client->GetFd()).second) {
+            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client);
+        }
+        return;
+    }
+    CloseConn_(client);
+}
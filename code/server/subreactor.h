@@ -0,0 +1,88 @@
+#ifndef SUBREACTOR_H
+#define SUBREACTOR_H
+
+#include <unordered_set>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <sys/eventfd.h> // eventfd()
+#include <netinet/in.h>
+
+#include "epoller.h"
+#include "reactor.h"
+#include "../config/config.h"
+#include "../log/log.h"
+#include "../timer/heaptimer.h"
+#include "../pool/threadpool.h"
+#include "../http/httpconn.h"
+
+/* 从反应堆: 一个线程一个事件循环，独占自己的Epoller、定时器和连接表，
+   连接的读、解析、写都在本线程内完成，不再经过线程池 */
+class SubReactor : public Reactor {
+public:
+    // users 是WebServer按fd下标分配的连接槽位，各反应堆只访问自己的fd
+    // blockingPool 执行查库等阻塞操作，完成后回到本线程继续
+    SubReactor(int id, int timeoutMS, uint32_t connEvent,
+               HttpConn* users, int maxFd, ThreadPool* blockingPool,
+               int ioBackend = EPOLL_BACKEND);
+
+    ~SubReactor() override;
+
+    void Start() override;
+
+    void Stop() override;
+
+    void AddConn(int fd, const sockaddr_in& addr) override;
+
+    void SetListenFd(int listenFd, uint32_t listenEvent, int maxConn) override;
+
+    const char* Name() const override { return epoller_->Name(); }
+
+private:
+    void Loop_();
+    void HandleWakeup_();
+    void DealListen_();
+
+    void AddClient_(int fd, const sockaddr_in& addr);
+    void CloseConn_(HttpConn* client);
+    // 事件循环退出时关闭本反应堆的全部连接
+    void CloseAll_();
+    void OnTimeout_(ConnHandle handle);
+    void ExtentTime_(HttpConn* client);
+
+    void OnRead_(HttpConn* client);
+    void OnWrite_(HttpConn* client);
+    void OnProcess_(HttpConn* client);
+
+    // 把任务投递到本线程执行，可以在任意线程调用
+    void Post_(Task&& task);
+    void StartBlocking_(HttpConn* client);
+    void OnBlockingDone_(ConnHandle handle);
+
+    int id_;
+    int timeoutMS_;
+    uint32_t connEvent_;        // 连接的事件，不带EPOLLONESHOT
+    int wakeupFd_;              // eventfd，主反应堆有新连接时唤醒本线程
+    int listenFd_;              // 自己的监听套接字，没有时为-1
+    uint32_t listenEvent_;
+    int maxConn_;
+    std::atomic<bool> isClose_;
+
+    std::mutex mtx_;                                   // 保护 pending_ 和 tasks_
+    std::vector<std::pair<int, sockaddr_in>> pending_; // 等待加入的新连接
+    std::vector<Task> tasks_;                          // 其他线程投递过来的任务
+
+    std::unique_ptr<Poller> epoller_;
+    std::unique_ptr<HeapTimer> timer_;
+    HttpConn* users_;                  // 连接槽位，按fd下标访问
+    int maxFd_;
+    std::unordered_set<int> conns_;    // 本反应堆持有的全部连接
+    std::unordered_set<int> writing_;  // 正在等待EPOLLOUT的连接
+    std::unordered_set<int> blocking_; // 正在阻塞线程池中查库的连接，期间不在epoll中
+    ThreadPool* blockingPool_;
+    std::thread thread_;
+};
+
+#endif //SUBREACTOR_H
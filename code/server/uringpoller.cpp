@@ -0,0 +1,163 @@
+#include "uringpoller.h"
+#include <string.h>
+#include "../log/log.h"
+
+using namespace std;
+
+UringPoller::UringPoller(int maxEvent, unsigned entries):
+    loopId_(std::thread::id()), maxEvent_(maxEvent) {
+    assert(maxEvent_ > 0);
+    events_.reserve(maxEvent_);
+    ring_.Setup(entries);
+}
+
+UringPoller::~UringPoller() = default;
+
+UringPoller::FdState& UringPoller::State_(int fd) {
+    if(static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(fd + 1);
+    }
+    return fds_[fd];
+}
+
+bool UringPoller::Arm_(int fd, FdState& st) {
+    io_uring_sqe* sqe = ring_.GetSqe();
+    if(!sqe) { return false; }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    // 单次poll按水平触发检查当前状态；multishot poll每次唤醒通知一次，是边沿触发
+    sqe->poll32_events = st.events & ~(EPOLLONESHOT | EPOLLET);
+    if(IsMultishot_(st.events)) { sqe->len = IORING_POLL_ADD_MULTI; }
+    sqe->user_data = UserData_(fd, st.gen);
+    ring_.Commit();
+    st.armed = true;
+    return true;
+}
+
+void UringPoller::Disarm_(int fd, FdState& st) {
+    if(!st.armed) { return; }
+    st.armed = false;
+    io_uring_sqe* sqe = ring_.GetSqe();
+    if(!sqe) {
+        // 旧的poll留在内核里，代数已经变了，它的完成事件会被Wait丢掉
+        LOG_WARN("io_uring poll remove for fd %d not submitted", fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = UserData_(fd, st.gen);
+    sqe->user_data = REMOVE_TAG;
+    ring_.Commit();
+}
+
+bool UringPoller::AddFd(int fd, uint32_t events, void* ptr) {
+    if(fd < 0) return false;
+    lock_guard<mutex> locker(mtx_);
+    FdState& st = State_(fd);
+    Disarm_(fd, st);
+    st.gen++;
+    st.events = events;
+    st.ptr = ptr;
+    st.registered = Arm_(fd, st);
+    if(!st.registered) { return false; }
+    // 不在事件循环线程上时立即提交，否则等到Wait里一起提交
+    if(loopId_.load() != std::this_thread::get_id()) { return ring_.Submit(); }
+    return true;
+}
+
+bool UringPoller::ModFd(int fd, uint32_t events, void* ptr) {
+    if(fd < 0) return false;
+    lock_guard<mutex> locker(mtx_);
+    FdState& st = State_(fd);
+    if(!st.registered) { return false; }
+    st.ptr = ptr;
+    // 边沿触发的ModFd和epoll_ctl一样要重新检查一次当前状态，重新挂上
+    if(st.armed && st.events == events && !IsMultishot_(events)) { return true; }
+    Disarm_(fd, st);
+    st.gen++;
+    st.events = events;
+    if(!Arm_(fd, st)) {
+        // 没挂上的由下一次Wait再挂
+        rearm_.push_back(fd);
+        return false;
+    }
+    if(loopId_.load() != std::this_thread::get_id()) { return ring_.Submit(); }
+    return true;
+}
+
+bool UringPoller::DelFd(int fd) {
+    if(fd < 0) return false;
+    lock_guard<mutex> locker(mtx_);
+    FdState& st = State_(fd);
+    if(!st.registered) { return false; }
+    Disarm_(fd, st);
+    st.gen++;
+    st.registered = false;
+    // poll持有文件的引用，要尽快提交POLL_REMOVE，连接才能真正关闭
+    return ring_.Submit();
+}
+
+int UringPoller::Wait(int timeoutMs) {
+    loopId_ = std::this_thread::get_id();
+    unsigned toSubmit = 0;
+    {
+        lock_guard<mutex> locker(mtx_);
+        // 上一轮触发过的非ONESHOT fd重新挂上poll，和其他修改一起提交。提交队列满了挂不上的留到下一轮
+        size_t i = 0;
+        for(; i < rearm_.size(); i++) {
+            FdState& st = State_(rearm_[i]);
+            if(st.registered && !st.armed && !Arm_(rearm_[i], st)) { break; }
+        }
+        rearm_.erase(rearm_.begin(), rearm_.begin() + i);
+        toSubmit = ring_.Pending();
+    }
+
+    // 完成队列积压(EBUSY)时提交不了，先照常收割完成事件，下一轮再提交
+    int ret = 0;
+    if(timeoutMs == 0 || ring_.HasCqe()) {
+        if(toSubmit) { ret = ring_.Enter(toSubmit, 0, 0, -1); }
+    } else {
+        ret = ring_.Enter(toSubmit, 1, IORING_ENTER_GETEVENTS, timeoutMs);
+    }
+    if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+        LOG_ERROR("io_uring enter error: %s", strerror(errno));
+        return -1;
+    }
+
+    events_.clear();
+    lock_guard<mutex> locker(mtx_);
+    unsigned head = ring_.CqHead();
+    unsigned tail = ring_.CqTail();
+    while(head != tail && events_.size() < static_cast<size_t>(maxEvent_)) {
+        const io_uring_cqe& cqe = ring_.Cqe(head);
+        head++;
+        if(cqe.user_data == REMOVE_TAG) { continue; }
+        int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+        uint32_t gen = static_cast<uint32_t>(cqe.user_data >> 32);
+        FdState& st = State_(fd);
+        // 已被ModFd/DelFd替换或取消的poll
+        if(gen != st.gen || !st.registered) { continue; }
+        // multishot poll带F_MORE时还挂着，不用重新挂
+        st.armed = cqe.flags & IORING_CQE_F_MORE;
+        uint32_t revents = cqe.res < 0 ? (EPOLLERR | EPOLLHUP) : static_cast<uint32_t>(cqe.res);
+        events_.push_back({fd, revents, st.ptr});
+        if(!(st.events & EPOLLONESHOT) && !st.armed) { rearm_.push_back(fd); }
+    }
+    ring_.CqAdvance(head);
+    return static_cast<int>(events_.size());
+}
+
+int UringPoller::GetEventFd(size_t i) const {
+    assert(i < events_.size());
+    return events_[i].fd;
+}
+
+void* UringPoller::GetEventPtr(size_t i) const {
+    assert(i < events_.size());
+    return events_[i].ptr;
+}
+
+uint32_t UringPoller::GetEvents(size_t i) const {
+    assert(i < events_.size());
+    return events_[i].events;
+}
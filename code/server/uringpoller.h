@@ -0,0 +1,85 @@
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <sys/epoll.h>
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "iouring.h"
+#include "poller.h"
+
+/* 基于io_uring的多路复用后端。
+   每次AddFd/ModFd/DelFd只是往提交队列里写一个POLL_ADD/POLL_REMOVE，
+   事件循环线程在Wait里用一次io_uring_enter同时提交这一批请求并等待完成事件，
+   省掉了epoll_ctl的系统调用。非事件循环线程(线程池)修改时立即提交，不用唤醒事件循环。
+   单次poll天然就是EPOLLONESHOT语义，非ONESHOT的水平触发fd在触发后由Wait自动重新挂上。
+   EPOLLET(不带ONESHOT)用multishot poll(5.13): 一个POLL_ADD一直挂着，每次有新数据到达
+   唤醒一次，和epoll的边沿触发一样，不再重新挂。
+
+   这里只把就绪通知放进io_uring，accept/readv/writev/close还是由连接自己调用；
+   完成语义的多反应堆见UringReactor。
+   提交失败(ENOMEM、EBADF等)时AddFd/ModFd返回false并记日志，不会在锁里一直重试。 */
+class UringPoller : public Poller {
+public:
+    explicit UringPoller(int maxEvent = 1024, unsigned entries = 4096);
+
+    ~UringPoller() override;
+
+    // 内核是否支持(io_uring_setup成功且支持EXT_ARG超时等待)
+    bool IsOk() const { return ring_.IsOk(); }
+
+    bool AddFd(int fd, uint32_t events, void* ptr = nullptr) override;
+
+    bool ModFd(int fd, uint32_t events, void* ptr = nullptr) override;
+
+    bool DelFd(int fd) override;
+
+    int Wait(int timeoutMs = -1) override;
+
+    int GetEventFd(size_t i) const override;
+
+    void* GetEventPtr(size_t i) const override;
+
+    uint32_t GetEvents(size_t i) const override;
+
+    const char* Name() const override { return "io_uring"; }
+
+private:
+    struct Event {
+        int fd;
+        uint32_t events;
+        void* ptr;
+    };
+
+    struct FdState {
+        uint32_t events = 0;      // 注册的事件
+        void* ptr = nullptr;      // 注册时带的指针
+        uint32_t gen = 0;         // 每次重新注册加一，用来丢弃过期的完成事件
+        bool registered = false;  // 是否已注册
+        bool armed = false;       // 内核中是否有未完成的poll
+    };
+
+    FdState& State_(int fd);
+    bool Arm_(int fd, FdState& st);
+    void Disarm_(int fd, FdState& st);
+    // 边沿触发的fd用multishot poll
+    static bool IsMultishot_(uint32_t events) { return (events & EPOLLET) && !(events & EPOLLONESHOT); }
+
+    static uint64_t UserData_(int fd, uint32_t gen) { return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd); }
+
+    static const uint64_t REMOVE_TAG = ~0ULL;  // POLL_REMOVE自身的完成事件
+
+    IoUring ring_;
+
+    std::mutex mtx_;                       // 保护提交队列和fds_
+    std::atomic<std::thread::id> loopId_;  // 正在Wait的事件循环线程
+    std::vector<FdState> fds_;
+    std::vector<int> rearm_;               // 已触发、需要重新挂poll的非ONESHOT fd，和没挂上的fd
+
+    int maxEvent_;
+    std::vector<Event> events_;            // Wait 得到的事件
+};
+
+#endif //URING_POLLER_H
@@ -0,0 +1,619 @@
+#include "uringreactor.h"
+#include <string.h>
+#include <sys/epoll.h> // EPOLLOUT
+
+using namespace std;
+
+// 每个反应堆自己一个io_uring，接收缓冲区的组号用同一个
+static const uint16_t BUF_GROUP = 0;
+
+UringReactor::UringReactor(int id, int timeoutMS, HttpConn* users, int maxFd,
+                           ThreadPool* blockingPool, unsigned entries):
+    id_(id), timeoutMS_(timeoutMS), wakeupCnt_(0), listenFd_(-1), maxConn_(0), isClose_(false),
+    ok_(false), multishotAccept_(true), multishotRecv_(true), skipFlag_(0), closes_(0),
+    bufMem_(nullptr), freeBufs_(0), timer_(new HeapTimer()), users_(users), maxFd_(maxFd),
+    blockingPool_(blockingPool) {
+    assert(blockingPool_);
+    wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(wakeupFd_ >= 0);
+    if(!ring_.Setup(entries)) { return; }
+    const int ops[] = { IORING_OP_READ, IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG,
+                        IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_CLOSE,
+                        IORING_OP_PROVIDE_BUFFERS };
+    for(int op: ops) {
+        if(!ring_.HasOp(op)) { return; }
+    }
+    if(ring_.Features() & IORING_FEAT_CQE_SKIP) { skipFlag_ = IOSQE_CQE_SKIP_SUCCESS; }
+    ok_ = SetupBufs_();
+}
+
+UringReactor::~UringReactor() {
+    Stop();
+    // 先关掉io_uring，内核不再用接收缓冲区
+    ring_.Teardown();
+    if(bufMem_) { munmap(bufMem_, static_cast<size_t>(BUF_COUNT) * BUF_SIZE); }
+    close(wakeupFd_);
+    if(listenFd_ >= 0) { close(listenFd_); }
+}
+
+bool UringReactor::SetupBufs_() {
+    void* mem = mmap(nullptr, static_cast<size_t>(BUF_COUNT) * BUF_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) { return false; }
+    bufMem_ = static_cast<char*>(mem);
+    io_uring_sqe* sqe = Prepare_(OP_PROVIDE, BUF_COUNT);
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->addr = reinterpret_cast<uint64_t>(bufMem_);
+    sqe->len = BUF_SIZE;
+    sqe->buf_group = BUF_GROUP;
+    sqe->off = 0;
+    ring_.Commit();
+    // 事件循环还没开始，这里同步等它完成
+    int ret = ring_.Enter(1, 1, IORING_ENTER_GETEVENTS, 1000);
+    if(ret < 0 || !ring_.HasCqe()) { return false; }
+    int res = ring_.Cqe(ring_.CqHead()).res;
+    ring_.CqAdvance(ring_.CqHead() + 1);
+    if(res < 0) {
+        LOG_ERROR("Provide buffers error: %s", strerror(-res));
+        return false;
+    }
+    freeBufs_ = BUF_COUNT;
+    return true;
+}
+
+// 缓冲区还给内核，和这一批其他请求一起提交
+void UringReactor::RecycleBuf_(uint16_t bid) {
+    io_uring_sqe* sqe = Prepare_(OP_PROVIDE, 1);
+    if(!sqe) {
+        LOG_ERROR("UringReactor[%d] buffer %d lost", id_, bid);
+        return;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->flags = skipFlag_;
+    sqe->addr = reinterpret_cast<uint64_t>(BufAddr_(bid));
+    sqe->len = BUF_SIZE;
+    sqe->buf_group = BUF_GROUP;
+    sqe->off = bid;
+    ring_.Commit();
+    freeBufs_++;
+}
+
+void UringReactor::Start() {
+    assert(ok_);
+    thread_ = std::thread(&UringReactor::Loop_, this);
+}
+
+void UringReactor::Stop() {
+    isClose_ = true;
+    if(thread_.joinable()) {
+        uint64_t one = 1;
+        ::write(wakeupFd_, &one, sizeof(one));
+        thread_.join();
+    }
+}
+
+void UringReactor::AddConn(int fd, const sockaddr_in& addr) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        pending_.emplace_back(fd, addr);
+    }
+    uint64_t one = 1;
+    ::write(wakeupFd_, &one, sizeof(one));
+}
+
+void UringReactor::SetListenFd(int listenFd, uint32_t listenEvent, int maxConn) {
+    assert(listenFd >= 0 && !thread_.joinable());
+    (void)listenEvent;
+    listenFd_ = listenFd;
+    maxConn_ = maxConn;
+}
+
+void UringReactor::Loop_() {
+    LOG_INFO("UringReactor[%d] start", id_);
+    ArmWakeup_();
+    if(listenFd_ >= 0) { ArmAccept_(); }
+    while(!isClose_) {
+        int timeMS = -1;
+        if(timeoutMS_ > 0) {
+            timeMS = timer_->GetNextTick();
+        }
+        Wait_(timeMS);
+        Dispatch_();
+    }
+    CloseAll_();
+    LOG_INFO("UringReactor[%d] quit", id_);
+}
+
+void UringReactor::Wait_(int timeoutMs) {
+    int ret = 0;
+    // 完成队列里还有事件(处理时新产生的)就不等，只提交
+    if(timeoutMs == 0 || ring_.HasCqe()) {
+        if(ring_.Pending()) { ret = ring_.Enter(ring_.Pending(), 0, 0, -1); }
+    } else {
+        ret = ring_.Enter(ring_.Pending(), 1, IORING_ENTER_GETEVENTS, timeoutMs);
+    }
+    if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+        LOG_ERROR("io_uring enter error: %s", strerror(errno));
+    }
+}
+
+void UringReactor::Dispatch_() {
+    unsigned head = ring_.CqHead();
+    unsigned tail = ring_.CqTail();
+    while(head != tail) {
+        // 先归还完成项，处理时提交的请求产生的完成事件不会因为队列满而积压
+        io_uring_cqe cqe = ring_.Cqe(head);
+        ring_.CqAdvance(++head);
+        OnCqe_(cqe);
+    }
+    // 缓冲区用完停下的recv，有缓冲区还回来了就重新提交
+    if(!starved_.empty() && freeBufs_ > 0) {
+        vector<int> fds;
+        fds.swap(starved_);
+        for(int fd: fds) {
+            auto it = conns_.find(fd);
+            if(it == conns_.end()) { continue; }
+            Conn& c = it->second;
+            if(!c.recving && !c.paused && !c.closing) { ArmRecv_(fd, c); }
+        }
+    }
+}
+
+void UringReactor::OnCqe_(const io_uring_cqe& cqe) {
+    int op = static_cast<int>(cqe.user_data >> 32);
+    int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+    switch(op)
+    {
+    case OP_WAKEUP:
+        OnWakeup_(cqe.res);
+        break;
+    case OP_ACCEPT:
+        OnAccept_(cqe.res, cqe.flags);
+        break;
+    case OP_RECV:
+        OnRecv_(fd, cqe.res, cqe.flags);
+        break;
+    case OP_SEND:
+        OnSend_(fd, cqe.res);
+        break;
+    case OP_POLLOUT:
+        OnPollOut_(fd, cqe.res);
+        break;
+    case OP_CLOSE:
+        closes_--;
+        if(cqe.res < 0) { LOG_ERROR("Close fd %d error: %s", fd, strerror(-cqe.res)); }
+        break;
+    case OP_CANCEL:
+        // 没找到(已经完成)或正在取消都不要紧，被取消的请求自己会有完成事件
+        break;
+    case OP_PROVIDE:
+        if(cqe.res < 0) { LOG_ERROR("Provide buffers error: %s", strerror(-cqe.res)); }
+        break;
+    default:
+        LOG_ERROR("Unexpected io_uring completion");
+    }
+}
+
+io_uring_sqe* UringReactor::Prepare_(int op, int fd) {
+    io_uring_sqe* sqe = ring_.GetSqe();
+    if(!sqe) { return nullptr; }
+    sqe->fd = fd;
+    sqe->user_data = UserData_(op, fd);
+    return sqe;
+}
+
+void UringReactor::ArmWakeup_() {
+    io_uring_sqe* sqe = Prepare_(OP_WAKEUP, wakeupFd_);
+    if(!sqe) {
+        LOG_ERROR("UringReactor[%d] wakeup not armed", id_);
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeupCnt_);
+    sqe->len = sizeof(wakeupCnt_);
+    ring_.Commit();
+}
+
+void UringReactor::ArmAccept_() {
+    io_uring_sqe* sqe = Prepare_(OP_ACCEPT, listenFd_);
+    if(!sqe) {
+        LOG_ERROR("UringReactor[%d] accept not armed", id_);
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    if(multishotAccept_) { sqe->ioprio = IORING_ACCEPT_MULTISHOT; }
+    sqe->accept_flags = SOCK_NONBLOCK;
+    ring_.Commit();
+}
+
+void UringReactor::ArmRecv_(int fd, Conn& c) {
+    io_uring_sqe* sqe = Prepare_(OP_RECV, fd);
+    if(!sqe) {
+        // 提交队列满且提交不了，等有缓冲区还回来时再试
+        starved_.push_back(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    if(multishotRecv_) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    } else {
+        sqe->len = BUF_SIZE;
+    }
+    ring_.Commit();
+    c.recving = true;
+    c.inflight++;
+}
+
+// 取消recv，之前已经收到的数据照常完成
+void UringReactor::PauseRecv_(int fd, Conn& c) {
+    if(c.paused) { return; }
+    c.paused = true;
+    if(c.recving) { Cancel_(OP_RECV, fd); }
+}
+
+// 按user_data取消一个请求。每个连接同一种请求最多一个在内核中
+void UringReactor::Cancel_(int op, int fd) {
+    io_uring_sqe* sqe = Prepare_(OP_CANCEL, fd);
+    if(!sqe) { return; }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = UserData_(op, fd);
+    ring_.Commit();
+}
+
+void UringReactor::ResumeRecv_(int fd, Conn& c) {
+    c.paused = false;
+    // 取消还没完成时recving仍为true，由它的完成事件重新提交
+    if(!c.recving && !c.closing) { ArmRecv_(fd, c); }
+}
+
+void UringReactor::OnWakeup_(int res) {
+    (void)res;
+    vector<pair<int, sockaddr_in>> conns;
+    vector<Task> tasks;
+    {
+        lock_guard<mutex> locker(mtx_);
+        conns.swap(pending_);
+        tasks.swap(tasks_);
+    }
+    for(auto& item: conns) {
+        if(isClose_) { close(item.first); }
+        else { AddClient_(item.first, item.second); }
+    }
+    for(auto& task: tasks) {
+        task();
+    }
+    if(!isClose_) { ArmWakeup_(); }
+}
+
+void UringReactor::OnAccept_(int res, uint32_t flags) {
+    if(res == -EINVAL && multishotAccept_) {
+        // 5.19以前没有multishot accept，改成每次accept完重新提交
+        LOG_WARN("UringReactor[%d] multishot accept not supported", id_);
+        multishotAccept_ = false;
+    }
+    // multishot accept出错或被取消后就结束了，要重新提交
+    if(!(flags & IORING_CQE_F_MORE) && !isClose_) { ArmAccept_(); }
+    if(res < 0) {
+        if(res != -ECANCELED) { LOG_WARN("UringReactor[%d] accept error: %s", id_, strerror(-res)); }
+        return;
+    }
+    int fd = res;
+    if(isClose_) {
+        close(fd);
+        return;
+    }
+    if(HttpConn::userCount >= maxConn_ || fd >= maxFd_) {
+        const char* info = "Server busy!";
+        send(fd, info, strlen(info), MSG_NOSIGNAL);
+        close(fd);
+        LOG_WARN("Clients is full!");
+        return;
+    }
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    getpeername(fd, (struct sockaddr *)&addr, &len);
+    AddClient_(fd, addr);
+}
+
+void UringReactor::OnRecv_(int fd, int res, uint32_t flags) {
+    bool hasBuf = flags & IORING_CQE_F_BUFFER;
+    uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    if(hasBuf) { freeBufs_--; }
+    auto it = conns_.find(fd);
+    if(it == conns_.end()) {
+        if(hasBuf) { RecycleBuf_(bid); }
+        return;
+    }
+    Conn& c = it->second;
+    HttpConn* client = &users_[fd];
+    // 没有F_MORE时这个recv结束了
+    if(!(flags & IORING_CQE_F_MORE)) {
+        c.recving = false;
+        c.inflight--;
+    }
+    if(c.closing) {
+        if(hasBuf) { RecycleBuf_(bid); }
+        Finish_(fd, c);
+        return;
+    }
+    if(c.blocking) {
+        // 阻塞线程池正在用这个连接，数据先留在缓冲区里；对端关闭等查完再关
+        if(res > 0 && hasBuf) { c.held.emplace_back(bid, static_cast<uint32_t>(res)); }
+        else if(hasBuf) { RecycleBuf_(bid); }
+        if(res <= 0 && res != -ENOBUFS && res != -ECANCELED) { client->SetExpired(); }
+        return;
+    }
+    if(res > 0) {
+        client->Input(BufAddr_(bid), res, BUF_SIZE);
+        RecycleBuf_(bid);
+        if(client->IsReadFull()) { PauseRecv_(fd, c); }
+        ExtentTime_(client);
+        // 正在发送时先收着，发完再一起处理
+        if(!c.sending) { OnProcess_(client); }
+    } else {
+        if(hasBuf) { RecycleBuf_(bid); }
+        if(res == -EINVAL && multishotRecv_) {
+            // 6.0以前没有multishot recv，改成每次收完重新提交
+            LOG_WARN("UringReactor[%d] multishot recv not supported", id_);
+            multishotRecv_ = false;
+        } else if(res == -ENOBUFS) {
+            starved_.push_back(fd);
+            return;
+        } else if(res != -ECANCELED) {
+            // 对端关闭(0)或出错
+            CloseConn_(client);
+            return;
+        }
+    }
+    // OnProcess_里可能关了连接
+    it = conns_.find(fd);
+    if(it == conns_.end()) { return; }
+    Conn& cur = it->second;
+    if(!cur.recving && !cur.paused && !cur.closing) { ArmRecv_(fd, cur); }
+}
+
+void UringReactor::OnSend_(int fd, int res) {
+    auto it = conns_.find(fd);
+    if(it == conns_.end()) { return; }
+    Conn& c = it->second;
+    c.sending = false;
+    c.inflight--;
+    if(c.closing) {
+        Finish_(fd, c);
+        return;
+    }
+    HttpConn* client = &users_[fd];
+    if(res <= 0) {
+        CloseConn_(client);
+        return;
+    }
+    client->Sent(res);
+    ExtentTime_(client);
+    StartSend_(client);
+}
+
+void UringReactor::OnPollOut_(int fd, int res) {
+    auto it = conns_.find(fd);
+    if(it == conns_.end()) { return; }
+    Conn& c = it->second;
+    c.sending = false;
+    c.inflight--;
+    if(c.closing) {
+        Finish_(fd, c);
+        return;
+    }
+    HttpConn* client = &users_[fd];
+    if(res < 0 || (res & (EPOLLERR | EPOLLHUP))) {
+        CloseConn_(client);
+        return;
+    }
+    ExtentTime_(client);
+    StartSend_(client);
+}
+
+void UringReactor::AddClient_(int fd, const sockaddr_in& addr) {
+    assert(fd > 0 && fd < maxFd_);
+    HttpConn* client = &users_[fd];
+    client->init(fd, addr);
+    auto res = conns_.try_emplace(fd);
+    assert(res.second);
+    if(timeoutMS_ > 0) {
+        timer_->add(fd, timeoutMS_, std::bind(&UringReactor::OnTimeout_, this, client->Handle()));
+    }
+    ArmRecv_(fd, res.first->second);
+}
+
+void UringReactor::CloseConn_(HttpConn* client) {
+    assert(client);
+    int fd = client->GetFd();
+    auto it = conns_.find(fd);
+    if(it == conns_.end() || it->second.closing) { return; }
+    Conn& c = it->second;
+    LOG_INFO("Client[%d] quit!", fd);
+    c.closing = true;
+    // 取消这个连接上的请求，它们的完成事件都回来以后才释放连接
+    if(c.recving) { Cancel_(OP_RECV, fd); }
+    if(c.sending) {
+        Cancel_(OP_SEND, fd);
+        Cancel_(OP_POLLOUT, fd);
+    }
+    Finish_(fd, c);
+}
+
+void UringReactor::Finish_(int fd, Conn& c) {
+    if(!c.closing || c.inflight > 0 || c.blocking) { return; }
+    for(auto& item: c.held) {
+        RecycleBuf_(item.first);
+    }
+    users_[fd].Close(false);
+    conns_.erase(fd);
+    io_uring_sqe* sqe = Prepare_(OP_CLOSE, fd);
+    if(!sqe) {
+        close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    ring_.Commit();
+    closes_++;
+}
+
+// 阻塞线程池在从反应堆之前就已经停掉(见~WebServer)，这里不会再有任务用到这些连接，
+// 正在查库的连接也一起关闭；还没来得及加入的新连接只关闭fd
+void UringReactor::CloseAll_() {
+    vector<pair<int, sockaddr_in>> conns;
+    {
+        lock_guard<mutex> locker(mtx_);
+        conns.swap(pending_);
+        tasks_.clear();
+    }
+    for(auto& item: conns) {
+        close(item.first);
+    }
+    vector<int> fds;
+    for(auto& item: conns_) {
+        item.second.blocking = false;
+        fds.push_back(item.first);
+    }
+    for(int fd: fds) {
+        CloseConn_(&users_[fd]);
+    }
+    // 内核还在用连接的内存(发送中的输出链)，等取消的请求都完成再返回
+    for(int i = 0; i < 100 && (!conns_.empty() || closes_ > 0); i++) {
+        Wait_(10);
+        Dispatch_();
+    }
+    if(!conns_.empty() || closes_ > 0) {
+        LOG_ERROR("UringReactor[%d] %zu conns not closed", id_, conns_.size());
+    }
+}
+
+void UringReactor::OnTimeout_(ConnHandle handle) {
+    HttpConn* client = &users_[handle.fd];
+    if(!client->IsValid(handle)) { return; }
+    auto it = conns_.find(handle.fd);
+    if(it != conns_.end() && it->second.blocking) {
+        // 阻塞线程池还在用这个连接，等它回来再关
+        client->SetExpired();
+    } else {
+        CloseConn_(client);
+    }
+}
+
+void UringReactor::ExtentTime_(HttpConn* client) {
+    assert(client);
+    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+}
+
+void UringReactor::OnProcess_(HttpConn* client) {
+    int fd = client->GetFd();
+    if(client->process()) {
+        StartSend_(client);
+    } else if(client->IsPending()) {
+        StartBlocking_(client);
+    } else {
+        // 这一批处理完了，读缓冲区不满就接着收
+        Conn& c = conns_[fd];
+        if(c.paused && !client->IsReadFull()) { ResumeRecv_(fd, c); }
+    }
+}
+
+// 链头的内存片段交给sendmsg，完成后在OnSend_里接着发；文件区间在这里直接sendfile
+void UringReactor::StartSend_(HttpConn* client) {
+    int fd = client->GetFd();
+    Conn& c = conns_[fd];
+    while(client->ToWriteBytes() > 0) {
+        int cnt = client->FillSend(c.iov, OutputChain::IOV_BATCH);
+        if(cnt > 0) {
+            io_uring_sqe* sqe = Prepare_(OP_SEND, fd);
+            if(!sqe) {
+                CloseConn_(client);
+                return;
+            }
+            memset(&c.msg, 0, sizeof(c.msg));
+            c.msg.msg_iov = c.iov;
+            c.msg.msg_iovlen = cnt;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->addr = reinterpret_cast<uint64_t>(&c.msg);
+            sqe->msg_flags = MSG_NOSIGNAL;
+            ring_.Commit();
+            c.sending = true;
+            c.inflight++;
+            return;
+        }
+        int writeErrno = 0;
+        ssize_t ret = client->write(&writeErrno);
+        if(ret < 0 && writeErrno == EAGAIN) {
+            io_uring_sqe* sqe = Prepare_(OP_POLLOUT, fd);
+            if(!sqe) {
+                CloseConn_(client);
+                return;
+            }
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = EPOLLOUT;
+            ring_.Commit();
+            c.sending = true;
+            c.inflight++;
+            return;
+        }
+        if(ret <= 0) {
+            CloseConn_(client);
+            return;
+        }
+    }
+    OnSendDone_(client);
+}
+
+void UringReactor::OnSendDone_(HttpConn* client) {
+    if(client->IsKeepAlive()) {
+        // 发完这一批接着处理读缓冲区里排着的请求
+        OnProcess_(client);
+    } else {
+        CloseConn_(client);
+    }
+}
+
+void UringReactor::Post_(Task&& task) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        tasks_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    ::write(wakeupFd_, &one, sizeof(one));
+}
+
+// 需要查数据库: 暂停接收，交给阻塞线程池，查完投递回本线程继续写
+void UringReactor::StartBlocking_(HttpConn* client) {
+    int fd = client->GetFd();
+    Conn& c = conns_[fd];
+    PauseRecv_(fd, c);
+    c.blocking = true;
+    ConnHandle handle = client->Handle();
+    blockingPool_->AddTask([this, handle] {
+        HttpConn* client = &users_[handle.fd];
+        if(client->IsValid(handle)) { client->ProcessBlocking(); }
+        Post_([this, handle] { OnBlockingDone_(handle); });
+    });
+}
+
+void UringReactor::OnBlockingDone_(ConnHandle handle) {
+    HttpConn* client = &users_[handle.fd];
+    auto it = conns_.find(handle.fd);
+    if(!client->IsValid(handle) || it == conns_.end()) { return; }
+    Conn& c = it->second;
+    c.blocking = false;
+    // 查库期间收到的数据交给连接
+    for(auto& item: c.held) {
+        client->Input(BufAddr_(item.first), item.second, BUF_SIZE);
+        RecycleBuf_(item.first);
+    }
+    c.held.clear();
+    if(client->IsExpired()) {
+        CloseConn_(client);
+        return;
+    }
+    StartSend_(client);
+}
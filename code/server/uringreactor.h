@@ -0,0 +1,161 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <sys/eventfd.h> // eventfd()
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "reactor.h"
+#include "iouring.h"
+#include "../config/config.h"
+#include "../log/log.h"
+#include "../timer/heaptimer.h"
+#include "../pool/threadpool.h"
+#include "../http/httpconn.h"
+
+/* 完成通知的从反应堆(io_uring): 和SubReactor一样一个线程一个事件循环、独占自己的连接，
+   但accept、recv、send、close都是提交给内核的请求，每轮循环一次io_uring_enter
+   同时提交这一批请求并收割完成事件，读写本身不再各占一次系统调用。
+   - 监听套接字挂一个multishot accept，一次提交持续产生新连接
+   - 每个连接挂一个multishot recv，数据由内核放进本反应堆提供的接收缓冲区(provided buffers)，
+     连接空闲时不占缓冲区；数据拷进连接的读缓冲区后，缓冲区随下一批提交还给内核，
+     请求仍在读缓冲区上解析
+   - 响应链头的内存片段一次sendmsg发出；文件区间仍然直接sendfile，发不完时挂一次poll等可写
+   - 关闭时先取消连接上未完成的请求，全部结束后释放连接，fd用close请求关闭
+   需要5.11(EXT_ARG)，不支持时由Reactor::Create改用SubReactor。multishot accept(5.19)、
+   multishot recv(6.0)不支持时退回每次完成后重新提交。
+   接收缓冲区用PROVIDE_BUFFERS逐个归还，没有用缓冲区环(5.19的PBUF_RING): 有的内核上注册成功
+   但recv一直返回ENOBUFS，逐个归还的提交项和其他请求一起提交，不多系统调用 */
+class UringReactor : public Reactor {
+public:
+    // BUF_COUNT个BUF_SIZE字节的接收缓冲区，每个反应堆一份
+    static const unsigned BUF_SIZE = 16 << 10;
+    static const unsigned BUF_COUNT = 256;
+
+    UringReactor(int id, int timeoutMS, HttpConn* users, int maxFd, ThreadPool* blockingPool,
+                 unsigned entries = 4096);
+
+    ~UringReactor() override;
+
+    // 内核是否支持需要的操作
+    bool IsOk() const { return ok_; }
+
+    void Start() override;
+
+    void Stop() override;
+
+    void AddConn(int fd, const sockaddr_in& addr) override;
+
+    // listenEvent不用: multishot accept每个新连接一个完成事件，没有水平/边沿之分
+    void SetListenFd(int listenFd, uint32_t listenEvent, int maxConn) override;
+
+    const char* Name() const override { return "io_uring(completion)"; }
+
+private:
+    enum OP {
+        OP_WAKEUP = 1,  // eventfd的read
+        OP_ACCEPT,
+        OP_RECV,
+        OP_SEND,        // sendmsg
+        OP_POLLOUT,     // sendfile发不完，等可写
+        OP_CANCEL,
+        OP_CLOSE,
+        OP_PROVIDE,     // 归还接收缓冲区
+    };
+
+    // 本反应堆上一个连接的请求状态
+    struct Conn {
+        int inflight = 0;       // 内核中未完成的请求数，为0才能释放连接
+        bool recving = false;   // recv请求在内核中
+        bool sending = false;   // sendmsg或等可写的poll在内核中
+        bool paused = false;    // 读缓冲区满了或正在查库，暂停接收
+        bool blocking = false;  // 正在阻塞线程池中查库，期间不碰HttpConn
+        bool closing = false;   // 等未完成的请求结束后关闭
+        // 查库期间收到的数据，缓冲区先不还，查完再交给连接
+        std::vector<std::pair<uint16_t, uint32_t>> held;
+        struct iovec iov[OutputChain::IOV_BATCH];
+        struct msghdr msg;
+    };
+
+    // 把全部接收缓冲区交给内核，等待完成，失败返回false
+    bool SetupBufs_();
+    char* BufAddr_(uint16_t bid) const { return bufMem_ + static_cast<size_t>(bid) * BUF_SIZE; }
+    void RecycleBuf_(uint16_t bid);
+
+    void Loop_();
+    // 提交这一批请求，没有完成事件时等到超时
+    void Wait_(int timeoutMs);
+    void Dispatch_();
+    void OnCqe_(const io_uring_cqe& cqe);
+
+    io_uring_sqe* Prepare_(int op, int fd);
+    void ArmWakeup_();
+    void ArmAccept_();
+    void ArmRecv_(int fd, Conn& c);
+    void Cancel_(int op, int fd);
+    void PauseRecv_(int fd, Conn& c);
+    void ResumeRecv_(int fd, Conn& c);
+
+    void OnWakeup_(int res);
+    void OnAccept_(int res, uint32_t flags);
+    void OnRecv_(int fd, int res, uint32_t flags);
+    void OnSend_(int fd, int res);
+    void OnPollOut_(int fd, int res);
+
+    void AddClient_(int fd, const sockaddr_in& addr);
+    void CloseConn_(HttpConn* client);
+    // 没有未完成的请求时释放连接，提交close
+    void Finish_(int fd, Conn& c);
+    // 事件循环退出时关闭本反应堆的全部连接，等它们的请求都结束
+    void CloseAll_();
+    void OnTimeout_(ConnHandle handle);
+    void ExtentTime_(HttpConn* client);
+
+    void OnProcess_(HttpConn* client);
+    void StartSend_(HttpConn* client);
+    void OnSendDone_(HttpConn* client);
+
+    // 把任务投递到本线程执行，可以在任意线程调用
+    void Post_(Task&& task);
+    void StartBlocking_(HttpConn* client);
+    void OnBlockingDone_(ConnHandle handle);
+
+    static uint64_t UserData_(int op, int fd) { return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd); }
+
+    int id_;
+    int timeoutMS_;
+    int wakeupFd_;              // eventfd，有新连接或投递的任务时唤醒本线程
+    uint64_t wakeupCnt_;        // eventfd的read请求读到这里
+    int listenFd_;              // 自己的监听套接字，没有时为-1
+    int maxConn_;
+    std::atomic<bool> isClose_;
+    bool ok_;
+    bool multishotAccept_;      // 内核支持multishot accept
+    bool multishotRecv_;        // 内核支持multishot recv
+    uint8_t skipFlag_;          // 支持时为IOSQE_CQE_SKIP_SUCCESS，归还缓冲区成功时不产生完成事件
+    int closes_;                // 已提交、还没完成的close请求
+
+    std::mutex mtx_;                                   // 保护 pending_ 和 tasks_
+    std::vector<std::pair<int, sockaddr_in>> pending_; // 等待加入的新连接
+    std::vector<Task> tasks_;                          // 其他线程投递过来的任务
+
+    IoUring ring_;
+    char* bufMem_;                 // BUF_COUNT * BUF_SIZE 的接收缓冲区
+    unsigned freeBufs_;            // 内核手里可用的缓冲区个数
+    std::vector<int> starved_;     // 缓冲区用完(ENOBUFS)停下的recv，有缓冲区还回来后重新提交
+
+    std::unique_ptr<HeapTimer> timer_;
+    HttpConn* users_;              // 连接槽位，按fd下标访问
+    int maxFd_;
+    std::unordered_map<int, Conn> conns_;  // 本反应堆持有的全部连接
+    ThreadPool* blockingPool_;
+    std::thread thread_;
+};
+
+#endif //URING_REACTOR_H
@@ -14,10 +14,14 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize,
+            const Config& config):
             
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            reactorMode_(config.reactorMode), reusePort_(config.reusePort),
+            backlog_(config.listenBacklog), listenFd_(-1), timer_(new HeapTimer()),
+            epoller_(Poller::Create(config.ioBackend)),
+            nextReactor_(0)
     {
     srcDir_ = getcwd(nullptr, 256);      //获取当前的工作路径
     // assert()函数用于运行时断言。如果其参数表达式为假（即srcDir_为nullptr），
@@ -27,11 +31,52 @@ WebServer::WebServer(
     strncat(srcDir_, "/resources/", 16); //生成资源的根路径
     HttpConn::userCount = 0;             //初始化用户连接数0
     HttpConn::srcDir = srcDir_;          //资源的根据路径
+    HttpRequest::maxBodySize = config.maxBodySize;  //请求体上限
+    HttpRequest::maxStreamBodySize = config.maxUploadSize;
+    HttpResponse::fileSendMode = config.fileSendMode;  //静态文件的发送方式
+    HttpResponse::sendfileMinSize = config.sendfileMinSize;
+    FormUpload::tmpDir = config.uploadDir;          //上传文件的临时目录
+    //注册路由，请求体按路由交给各自的处理函数
+    Routes::Register(Router::Instance(), config.enableUpload);
+    HttpRequest::bodyHandlerFactory = [](HttpRequest& request) {
+        return Router::Instance()->MakeBodyHandler(request);
+    };
 
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
 
+    //连接槽位按fd下标一次性分配好，fd不会超过进程的打开文件数上限
+    maxFd_ = min(config.maxFd, static_cast<int>(MAX_FD));
+    if(maxFd_ <= 0) {
+        struct rlimit limit;
+        maxFd_ = MAX_FD;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < static_cast<rlim_t>(MAX_FD)) {
+            maxFd_ = static_cast<int>(limit.rlim_cur);
+        }
+    }
+    users_.reset(new HttpConn[maxFd_]);
+
     //初始化事件的模式
     InitEventMode_(trigMode);
+    //阻塞操作单独一个线程池，线程数超过数据库连接数只会阻塞在取连接上
+    int blockingThreads = config.blockingThreads > 0 ? config.blockingThreads : connPoolNum;
+    blockingPool_.reset(new ThreadPool(blockingThreads));
+    //单反应堆把读写交给线程池，多反应堆每个从反应堆一个线程
+    int subReactorNum = config.subReactorNum > 0 ? config.subReactorNum : threadNum;
+    if(reactorMode_ == MULTI_REACTOR) {
+        for(int i = 0; i < subReactorNum; i++) {
+            subReactors_.emplace_back(Reactor::Create(i, timeoutMS_, connEvent_, users_.get(), maxFd_,
+                                                      blockingPool_.get(), config.ioBackend));
+        }
+    } else if(reactorMode_ == COROUTINE_REACTOR) {
+        coLoop_.reset(new CoLoop(config.ioBackend));
+    } else if(config.poolType == WORK_STEALING_POOL) {
+        stealPool_.reset(new WorkStealingPool(threadNum));
+    } else if(config.poolMaxThreads > threadNum) {
+        threadpool_.reset(new ThreadPool(threadNum, config.poolMaxThreads, config.poolWaitTargetMs, config.poolIdleMs));
+    } else {
+        threadpool_.reset(new ThreadPool(threadNum));
+    }
+
     //初始化Socket
     if(!InitSocket_()) { isClose_ = true;}
 
@@ -42,18 +87,41 @@ WebServer::WebServer(
         else {
             LOG_INFO("========== Server init ==========");
             LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger? "true":"false");
+            LOG_INFO("ReusePort: %s, Backlog: %d", reusePort_ ? "true":"false", backlog_);
+            LOG_INFO("Conn slots: %d", maxFd_);
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d, BlockingPool num: %d",
+                     connPoolNum, threadNum, blockingThreads);
+            if(threadpool_ && threadpool_->IsElastic()) {
+                LOG_INFO("ThreadPool elastic: %d~%d threads, wait target: %dms, idle: %dms", threadNum,
+                         config.poolMaxThreads, config.poolWaitTargetMs, config.poolIdleMs);
+            }
+            LOG_INFO("IO Backend: %s", epoller_->Name());
+            if(reactorMode_ == MULTI_REACTOR) {
+                LOG_INFO("Reactor Mode: multi, SubReactor num: %d, SubReactor IO: %s",
+                         subReactorNum, subReactors_[0]->Name());
+            } else if(reactorMode_ == COROUTINE_REACTOR) {
+                LOG_INFO("Reactor Mode: coroutine");
+            } else {
+                LOG_INFO("Reactor Mode: single, Pool: %s", stealPool_ ? "work-stealing" : "queue");
+            }
         }
     }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    // 阻塞任务会回到线程池或从反应堆，先等它们执行完
+    threadpool_.reset();
+    stealPool_.reset();
+    blockingPool_.reset();
+    // 再停掉从反应堆，由它们各自关闭自己的连接
+    subReactors_.clear();
+    coLoop_.reset();
+    if(listenFd_ >= 0) { close(listenFd_); }
     isClose_ = true;
     free(srcDir_);
     SqlConnPool::Instance()->ClosePool();
@@ -88,6 +156,16 @@ void WebServer::InitEventMode_(int trigMode) {
 void WebServer::Start() {
     int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    for(auto& reactor: subReactors_) {
+        reactor->Start();
+    }
+    if(coLoop_) {
+        if(!isClose_) {
+            coLoop_->Spawn(AcceptLoop_());
+            coLoop_->Run();
+        }
+        return;
+    }
     // 服务没有关闭就一直在运行
     while(!isClose_) {
         // 解决超时连接
@@ -98,30 +176,31 @@ void WebServer::Start() {
         int eventCnt = epoller_->Wait(timeMS);
         
         for(int i = 0; i < eventCnt; i++) {
-            /* 处理事件 */
-            int fd = epoller_->GetEventFd(i);
+            /* 处理事件，data.ptr 指向连接槽位，监听套接字指向 listenFd_ */
+            void* ptr = epoller_->GetEventPtr(i);
             uint32_t events = epoller_->GetEvents(i);
 
-            if(fd == listenFd_) {
+            if(ptr == &listenFd_) {
                 // 处理监听的事件，接受客户端连接
                 DealListen_();
             }
+            else if(static_cast<HttpConn*>(ptr)->IsClose()) {
+                // 同一批事件中已经被关闭的连接
+                continue;
+            }
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                assert(users_.count(fd) > 0);
                 // 关闭连接，出错
-                CloseConn_(&users_[fd]);
+                TryClose_(static_cast<HttpConn*>(ptr)->Handle());
             }
 
             else if(events & EPOLLIN) {
-                assert(users_.count(fd) > 0);
                 // 处理读事件
-                DealRead_(&users_[fd]);
+                DealRead_(static_cast<HttpConn*>(ptr));
             }
 
             else if(events & EPOLLOUT) {
-                assert(users_.count(fd) > 0);
                 // 处理写事件
-                DealWrite_(&users_[fd]);
+                DealWrite_(static_cast<HttpConn*>(ptr));
             } else {
                 LOG_ERROR("Unexpected event");
             }
@@ -148,15 +227,23 @@ void WebServer::CloseConn_(HttpConn* client) {
 void WebServer::AddClient_(int fd, sockaddr_in addr) {
     assert(fd > 0);
 
-    users_[fd].init(fd, addr);
+    HttpConn* client = &users_[fd];
+    client->init(fd, addr);
     
     if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        timer_->add(fd, timeoutMS_, std::bind(&WebServer::TryClose_, this, client->Handle()));
     }
     // 添加到epoller
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);
+    epoller_->AddFd(fd, EPOLLIN | connEvent_, client);
+    SetFdNonblock(fd);
+    LOG_INFO("Client[%d] in!", client->GetFd());
+}
+
+// 多反应堆模式下，轮询把新连接交给从反应堆
+void WebServer::DispatchClient_(int fd, sockaddr_in addr) {
+    assert(fd > 0 && !subReactors_.empty());
     SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    subReactors_[nextReactor_++ % subReactors_.size()]->AddConn(fd, addr);
 }
 
 void WebServer::DealListen_() {
@@ -168,14 +255,18 @@ void WebServer::DealListen_() {
         int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
         if(fd <= 0) { return;}
 
-        else if(HttpConn::userCount >= MAX_FD) {
+        else if(HttpConn::userCount >= maxFd_ || fd >= maxFd_) {
             SendError_(fd, "Server busy!");
             LOG_WARN("Clients is full!");
             return;
         }
 
         // 添加客户端
-        AddClient_(fd, addr);
+        if(reactorMode_ == MULTI_REACTOR) {
+            DispatchClient_(fd, addr);
+        } else {
+            AddClient_(fd, addr);
+        }
 
     } while(listenEvent_ & EPOLLET);
 }
@@ -183,13 +274,15 @@ void WebServer::DealListen_() {
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    ConnHandle handle = client->Handle();
+    AddTask_([this, handle] { OnRead_(handle); });
 }
 
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    ConnHandle handle = client->Handle();
+    AddTask_([this, handle] { OnWrite_(handle); });
 }
 
 void WebServer::ExtentTime_(HttpConn* client) {
@@ -197,60 +290,204 @@ void WebServer::ExtentTime_(HttpConn* client) {
     if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
 }
 
+// 根据句柄取连接，连接已关闭或fd已被新连接复用时返回nullptr
+HttpConn* WebServer::GetConn_(const ConnHandle& handle) {
+    if(handle.fd < 0 || handle.fd >= maxFd_) { return nullptr; }
+    HttpConn* client = &users_[handle.fd];
+    return client->IsValid(handle) ? client : nullptr;
+}
+
+// 工作线程独占连接，持有期间连接不会被定时器关闭
+HttpConn* WebServer::AcquireConn_(const ConnHandle& handle) {
+    HttpConn* client = GetConn_(handle);
+    if(!client) { return nullptr; }
+    client->Acquire();
+    if(!client->IsValid(handle)) {
+        client->Release();
+        return nullptr;
+    }
+    return client;
+}
+
+void WebServer::ReleaseConn_(HttpConn* client, const ConnHandle& handle) {
+    client->Release();
+    // 处理期间定时器到期，由工作线程补上关闭
+    if(client->IsExpired()) { TryClose_(handle); }
+}
+
+// 定时器到期或连接出错时关闭，连接正在被工作线程处理时只做标记
+void WebServer::TryClose_(ConnHandle handle) {
+    HttpConn* client = GetConn_(handle);
+    if(!client) { return; }
+    client->SetExpired();
+    if(client->TryAcquire()) {
+        if(client->IsValid(handle)) { CloseConn_(client); }
+        client->Release();
+    }
+}
+
 // 在子线程中执行
-void WebServer::OnRead_(HttpConn* client) {
-    assert(client);
+void WebServer::OnRead_(ConnHandle handle) {
+    HttpConn* client = AcquireConn_(handle);
+    if(!client) { return; }
     int ret = -1;
     int readErrno = 0;
     // 读取客户端数据
     ret = client->read(&readErrno);
     if(ret <= 0 && readErrno != EAGAIN) {
         CloseConn_(client);
-        return;
+    } else {
+        // 处理，业务逻辑 
+        OnProcess(client);
     }
-    // 处理，业务逻辑 
-    OnProcess(client);
+    ReleaseConn_(client, handle);
 }
 
 void WebServer::OnProcess(HttpConn* client) {
     if(client->process()) {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client);
+    } else if(client->IsPending()) {
+        // 需要查数据库: 交给阻塞线程池，EPOLLONESHOT下连接在此期间不会再触发事件
+        ConnHandle handle = client->Handle();
+        blockingPool_->AddTask([this, handle] { OnBlocking_(handle); });
     } else {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN, client);
     }
 }
 
-void WebServer::OnWrite_(HttpConn* client) {
-    assert(client);
+// 在阻塞线程池中执行，查库期间持有连接，定时器到期只做标记
+void WebServer::OnBlocking_(ConnHandle handle) {
+    HttpConn* client = AcquireConn_(handle);
+    if(!client) { return; }
+    client->ProcessBlocking();
+    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client);
+    ReleaseConn_(client, handle);
+}
+
+void WebServer::OnWrite_(ConnHandle handle) {
+    HttpConn* client = AcquireConn_(handle);
+    if(!client) { return; }
     int ret = -1;
     int writeErrno = 0;
     // 写数据
     ret = client->write(&writeErrno);
-    if(client->ToWriteBytes() == 0) {
+    if(client->ToWriteBytes() == 0 && client->IsKeepAlive()) {
         /* 传输完成 */
-        if(client->IsKeepAlive()) {
-            OnProcess(client);
-            return;
+        OnProcess(client);
+    }
+    else if(client->ToWriteBytes() > 0 && ret < 0 && writeErrno == EAGAIN) {
+        /* 继续传输 */
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, client);
+    }
+    else {
+        CloseConn_(client);
+    }
+    ReleaseConn_(client, handle);
+}
+
+// 协程模式: 等监听套接字可读，accept到EAGAIN，每个新连接启动一个协程
+CoTask<void> WebServer::AcceptLoop_() {
+    while(!isClose_) {
+        co_await coLoop_->Readable(listenFd_);
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd;
+        while((fd = accept4(listenFd_, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK)) > 0) {
+            if(HttpConn::userCount >= maxFd_ || fd >= maxFd_) {
+                SendError_(fd, "Server busy!");
+                LOG_WARN("Clients is full!");
+                continue;
+            }
+            HttpConn* client = &users_[fd];
+            client->init(fd, addr);
+            LOG_INFO("Client[%d] in!", fd);
+            coLoop_->Spawn(ServeConn_(client->Handle()));
         }
     }
-    else if(ret < 0) {
-        if(writeErrno == EAGAIN) {
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
+}
+
+// 协程模式: 一个连接一个协程，读、处理、写按顺序写下来，
+// 等待可读可写时只挂起协程，查库交给阻塞线程池后回到事件循环继续
+CoTask<void> WebServer::ServeConn_(ConnHandle handle) {
+    HttpConn* client = &users_[handle.fd];
+    int fd = handle.fd;
+    int waitMS = timeoutMS_ > 0 ? timeoutMS_ : -1;
+    bool ok = true;
+    while(ok) {
+        /* 先处理缓冲区中已有的数据，不够一个请求再等可读 */
+        if(!client->process()) {
+            if(!client->IsPending()) {
+                if(!co_await coLoop_->Readable(fd, waitMS)) { break; }  /* 超时 */
+                int readErrno = 0;
+                ssize_t ret = client->read(&readErrno);
+                if(ret <= 0 && readErrno != EAGAIN) { break; }
+                continue;
+            }
+            co_await coLoop_->Offload(*blockingPool_, [client] { client->ProcessBlocking(); });
         }
+        while(client->ToWriteBytes() > 0) {
+            int writeErrno = 0;
+            ssize_t ret = client->write(&writeErrno);
+            if(client->ToWriteBytes() == 0) { break; }
+            if(ret < 0 && writeErrno == EAGAIN) {
+                ok = co_await coLoop_->Writable(fd, waitMS);
+            } else if(ret <= 0) {
+                ok = false;
+            }
+            if(!ok) { break; }
+        }
+        /* 传输完成，非长连接就关闭 */
+        if(!client->IsKeepAlive()) { break; }
     }
-    CloseConn_(client);
+    LOG_INFO("Client[%d] quit!", fd);
+    coLoop_->Forget(fd);
+    client->Close();
 }
 
 /* Create listenFd */
 bool WebServer::InitSocket_() {
-    int ret;
-    struct sockaddr_in addr;
     if(port_ > 65535 || port_ < 1024) {
         LOG_ERROR("Port:%d error!",  port_);
         return false;
     }
+
+    if(reactorMode_ == MULTI_REACTOR && reusePort_) {
+        /* 每个从反应堆一个监听套接字，主反应堆不再accept */
+        for(auto& reactor: subReactors_) {
+            int fd = CreateListenFd_();
+            if(fd < 0) { return false; }
+            reactor->SetListenFd(fd, listenEvent_, maxFd_);
+        }
+        listenFd_ = -1;
+        LOG_INFO("Server port:%d, %d reuseport listeners", port_, (int)subReactors_.size());
+        return true;
+    }
+
+    listenFd_ = CreateListenFd_();
+    if(listenFd_ < 0) {
+        return false;
+    }
+    if(reactorMode_ == COROUTINE_REACTOR) {
+        /* 由accept协程等待监听套接字 */
+        LOG_INFO("Server port:%d", port_);
+        return true;
+    }
+
+    int ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN, &listenFd_);
+    
+    if(ret == 0) {
+        LOG_ERROR("Add listen error!");
+        close(listenFd_);
+        return false;
+    }
+    LOG_INFO("Server port:%d", port_);
+    return true;
+}
+
+// 创建绑定好端口、已经listen的非阻塞套接字，失败返回-1
+int WebServer::CreateListenFd_() {
+    int ret;
+    struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons(port_);
@@ -262,54 +499,55 @@ bool WebServer::InitSocket_() {
         optLinger.l_linger = 1;
     }
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0) {
         LOG_ERROR("Create socket error!", port_);
-        return false;
+        return -1;
     }
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
-        close(listenFd_);
+        close(listenFd);
         LOG_ERROR("Init linger error!", port_);
-        return false;
+        return -1;
     }
 
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
-        return false;
+        close(listenFd);
+        return -1;
+    }
+
+    /* 多个套接字绑定同一端口，内核在它们之间做负载均衡 */
+    if(reusePort_) {
+        ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if(ret == -1) {
+            LOG_ERROR("set SO_REUSEPORT error !");
+            close(listenFd);
+            return -1;
+        }
     }
 
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    ret = bind(listenFd, (struct sockaddr *)&addr, sizeof(addr));
     if(ret < 0) {
         LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
-        return false;
+        close(listenFd);
+        return -1;
     }
 
-    ret = listen(listenFd_, 6);
+    ret = listen(listenFd, backlog_);
     if(ret < 0) {
         LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
-        return false;
-    }
-
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
-    
-    if(ret == 0) {
-        LOG_ERROR("Add listen error!");
-        close(listenFd_);
-        return false;
+        close(listenFd);
+        return -1;
     }
 
     // 设置非阻塞
-    SetFdNonblock(listenFd_);
-    LOG_INFO("Server port:%d", port_);
-    return true;
+    SetFdNonblock(listenFd);
+    return listenFd;
 }
 
 // 设置文件描述符非阻塞
@@ -8,21 +8,29 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/resource.h> // getrlimit()
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "epoller.h"
+#include "reactor.h"
+#include "subreactor.h"
+#include "../coro/coloop.h"
+#include "../config/config.h"
 #include "../log/log.h"
 #include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
+#include "../pool/workstealingpool.h"
 #include "../pool/sqlconnRAII.h"
 #include "../http/httpconn.h"
+#include "../http/routes.h"
 
 class WebServer {
 public:
@@ -30,15 +38,18 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        const Config& config = Config());
 
     ~WebServer();
     void Start();
 
 private:
     bool InitSocket_(); 
+    int CreateListenFd_();
     void InitEventMode_(int trigMode);
     void AddClient_(int fd, sockaddr_in addr);
+    void DispatchClient_(int fd, sockaddr_in addr);
 
     void DealListen_();
     void DealWrite_(HttpConn* client);
@@ -48,9 +59,27 @@ private:
     void ExtentTime_(HttpConn* client);
     void CloseConn_(HttpConn* client);
 
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* client);
+    HttpConn* GetConn_(const ConnHandle& handle);
+    HttpConn* AcquireConn_(const ConnHandle& handle);
+    void ReleaseConn_(HttpConn* client, const ConnHandle& handle);
+    void TryClose_(ConnHandle handle);
+
+    // 线程池任务只持有句柄，执行时句柄过期则直接返回
+    void OnRead_(ConnHandle handle);
+    void OnWrite_(ConnHandle handle);
     void OnProcess(HttpConn* client);
+    void OnBlocking_(ConnHandle handle);
+
+    // 协程模式
+    CoTask<void> AcceptLoop_();
+    CoTask<void> ServeConn_(ConnHandle handle);
+
+    // 按配置交给共享队列线程池或工作窃取线程池
+    template<class F>
+    void AddTask_(F&& task) {
+        if(stealPool_) { stealPool_->AddTask(std::forward<F>(task)); }
+        else { threadpool_->AddTask(std::forward<F>(task)); }
+    }
 
     static const int MAX_FD = 65536;   //最大的文件描述符的个数
 
@@ -60,6 +89,10 @@ private:
     bool openLinger_; //是否打开优雅关闭
     int timeoutMS_;   /* 毫秒MS */
     bool isClose_;    //是否关闭
+    int reactorMode_; //反应堆模式
+    bool reusePort_;  //是否使用SO_REUSEPORT
+    int backlog_;     //listen的队列长度
+    int maxFd_;       //连接槽位数，fd必须小于它
     int listenFd_;    //监听的文件描述符
     char* srcDir_;    //资源的目录
     
@@ -68,8 +101,14 @@ private:
    
     std::unique_ptr<HeapTimer> timer_;        //定时器
     std::unique_ptr<ThreadPool> threadpool_;  //线程池
-    std::unique_ptr<Epoller> epoller_;        //epoll对象
-    std::unordered_map<int, HttpConn> users_; //保存的是客户端连接的信息
+    std::unique_ptr<ThreadPool> blockingPool_; //专门执行查库等阻塞操作的线程池，不占用处理静态请求的线程
+    std::unique_ptr<Poller> epoller_;         //多路复用对象(epoll或io_uring)
+    std::unique_ptr<HttpConn[]> users_;       //按fd下标预分配的连接槽位，地址固定，epoll的data.ptr直接指向它
+
+    std::vector<std::unique_ptr<Reactor>> subReactors_;    //从反应堆，多反应堆模式下使用
+    std::unique_ptr<CoLoop> coLoop_;                       //协程事件循环，协程模式下使用
+    size_t nextReactor_;                                   //轮询分发新连接的下标
+    std::unique_ptr<WorkStealingPool> stealPool_;          //工作窃取线程池，最后声明、最先析构，等任务执行完再释放连接
 };
 
 
@@ -3,12 +3,12 @@
 // 上浮操作，用于调整堆结构
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size()); // 断言，确保下标 i 合法
-    size_t j = (i - 1) / 2; // 计算父节点的下标
-    while(j >= 0) { // 循环直到根节点
+    // 下标是无符号数，根节点没有父节点，(0 - 1) / 2 会越界，所以在i到达根节点时停下
+    while(i > 0) { // 循环直到根节点
+        size_t j = (i - 1) / 2; // 计算父节点的下标
         if(heap_[j] < heap_[i]) { break; } // 如果父节点的到期时间小于子节点的到期时间，则不需要调整
         SwapNode_(i, j); // 否则交换父子节点
         i = j; // 更新当前节点下标
-        j = (i - 1) / 2; // 更新父节点下标
     }
 }
 
@@ -71,6 +71,15 @@ void HeapTimer::doWork(int id) {
     del_(i); // 删除计时器节点
 }
 
+// 取消计时器节点
+void HeapTimer::cancel(int id) {
+    /* 删除指定id结点，不触发回调函数 */
+    if(ref_.count(id) == 0) {
+        return;
+    }
+    del_(ref_[id]);
+}
+
 // 删除指定位置的计时器节点
 void HeapTimer::del_(size_t index) {
     /* 删除指定位置的结点 */
@@ -93,7 +102,8 @@ void HeapTimer::del_(size_t index) {
 // 调整指定id的结点
 void HeapTimer::adjust(int id, int timeout) {
     /* 调整指定id的结点 */
-    assert(!heap_.empty() && ref_.count(id) > 0); // 断言，确保堆不为空且指定ID存在于映射表中
+    // 结点可能已经到期被删除(连接正在关闭)，此时不需要调整
+    if(ref_.count(id) == 0) { return; }
     heap_[ref_[id]].expires = Clock::now() + MS(timeout);; // 更新节点的到期时间
     siftdown_(ref_[id], heap_.size()); // 调整堆结构
 }
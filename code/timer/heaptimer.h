@@ -43,6 +43,8 @@ public: // 公有成员部分
 
     void doWork(int id); // 处理计时器节点的工作
 
+    void cancel(int id); // 删除计时器节点，不触发回调
+
     void clear(); // 清空堆
 
     void tick(); // 触发超时计时器节点的回调函数
@@ -0,0 +1,1564 @@
+/*
+ * 基准测试: make bench && ./bench
+ */
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <new>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include "../code/pool/threadpool.h"
+#include "../code/pool/workstealingpool.h"
+#include "../code/coro/coloop.h"
+#include "../code/buffer/buffer.h"
+#include "../code/buffer/outputchain.h"
+#include "../code/buffer/readsizer.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/httpresponse.h"
+#include "../code/http/httpscan.h"
+#include "../code/http/httpconn.h"
+#include "../code/http/router.h"
+#include "../code/server/subreactor.h"
+#include "../code/server/uringreactor.h"
+
+// 统计本线程的堆分配次数，看每个请求要分配几次。new和delete成对替换成malloc/free，
+// GCC看不出来，会误报-Wmismatched-new-delete
+static thread_local long allocCount = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(size_t size) {
+    allocCount++;
+    if(void* ptr = malloc(size ? size : 1)) { return ptr; }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+#pragma GCC diagnostic pop
+
+/* ---------------- accept 速率: 单监听套接字 vs SO_REUSEPORT ---------------- */
+
+static int CreateListener(int port, bool reusePort, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if(reusePort) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+    }
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 一个事件循环线程: epoll等待监听套接字，ET方式accept到EAGAIN
+static void AcceptLoop(int listenFd, const std::atomic<bool>& stop, std::atomic<long>& accepted) {
+    int epfd = epoll_create1(0);
+    epoll_event ev = { 0 };
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listenFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+    epoll_event events[16];
+    while(!stop) {
+        int n = epoll_wait(epfd, events, 16, 50);
+        for(int i = 0; i < n; i++) {
+            int fd;
+            while((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                close(fd);
+                accepted++;
+            }
+        }
+    }
+    close(epfd);
+}
+
+// 客户端: 不停地建立连接再以RST关闭，避免TIME_WAIT耗尽端口
+static void ConnectLoop(int port, const std::atomic<bool>& stop) {
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    struct linger optLinger = { 1, 0 };
+    while(!stop) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+        close(fd);
+    }
+}
+
+static void RunAccept(const char* name, int port, int listeners, bool reusePort, int backlog) {
+    const int CLIENTS = 8;
+    const int SECONDS = 2;
+    std::vector<int> fds;
+    for(int i = 0; i < listeners; i++) {
+        int fd = CreateListener(port, reusePort, backlog);
+        if(fd < 0) { return; }
+        fds.push_back(fd);
+    }
+    std::atomic<bool> stop(false);
+    std::atomic<long> accepted(0);
+    std::vector<std::thread> threads;
+    for(int fd: fds) {
+        threads.emplace_back(AcceptLoop, fd, std::cref(stop), std::ref(accepted));
+    }
+    for(int i = 0; i < CLIENTS; i++) {
+        threads.emplace_back(ConnectLoop, port, std::cref(stop));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(SECONDS));
+    stop = true;
+    for(auto& t: threads) { t.join(); }
+    for(int fd: fds) { close(fd); }
+    printf("%-36s %10.0f accepts/s\n", name, accepted / (double)SECONDS);
+}
+
+void BenchAccept() {
+    const int LOOPS = 4;
+    printf("== accept rate, %d event loops ==\n", LOOPS);
+    RunAccept("single listener, backlog 6", 13160, 1, false, 6);
+    RunAccept("single listener, backlog 1024", 13161, 1, false, 1024);
+    RunAccept("SO_REUSEPORT x4, backlog 1024", 13162, LOOPS, true, 1024);
+}
+
+/* ---------------- 线程池吞吐: 共享队列 vs 工作窃取 ---------------- */
+
+// 模拟一次很短的读/处理任务
+static void SmallWork(std::atomic<long>& done) {
+    volatile unsigned x = 0;
+    for(int i = 0; i < 200; i++) { x = x * 31 + i; }
+    done.fetch_add(1, std::memory_order_relaxed);
+}
+
+// producers个线程(类似事件循环)各提交perProducer个任务，等全部执行完
+template<class Pool>
+static void RunPool(const char* name, int threads, int producers, long perProducer) {
+    std::atomic<long> done(0);
+    long total = producers * perProducer;
+    auto start = std::chrono::steady_clock::now();
+    {
+        Pool pool(threads);
+        std::vector<std::thread> ps;
+        for(int p = 0; p < producers; p++) {
+            ps.emplace_back([&] {
+                for(long i = 0; i < perProducer; i++) {
+                    pool.AddTask([&done] { SmallWork(done); });
+                }
+            });
+        }
+        for(auto& t: ps) { t.join(); }
+        while(done.load() < total) { std::this_thread::yield(); }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-36s %10.0f tasks/s\n", name, total / sec);
+}
+
+void BenchThreadPool() {
+    const int THREADS = 4;
+    const long TASKS = 500000;
+    printf("== thread pool throughput, %d workers ==\n", THREADS);
+    RunPool<ThreadPool>("queue pool, 1 producer", THREADS, 1, TASKS);
+    RunPool<WorkStealingPool>("work-stealing pool, 1 producer", THREADS, 1, TASKS);
+    RunPool<ThreadPool>("queue pool, 4 producers", THREADS, 4, TASKS / 4);
+    RunPool<WorkStealingPool>("work-stealing pool, 4 producers", THREADS, 4, TASKS / 4);
+}
+
+/* ---------------- 任务入队出队: std::function+std::bind vs Task ---------------- */
+
+struct FakeServer {
+    long sum = 0;
+    void OnRead(int fd, unsigned gen) { sum += fd + gen; }
+};
+
+void BenchTask() {
+    const long N = 5000000;
+    FakeServer server;
+    printf("== task queue push/pop, %ld tasks ==\n", N);
+
+    auto start = std::chrono::steady_clock::now();
+    std::queue<std::function<void()>> q1;
+    for(long i = 0; i < N; i++) {
+        q1.emplace(std::bind(&FakeServer::OnRead, &server, (int)i, 1u));
+        auto task = std::move(q1.front());
+        q1.pop();
+        task();
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-36s %10.1f ns/task\n", "std::queue<std::function>(bind)", sec * 1e9 / N);
+
+    start = std::chrono::steady_clock::now();
+    TaskQueue q2;
+    for(long i = 0; i < N; i++) {
+        int fd = (int)i;
+        unsigned gen = 1;
+        FakeServer* self = &server;
+        q2.push([self, fd, gen] { self->OnRead(fd, gen); });
+        Task task = q2.pop();
+        task();
+    }
+    sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-36s %10.1f ns/task\n", "TaskQueue<Task>(lambda)", sec * 1e9 / N);
+    if(server.sum == 0) { printf("\n"); }
+}
+
+/* ---------------- 弹性线程池: 阻塞任务混入时短任务的排队时间 ---------------- */
+
+// 每10ms提交一个阻塞30ms的"登录"任务和20个短任务，持续2秒，统计短任务排队时间
+static void RunMixed(const char* name, ThreadPool& pool) {
+    typedef std::chrono::steady_clock Clock;
+    std::mutex mtx;
+    std::vector<long> waits;
+    for(int round = 0; round < 200; round++) {
+        pool.AddTask([] { std::this_thread::sleep_for(std::chrono::milliseconds(30)); });
+        for(int i = 0; i < 20; i++) {
+            Clock::time_point t = Clock::now();
+            std::mutex* m = &mtx;
+            std::vector<long>* w = &waits;
+            pool.AddTask([t, m, w] {
+                long us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t).count();
+                std::lock_guard<std::mutex> locker(*m);
+                w->push_back(us);
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    while(pool.GetStats().queued > 0) { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }
+    std::lock_guard<std::mutex> locker(mtx);
+    std::sort(waits.begin(), waits.end());
+    ThreadPool::Stats st = pool.GetStats();
+    printf("%-36s p50 %6ldus p95 %6ldus, %zu threads\n", name,
+           waits[waits.size() / 2], waits[waits.size() * 95 / 100], st.threads);
+}
+
+void BenchElasticPool() {
+    printf("== queue wait with blocking tasks ==\n");
+    {
+        ThreadPool pool(2);
+        RunMixed("fixed 2 threads", pool);
+    }
+    {
+        ThreadPool pool(2, 16, 5, 1000);
+        RunMixed("elastic 2~16 threads, target 5ms", pool);
+    }
+}
+
+/* ---------------- 协程: 挂起的开销和Offload往返 ---------------- */
+
+static long RssKB() {
+    long kb = 0;
+    FILE* fp = fopen("/proc/self/status", "r");
+    char line[256];
+    while(fp && fgets(line, sizeof(line), fp)) {
+        if(strncmp(line, "VmRSS:", 6) == 0) { sscanf(line + 6, "%ld", &kb); }
+    }
+    if(fp) { fclose(fp); }
+    return kb;
+}
+
+static CoTask<void> SleepOnce(CoLoop& loop, long& done, long total) {
+    co_await loop.Sleep(200);
+    if(++done == total) { loop.Stop(); }
+}
+
+static CoTask<void> OffloadMany(CoLoop& loop, ThreadPool& pool, long n) {
+    long sum = 0;
+    for(long i = 0; i < n; i++) {
+        sum += co_await loop.Offload(pool, [i] { return i; });
+    }
+    if(sum < 0) { printf("\n"); }
+    loop.Stop();
+}
+
+void BenchCoroutine() {
+    const long N = 100000;
+    printf("== coroutine ==\n");
+    {
+        CoLoop loop;
+        long done = 0;
+        long before = RssKB();
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) { loop.Spawn(SleepOnce(loop, done, N)); }
+        long after = RssKB();
+        loop.Run();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%-36s %10.0f bytes/coroutine, %ld done in %.2fs\n", "suspended on Sleep",
+               (after - before) * 1024.0 / N, done, sec);
+    }
+    {
+        const long M = 200000;
+        CoLoop loop;
+        ThreadPool pool(2);
+        auto start = std::chrono::steady_clock::now();
+        loop.Spawn(OffloadMany(loop, pool, M));
+        loop.Run();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%-36s %10.1f us/round trip\n", "Offload to pool and back", sec * 1e6 / M);
+    }
+}
+
+// 保持backlog字节积压，每轮写入chunk再读走chunk，线性Buffer写满后要搬移积压数据
+template<class Buf>
+static double StreamNs(long n, size_t backlog, size_t chunk) {
+    Buf buff;
+    std::vector<char> data(backlog + chunk, 'x');
+    buff.Append(data.data(), backlog);
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < n; i++) {
+        buff.Append(data.data(), chunk);
+        buff.Retrieve(chunk);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+// 缓冲区曾被大请求撑到big字节，之后每个小消息写入后RetrieveAll
+template<class Buf>
+static double SmallMsgNs(long n, size_t big, size_t msg) {
+    Buf buff;
+    std::vector<char> data(big, 'x');
+    buff.Append(data.data(), big);
+    buff.RetrieveAll();
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < n; i++) {
+        buff.Append(data.data(), msg);
+        buff.RetrieveAll();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+// 经过管道: ReadFd读入，WriteFd写到/dev/null
+template<class Buf>
+static double PipeNs(long n, size_t backlog, size_t chunk) {
+    int fds[2];
+    int ret = pipe(fds);
+    assert(ret == 0);
+    (void)ret;
+    int devnull = open("/dev/null", O_WRONLY);
+    Buf buff;
+    std::vector<char> data(backlog + chunk, 'x');
+    buff.Append(data.data(), backlog);
+    int err = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < n; i++) {
+        ssize_t len = write(fds[1], data.data(), chunk);
+        assert(len == static_cast<ssize_t>(chunk));
+        (void)len;
+        buff.ReadFd(fds[0], &err);
+        // 读走新到的chunk字节，保持积压
+        if(buff.ReadableBytes() > backlog) {
+            buff.Retrieve(buff.ReadableBytes() - backlog);
+        }
+    }
+    buff.WriteFd(devnull, &err);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+    close(fds[0]);
+    close(fds[1]);
+    close(devnull);
+    return ns;
+}
+
+void BenchBuffer() {
+    const long N = 1000000;
+    printf("== buffer ==\n");
+    printf("%-36s %10.1f ns/op\n", "Buffer stream 8K backlog", StreamNs<Buffer>(N, 8192, 1500));
+    printf("%-36s %10.1f ns/op\n", "Buffer 300B msg after 64K", SmallMsgNs<Buffer>(N / 10, 65536, 300));
+    printf("%-36s %10.1f ns/op\n", "Buffer pipe ReadFd 8K backlog", PipeNs<Buffer>(N / 10, 8192, 1500));
+}
+
+// 一个连接上的请求/响应循环: 读缓冲区解析请求，生成响应头写入写缓冲区，然后清空两个缓冲区
+// 在test目录下运行，静态资源取 ../resources/
+void BenchHttpLoop() {
+    const long N = 200000;
+    const std::string srcDir = "../resources/";
+    const char raw[] = "GET /index.html HTTP/1.1\r\n"
+                       "Host: 127.0.0.1:1316\r\n"
+                       "User-Agent: bench\r\n"
+                       "Accept: text/html\r\n"
+                       "Connection: keep-alive\r\n\r\n";
+    printf("== http parse/response loop ==\n");
+    {
+        Buffer buff;
+        std::vector<char> data(512, 'x');
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N * 10; i++) {
+            buff.Append(data.data(), data.size());
+            while(buff.ReadableBytes() > 0) { buff.Retrieve(std::min<size_t>(64, buff.ReadableBytes())); }
+            buff.RetrieveAll();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (N * 10);
+        printf("%-36s %10.1f ns/op\n", "Buffer append 512B, retrieve by 64B", ns);
+    }
+    {
+        HttpRequest request;
+        HttpResponse response;
+        Buffer readBuff, writeBuff;
+        long ok = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N / 10; i++) {
+            readBuff.Append(raw, sizeof(raw) - 1);
+            request.Init();
+            if(request.parse(readBuff) == HttpRequest::GET_REQUEST) { ok++; }
+            response.Init(srcDir, request.path(), request.IsKeepAlive(), 200);
+            response.MakeResponse(writeBuff);
+            response.UnmapFile();
+            writeBuff.RetrieveAll();
+            readBuff.RetrieveAll();
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (N / 10);
+        printf("%-36s %10.2f us/request (%ld parsed)\n", "parse + MakeResponse", us, ok);
+    }
+    {
+        // 不经过解析，只有响应生成和缓冲区读写，缓冲区开销占比更大
+        HttpResponse response;
+        Buffer writeBuff;
+        std::string path = "/index.html";
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            response.Init(srcDir, path, true, 200);
+            response.MakeResponse(writeBuff);
+            response.UnmapFile();
+            writeBuff.RetrieveAll();
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-36s %10.2f us/request\n", "MakeResponse only", us);
+    }
+}
+
+// 模拟K条keep-alive连接各处理过一次请求后空闲: 请求1200B、响应头250B，每10条里有一条带过32K的请求体
+// 对比原来按需resize、从不缩小的vector，和现在空闲时把存储还给BufferPool的Buffer
+void BenchBufferPool() {
+    const long K = 20000;
+    std::vector<char> req(1200, 'x'), body(32768, 'x'), resp(250, 'x');
+    printf("== buffer pool, %ld idle connections ==\n", K);
+    {
+        long before = RssKB();
+        std::vector<std::vector<char>> reads(K), writes(K);
+        for(long i = 0; i < K; i++) {
+            reads[i].resize(req.size() + 1);
+            if(i % 10 == 0) { reads[i].resize(req.size() + body.size() + 1); }
+            memcpy(reads[i].data(), req.data(), req.size());
+            writes[i].resize(resp.size() + 1);
+            memcpy(writes[i].data(), resp.data(), resp.size());
+        }
+        long after = RssKB();
+        printf("%-36s %10.0f bytes/connection\n", "vector, never shrinks (before)", (after - before) * 1024.0 / K);
+    }
+    {
+        long before = RssKB();
+        // 和HttpConn一样，缓冲区构造时不取存储
+        struct Conn {
+            Buffer readBuff{0};
+            Buffer writeBuff{0};
+        };
+        std::vector<Conn> conns(K);
+        for(long i = 0; i < K; i++) {
+            conns[i].readBuff.Append(req.data(), req.size());
+            if(i % 10 == 0) { conns[i].readBuff.Append(body.data(), body.size()); }
+            conns[i].readBuff.RetrieveAll();
+            conns[i].readBuff.ReleaseSpace();
+            conns[i].writeBuff.Append(resp.data(), resp.size());
+            conns[i].writeBuff.RetrieveAll();
+            conns[i].writeBuff.ReleaseSpace();
+        }
+        long after = RssKB();
+        BufferPool::Stats stats = BufferPool::GetStats();
+        printf("%-36s %10.0f bytes/connection\n", "Buffer + BufferPool", (after - before) * 1024.0 / K);
+        printf("%-36s in use %zu/%zu/%zu, cached %zu/%zu/%zu, hits %zu, misses %zu\n", "pool 4K/16K/64K",
+               stats.inUse[0], stats.inUse[1], stats.inUse[2],
+               stats.cached[0], stats.cached[1], stats.cached[2], stats.hits, stats.misses);
+    }
+    {
+        const long N = 1000000;
+        Buffer buff(0);
+        std::vector<char> data(1200, 'x');
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            buff.Append(data.data(), data.size());
+            buff.RetrieveAll();
+            buff.ReleaseSpace();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-36s %10.1f ns/op\n", "check out + append + return", ns);
+    }
+}
+
+// 一批16个响应(约200B响应头 + 4KB缓存的响应体)写到/dev/null:
+// 拷贝进一个Buffer再write、每个响应一次两段writev(原来的iov_[2])、输出链一次writev
+void BenchOutputChain() {
+    const long N = 200000;
+    const int BATCH = 16;
+    int devnull = open("/dev/null", O_WRONLY);
+    std::string header(200, 'h');
+    auto body = std::make_shared<std::vector<char>>(4096, 'b');
+    int err = 0;
+    printf("== output chain, %d responses per flush ==\n", BATCH);
+    {
+        Buffer buff;
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            for(int j = 0; j < BATCH; j++) {
+                buff.Append(header);
+                buff.Append(body->data(), body->size());
+            }
+            buff.WriteFd(devnull, &err);
+            buff.RetrieveAll();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-36s %10.0f ns/batch\n", "copy into Buffer + write", ns);
+    }
+    {
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            for(int j = 0; j < BATCH; j++) {
+                struct iovec iov[2];
+                iov[0].iov_base = &header[0];
+                iov[0].iov_len = header.size();
+                iov[1].iov_base = body->data();
+                iov[1].iov_len = body->size();
+                ssize_t len = writev(devnull, iov, 2);
+                (void)len;
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-36s %10.0f ns/batch\n", "iov[2] writev per response", ns);
+    }
+    {
+        OutputChain chain;
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            for(int j = 0; j < BATCH; j++) {
+                chain.Append(header);
+                chain.AppendShared(body, body->data(), body->size());
+            }
+            chain.WriteFd(devnull, &err);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-36s %10.0f ns/batch (%zu left)\n", "OutputChain single writev", ns, chain.Bytes());
+    }
+    close(devnull);
+}
+
+// 原来的ReadFd: 栈上64KB临时数组，读超出可写空间的部分再Append进缓冲区
+static ssize_t StackReadFd(Buffer& buff, int fd, int* saveErrno) {
+    char extra[65535];
+    struct iovec iov[2];
+    const size_t writable = buff.WritableBytes();
+    iov[0].iov_base = buff.BeginWrite();
+    iov[0].iov_len = writable;
+    iov[1].iov_base = extra;
+    iov[1].iov_len = sizeof(extra);
+    const ssize_t len = readv(fd, iov, 2);
+    if(len < 0) {
+        *saveErrno = errno;
+    } else if(static_cast<size_t>(len) <= writable) {
+        buff.HasWritten(len);
+    } else {
+        buff.HasWritten(writable);
+        buff.Append(extra, len - writable);
+    }
+    return len;
+}
+
+// ET方式读到EAGAIN，adaptive为true时用ReadSizer给的大小直接读进缓冲区
+static size_t ReadAll(Buffer& buff, ReadSizer& sizer, int fd, bool adaptive) {
+    size_t total = 0;
+    int err = 0;
+    while(true) {
+        ssize_t len = adaptive ? buff.ReadFd(fd, &err, sizer.Hint()) : StackReadFd(buff, fd, &err);
+        if(len <= 0) { break; }
+        if(adaptive) { sizer.Record(len, buff.WritableBytes() + len); }
+        total += len;
+    }
+    return total;
+}
+
+// 小请求: 每次300B，读完解析掉; 上传: 1MB的请求体每次到64KB，整个请求体读完之前一直留在缓冲区
+static double ReadNs(bool adaptive, long rounds, size_t chunk, size_t keep, ReadSizer::Stats* stats) {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+    (void)ret;
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    int size = 1 << 20;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    std::vector<char> data(chunk, 'x');
+    Buffer buff(0);
+    ReadSizer sizer;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < rounds; i++) {
+        ssize_t len = write(fds[1], data.data(), data.size());
+        assert(len == static_cast<ssize_t>(chunk));
+        (void)len;
+        ReadAll(buff, sizer, fds[0], adaptive);
+        if(buff.ReadableBytes() >= keep) {
+            buff.RetrieveAll();
+            buff.ReleaseSpace();
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+    if(stats) { *stats = sizer.GetStats(); }
+    close(fds[0]);
+    close(fds[1]);
+    return ns;
+}
+
+void BenchAdaptiveRead() {
+    const long N = 200000;
+    ReadSizer::Stats stats;
+    printf("== adaptive read ==\n");
+    printf("%-36s %10.0f ns/request\n", "300B requests, 64K stack readv", ReadNs(false, N, 300, 1, nullptr));
+    printf("%-36s %10.0f ns/request\n", "300B requests, adaptive", ReadNs(true, N, 300, 1, &stats));
+    printf("%-36s reads %zu, max %zu, grows %zu, hint %zu\n", "  stats", stats.reads, stats.maxBytes, stats.grows, stats.hint);
+    printf("%-36s %10.0f ns/64K\n", "1MB upload, 64K stack readv", ReadNs(false, N / 10, 65536, 1 << 20, nullptr));
+    printf("%-36s %10.0f ns/64K\n", "1MB upload, adaptive", ReadNs(true, N / 10, 65536, 1 << 20, &stats));
+    printf("%-36s reads %zu, max %zu, full %zu, grows %zu, shrinks %zu, hint %zu\n", "  stats",
+           stats.reads, stats.maxBytes, stats.fullReads, stats.grows, stats.shrinks, stats.hint);
+}
+
+/* ---------------- 请求解析: 原来的正则解析 vs string_view状态机 ---------------- */
+
+// 原来的解析流程: 每行拷贝成string，请求行和请求头各用一次regex_match，请求头存进unordered_map
+struct LegacyRequest {
+    std::string method, path, version, body;
+    std::unordered_map<std::string, std::string> header;
+};
+
+static bool LegacyParse(Buffer& buff, LegacyRequest& req) {
+    const char CRLF[] = "\r\n";
+    enum { REQUEST_LINE, HEADERS, BODY, FINISH } state = REQUEST_LINE;
+    while(buff.ReadableBytes() && state != FINISH) {
+        const char* lineEnd = std::search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
+        std::string line(buff.Peek(), lineEnd);
+        std::smatch subMatch;
+        if(state == REQUEST_LINE) {
+            std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+            if(!std::regex_match(line, subMatch, patten)) { return false; }
+            req.method = subMatch[1];
+            req.path = subMatch[2];
+            req.version = subMatch[3];
+            state = HEADERS;
+        } else if(state == HEADERS) {
+            std::regex patten("^([^:]*): ?(.*)$");
+            if(std::regex_match(line, subMatch, patten)) { req.header[subMatch[1]] = subMatch[2]; }
+            else { state = BODY; }
+            if(buff.ReadableBytes() <= 2) { state = FINISH; }
+        } else {
+            req.body = line;
+            state = FINISH;
+        }
+        if(lineEnd == buff.BeginWrite()) { break; }
+        buff.RetrieveUntil(lineEnd + 2);
+    }
+    return true;
+}
+
+// curl、带长UA和cookie的浏览器GET、表单POST
+static const std::string HTTP_CORPUS[] = {
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:1316\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n\r\n",
+
+    "GET /images/profile-image.jpg HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: https://www.example.com/picture.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1712345678; session=3f2a9c1e7b6d4a5f8e0c2b1a9d8e7f6a; "
+    "theme=dark; _ga_ABCDEF=GS1.1.1712345678.3.1.1712349999.0.0.0\r\n"
+    "If-None-Match: \"5f3c-61a2b3c4d5e6f\"\r\n\r\n",
+
+    "POST /login HTTP/1.1\r\n"
+    "Host: 127.0.0.1:1316\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 31\r\n"
+    "Origin: http://127.0.0.1:1316\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://127.0.0.1:1316/login.html\r\n\r\n"
+    "username=name&password=password",
+};
+static const char* HTTP_CORPUS_NAMES[] = { "curl GET", "browser GET", "form POST" };
+
+void BenchHttpParse() {
+    const long N = 200000;
+    printf("== http request parse ==\n");
+    for(int c = 0; c < 3; c++) {
+        const std::string& raw = HTTP_CORPUS[c];
+        Buffer buff;
+        long ok = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N / 100; i++) {
+            LegacyRequest req;
+            buff.Append(raw);
+            if(LegacyParse(buff, req)) { ok++; }
+            buff.RetrieveAll();
+        }
+        double legacyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (N / 100);
+
+        HttpRequest request;
+        start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            request.Init();
+            buff.Append(raw);
+            if(request.parse(buff) == HttpRequest::GET_REQUEST) { ok++; }
+            buff.RetrieveAll();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-12s %4zuB  regex %9.0f ns (%7.0f req/s)  state machine %6.0f ns (%9.0f req/s)  %.0fx\n",
+               HTTP_CORPUS_NAMES[c], raw.size(), legacyNs, 1e9 / legacyNs, ns, 1e9 / ns, legacyNs / ns);
+        assert(ok == N / 100 + N);
+    }
+}
+
+/* ---------------- 请求解析中的字节扫描: 逐字节 vs SSE4.2 vs AVX2 ---------------- */
+
+// 原来的分行方式: memchr找LF，再逐字节检查这一行里有没有非法字符
+static const char* MemchrLineEnd(const char* begin, const char* end) {
+    const char* lf = static_cast<const char*>(memchr(begin, '\n', end - begin));
+    if(!lf) { return end; }
+    for(const char* p = begin; p < lf - 1; p++) {
+        unsigned char ch = *p;
+        if((ch < 0x20 && ch != '\t') || ch == 0x7f) { return p; }
+    }
+    return lf - 1;
+}
+
+// 把一个请求按CRLF切成行并校验，返回每KB耗时
+template<typename Func>
+static double SplitNsPerKB(const std::string& raw, long rounds, Func lineEnd) {
+    const char* begin = raw.data();
+    const char* end = begin + raw.size();
+    long lines = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < rounds; i++) {
+        const char* pos = begin;
+        while(pos < end) {
+            const char* eol = lineEnd(pos, end);
+            if(eol == end || *eol != '\r') { break; }
+            pos = eol + 2;
+            lines++;
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    assert(lines > 0);
+    return ns / rounds * 1024 / raw.size();
+}
+
+void BenchHttpScan() {
+    const long N = 200000;
+    HttpScan::ISA detected = HttpScan::Isa();
+    const HttpScan::ISA isas[] = { HttpScan::SCALAR, HttpScan::SSE42, HttpScan::AVX2 };
+    printf("== http scan (detected %s) ==\n", HttpScan::IsaName(detected));
+    for(int c = 0; c < 3; c++) {
+        const std::string& raw = HTTP_CORPUS[c];
+        printf("%-12s %4zuB  split+check  memchr %6.0f ns/KB", HTTP_CORPUS_NAMES[c], raw.size(),
+               SplitNsPerKB(raw, N, MemchrLineEnd));
+        for(HttpScan::ISA isa: isas) {
+            if(!HttpScan::UseIsa(isa)) { continue; }
+            printf("  %s %6.0f", HttpScan::IsaName(isa), SplitNsPerKB(raw, N, HttpScan::FindCtl));
+        }
+        printf("\n%-12s %4s   parse       ", "", "");
+        for(HttpScan::ISA isa: isas) {
+            if(!HttpScan::UseIsa(isa)) { continue; }
+            HttpRequest request;
+            Buffer buff;
+            auto start = std::chrono::steady_clock::now();
+            for(long i = 0; i < N; i++) {
+                request.Init();
+                buff.Append(raw);
+                request.parse(buff);
+                buff.RetrieveAll();
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+            printf("  %s %6.0f ns/req", HttpScan::IsaName(isa), ns);
+        }
+        printf("\n");
+    }
+    HttpScan::UseIsa(detected);
+}
+
+/* ---------------- 慢速客户端: 请求逐字节到达 ---------------- */
+
+// 每到一个字节调用一次parse。restart为true时模拟原来的做法: 每次都从请求开头重新解析。
+// parse会从缓冲区去掉已经处理的请求体，所以重新解析时每次放入完整的已到达部分
+static double TrickleNs(const std::string& raw, long rounds, bool restart) {
+    HttpRequest request;
+    Buffer buff;
+    long done = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < rounds; i++) {
+        for(size_t j = 0; j < raw.size(); j++) {
+            if(restart) {
+                request.Init();
+                buff.RetrieveAll();
+                buff.Append(raw.data(), j + 1);
+            } else {
+                buff.Append(raw.data() + j, 1);
+            }
+            if(request.parse(buff) == HttpRequest::GET_REQUEST) { done++; }
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    assert(done == rounds);
+    return ns / rounds;
+}
+
+void BenchIncrementalParse() {
+    const long N = 2000;
+    printf("== incremental parse, 1 byte per read ==\n");
+    for(int c = 0; c < 3; c++) {
+        const std::string& raw = HTTP_CORPUS[c];
+        double restart = TrickleNs(raw, N, true);
+        double resume = TrickleNs(raw, N, false);
+        printf("%-12s %4zuB  restart %9.0f ns/req  resume %8.0f ns/req  %.1fx\n",
+               HTTP_CORPUS_NAMES[c], raw.size(), restart, resume, restart / resume);
+    }
+}
+
+/* ---------------- 流水线: 一次处理一个请求 vs 一批请求一次writev ---------------- */
+
+// 本线程到目前为止的写类系统调用次数，sendfile也算在内
+static long WriteSyscalls() {
+    FILE* fp = fopen("/proc/thread-self/io", "r");
+    if(!fp) { return 0; }
+    char line[128];
+    long count = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        if(sscanf(line, "syscw: %ld", &count) == 1) { break; }
+    }
+    fclose(fp);
+    return count;
+}
+
+// 客户端一次发来k个流水线请求，服务端read、process、write直到处理完，每次process后像反应堆那样重新注册一次epoll。
+// depth为1时就是原来每次唤醒只处理一个请求的做法。writes不为空时记下服务端每批请求的写类系统调用次数(writev、sendfile)
+static double PipelineNs(int depth, int k, long rounds, double* batches,
+                         const std::string& path = "/index.html", double* writes = nullptr) {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+    int size = 1 << 21;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = { 0 };
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev);
+
+    std::string batch;
+    for(int i = 0; i < k; i++) {
+        batch += "GET " + path + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+    }
+    HttpConn::maxPipeline = depth;
+    HttpConn conn;
+    struct sockaddr_in addr = { 0 };
+    conn.init(fds[0], addr);
+    std::vector<char> sink(1 << 21);
+    long processed = 0;
+    long syscw = WriteSyscalls();
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < rounds; i++) {
+        ssize_t len = ::write(fds[1], batch.data(), batch.size());
+        assert(len == static_cast<ssize_t>(batch.size()));
+        int err = 0;
+        conn.read(&err);
+        while(conn.process()) {
+            while(conn.ToWriteBytes() > 0) {
+                len = conn.write(&err);
+                if(len <= 0) {
+                    // 大文件一批响应超过套接字缓冲区，先把对端读空
+                    assert(err == EAGAIN);
+                    while(::read(fds[1], sink.data(), sink.size()) > 0) {}
+                }
+            }
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &ev);
+            processed++;
+        }
+        while(::read(fds[1], sink.data(), sink.size()) > 0) {}
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if(writes) {
+        // 减去客户端每轮发请求的那次write
+        *writes = static_cast<double>(WriteSyscalls() - syscw - rounds) / rounds;
+    }
+    HttpConn::maxPipeline = 32;
+    conn.Close();
+    close(fds[1]);
+    close(epfd);
+    *batches = static_cast<double>(processed) / rounds;
+    return ns / (rounds * k);
+}
+
+void BenchPipeline() {
+    const long N = 20000;
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = true;
+    printf("== pipelining ==\n");
+    for(int k: { 1, 4, 16 }) {
+        double oneBatches, allBatches;
+        double one = PipelineNs(1, k, N / k, &oneBatches);
+        double all = PipelineNs(32, k, N / k, &allBatches);
+        printf("%2d pipelined  one per wake-up %6.2f us/req (%4.1f writev)  batched %6.2f us/req (%4.1f writev)\n",
+               k, one / 1000, oneBatches, all / 1000, allBatches);
+    }
+}
+
+/* ---------------- 请求体: 整个收进读缓冲区 vs 边收边交给处理函数 ---------------- */
+
+// 一个size字节的请求体按64K一次到达，每次读后调用parse。stream为true时注册流式处理函数，
+// 否则攒在body_里。返回每MB耗时，peak返回读缓冲区最大的存储大小
+static double BodyNsPerMB(size_t size, bool chunked, bool stream, size_t* peak) {
+    const size_t READ = 65536;
+    std::string head = "POST /upload HTTP/1.1\r\nHost: bench\r\n";
+    std::string body;
+    if(chunked) {
+        head += "Transfer-Encoding: chunked\r\n\r\n";
+        char line[32];
+        for(size_t left = size; left > 0; ) {
+            size_t n = std::min<size_t>(left, 16384);
+            snprintf(line, sizeof(line), "%zx\r\n", n);
+            body += line;
+            body.append(n, 'b');
+            body += "\r\n";
+            left -= n;
+        }
+        body += "0\r\n\r\n";
+    } else {
+        head += "Content-Length: " + std::to_string(size) + "\r\n\r\n";
+        body.assign(size, 'b');
+    }
+    std::string raw = head + body;
+    size_t received = 0;
+    if(stream) {
+        HttpRequest::bodyHandlerFactory = [&received](HttpRequest&) {
+            return [&received](const char*, size_t len) { received += len; return true; };
+        };
+    }
+    const int ROUNDS = 20;
+    *peak = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < ROUNDS; r++) {
+        HttpRequest request;
+        Buffer buff(0);
+        HttpRequest::HTTP_CODE ret = HttpRequest::NO_REQUEST;
+        for(size_t off = 0; off < raw.size() && ret == HttpRequest::NO_REQUEST; off += READ) {
+            buff.Append(raw.data() + off, std::min(READ, raw.size() - off));
+            *peak = std::max(*peak, buff.Capacity());
+            ret = request.parse(buff);
+        }
+        assert(ret == HttpRequest::GET_REQUEST);
+        assert(stream || request.body().size() == size);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    HttpRequest::bodyHandlerFactory = nullptr;
+    assert(!stream || received == size * ROUNDS);
+    return ns / ROUNDS / (size >> 20);
+}
+
+void BenchRequestBody() {
+    const size_t SIZE = 4 << 20;
+    size_t peak;
+    printf("== request body, 4MB in 64K reads ==\n");
+    BodyNsPerMB(SIZE, true, false, &peak);  // 预热: 先让malloc把mmap阈值调上去，否则第一项全是缺页
+    double ns = BodyNsPerMB(SIZE, false, false, &peak);
+    printf("%-36s %8.0f us/MB  read buffer peak %zuK\n", "Content-Length, buffered", ns / 1000, peak >> 10);
+    ns = BodyNsPerMB(SIZE, false, true, &peak);
+    printf("%-36s %8.0f us/MB  read buffer peak %zuK\n", "Content-Length, streamed", ns / 1000, peak >> 10);
+    ns = BodyNsPerMB(SIZE, true, false, &peak);
+    printf("%-36s %8.0f us/MB  read buffer peak %zuK\n", "chunked 16K, buffered", ns / 1000, peak >> 10);
+    ns = BodyNsPerMB(SIZE, true, true, &peak);
+    printf("%-36s %8.0f us/MB  read buffer peak %zuK\n", "chunked 16K, streamed", ns / 1000, peak >> 10);
+}
+
+/* ---------------- multipart上传: 整个收进body_ vs 边收边写临时文件 ---------------- */
+
+// 一个size字节的文件以multipart/form-data按64K一次到达。stream为true时用FormDataHandler写进临时文件，
+// 否则整个请求体攒在body_里(原来的做法)。返回每MB耗时，held返回请求占的最大内存(读缓冲区加body_)
+static double UploadNsPerMB(size_t size, bool stream, size_t* held) {
+    const size_t READ = 65536;
+    std::string body = "--bench-boundary\r\n"
+                       "Content-Disposition: form-data; name=\"note\"\r\n\r\nhello\r\n"
+                       "--bench-boundary\r\n"
+                       "Content-Disposition: form-data; name=\"file\"; filename=\"big.bin\"\r\n"
+                       "Content-Type: application/octet-stream\r\n\r\n";
+    body.append(size, 'u');
+    body += "\r\n--bench-boundary--\r\n";
+    std::string raw = "POST /upload HTTP/1.1\r\nHost: bench\r\n"
+                      "Content-Type: multipart/form-data; boundary=bench-boundary\r\n"
+                      "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    size_t maxBody = HttpRequest::maxBodySize, maxStream = HttpRequest::maxStreamBodySize;
+    HttpRequest::maxBodySize = HttpRequest::maxStreamBodySize = raw.size();
+    if(stream) {
+        HttpRequest::bodyHandlerFactory = [](HttpRequest& request) { return request.FormDataHandler(); };
+    }
+    const int ROUNDS = 3;
+    *held = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < ROUNDS; r++) {
+        HttpRequest request;
+        Buffer buff(0);
+        HttpRequest::HTTP_CODE ret = HttpRequest::NO_REQUEST;
+        for(size_t off = 0; off < raw.size() && ret == HttpRequest::NO_REQUEST; off += READ) {
+            buff.Append(raw.data() + off, std::min(READ, raw.size() - off));
+            ret = request.parse(buff);
+            *held = std::max(*held, buff.Capacity() + request.body().capacity());
+        }
+        assert(ret == HttpRequest::GET_REQUEST);
+        assert(!stream || (request.files().size() == 1 && request.files()[0].size == size));
+        request.RemoveUploads();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    HttpRequest::bodyHandlerFactory = nullptr;
+    HttpRequest::maxBodySize = maxBody;
+    HttpRequest::maxStreamBodySize = maxStream;
+    return ns / ROUNDS / (size >> 20);
+}
+
+void BenchUpload() {
+    const size_t SIZE = 64 << 20;
+    size_t held;
+    printf("== multipart upload, 64MB in 64K reads ==\n");
+    double ns = UploadNsPerMB(SIZE, false, &held);
+    printf("%-36s %8.0f us/MB  request memory peak %zuK\n", "buffered in body", ns / 1000, held >> 10);
+    ns = UploadNsPerMB(SIZE, true, &held);
+    printf("%-36s %8.0f us/MB  request memory peak %zuK\n", "streamed to temp file", ns / 1000, held >> 10);
+}
+
+/* ---------------- JSON请求体: 每KB的解析耗时，和urlencoded表单对比 ---------------- */
+
+// 扁平的接口请求，字段和表单一样多，可以和urlencoded直接比
+static std::string JsonApiBody(std::string* form) {
+    std::string json = "{";
+    for(int i = 0; i < 24; i++) {
+        std::string key = "field" + std::to_string(i);
+        std::string value = "value-" + std::to_string(i * 7919) + "-abcdefgh";
+        json += (i ? ",\"" : "\"") + key + "\":\"" + value + "\"";
+        *form += (i ? "&" : "") + key + "=" + value;
+    }
+    return json + "}";
+}
+
+// 对象数组，数字、布尔和短字符串混合
+static std::string JsonRecordsBody() {
+    std::string json = "[";
+    for(int i = 0; i < 120; i++) {
+        json += i ? ",\n  " : "\n  ";
+        json += "{\"id\": " + std::to_string(100000 + i) + ", \"name\": \"user" + std::to_string(i) +
+                "\", \"score\": " + std::to_string(i * 0.37) + ", \"active\": " + (i % 3 ? "true" : "false") +
+                ", \"tags\": [\"a\", \"bb\", \"ccc\"], \"parent\": null}";
+    }
+    return json + "\n]";
+}
+
+// 几段长文本，带少量转义
+static std::string JsonTextBody() {
+    std::string json = "{\"docs\":[";
+    for(int i = 0; i < 16; i++) {
+        std::string text;
+        while(text.size() < 4000) { text += "Lorem ipsum dolor sit amet, consectetur adipiscing elit. "; }
+        text += "\\\"quoted\\\" \\u00e9\\n";
+        json += (i ? ",\"" : "\"") + text + "\"";
+    }
+    return json + "]}";
+}
+
+static double JsonParseNsPerKB(const std::string& body, long rounds, double* allocs) {
+    JsonDoc doc;
+    doc.Parse(body);  // 预热，节点数组长到够用
+    long before = allocCount;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < rounds; i++) {
+        bool ok = doc.Parse(body);
+        assert(ok);
+        (void)ok;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    *allocs = static_cast<double>(allocCount - before) / rounds;
+    return ns / rounds * 1024 / body.size();
+}
+
+// 整个POST请求走HttpRequest::parse，请求体按Content-Type解析
+static double PostNsPerReq(const std::string& type, const std::string& body, long rounds, double* allocs) {
+    std::string raw = "POST /api HTTP/1.1\r\nHost: bench\r\nContent-Type: " + type +
+                      "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    HttpRequest request;
+    Buffer buff;
+    long before = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = -1; i < rounds; i++) {
+        if(i == 0) {
+            before = allocCount;
+            start = std::chrono::steady_clock::now();
+        }
+        buff.Append(raw);
+        HttpRequest::HTTP_CODE ret = request.parse(buff);
+        assert(ret == HttpRequest::GET_REQUEST);
+        (void)ret;
+        buff.RetrieveAll();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    *allocs = static_cast<double>(allocCount - before) / rounds;
+    return ns / rounds;
+}
+
+void BenchJson() {
+    HttpScan::ISA detected = HttpScan::Isa();
+    const HttpScan::ISA isas[] = { HttpScan::SCALAR, HttpScan::SSE42, HttpScan::AVX2 };
+    std::string form;
+    const std::string bodies[] = { JsonApiBody(&form), JsonRecordsBody(), JsonTextBody() };
+    const char* names[] = { "api object", "records", "long text" };
+    printf("== json body (detected %s) ==\n", HttpScan::IsaName(detected));
+    for(int c = 0; c < 3; c++) {
+        long rounds = (4L << 30) / 16 / bodies[c].size();
+        printf("%-12s %6zuB  parse", names[c], bodies[c].size());
+        double allocs = 0;
+        for(HttpScan::ISA isa: isas) {
+            if(!HttpScan::UseIsa(isa)) { continue; }
+            printf("  %s %5.0f ns/KB", HttpScan::IsaName(isa), JsonParseNsPerKB(bodies[c], rounds, &allocs));
+        }
+        printf("  %.1f allocs\n", allocs);
+    }
+    HttpScan::UseIsa(detected);
+
+    const long N = 200000;
+    double formAllocs, jsonAllocs;
+    double formNs = PostNsPerReq("application/x-www-form-urlencoded", form, N, &formAllocs);
+    double jsonNs = PostNsPerReq("application/json", bodies[0], N, &jsonAllocs);
+    printf("POST 24 fields  urlencoded %5.0f ns %4.1f allocs/req  json %5.0f ns %4.1f allocs/req\n",
+           formNs, formAllocs, jsonNs, jsonAllocs);
+
+    // 序列化: 把records先取出来，再重新写进Buffer，只计写的时间
+    struct Record {
+        int64_t id;
+        std::string_view name;
+        double score;
+        bool active;
+        std::vector<std::string_view> tags;
+    };
+    JsonDoc doc;
+    doc.Parse(bodies[1]);
+    std::vector<Record> records;
+    for(JsonValue item = doc.Root().First(); item.IsValid(); item = item.Next()) {
+        Record record{ item["id"].GetInt(0), item["name"].Raw(), item["score"].GetDouble(), item["active"].GetBool(), {} };
+        for(JsonValue tag = item["tags"].First(); tag.IsValid(); tag = tag.Next()) { record.tags.push_back(tag.Raw()); }
+        records.push_back(record);
+    }
+    Buffer buff(64 << 10);
+    long before = allocCount;
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for(long i = 0; i < N / 20; i++) {
+        buff.RetrieveAll();
+        JsonWriter writer(buff);
+        writer.BeginArray();
+        for(const Record& record: records) {
+            writer.BeginObject()
+                  .Key("id").Int(record.id)
+                  .Key("name").String(record.name)
+                  .Key("score").Double(record.score)
+                  .Key("active").Bool(record.active)
+                  .Key("tags").BeginArray();
+            for(std::string_view tag: record.tags) { writer.String(tag); }
+            writer.EndArray().Key("parent").Null().EndObject();
+        }
+        writer.EndArray();
+        bytes = buff.ReadableBytes();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("write records %6zuB  %5.0f ns/KB  %.1f allocs\n", bytes, ns / (N / 20) * 1024 / bytes,
+           static_cast<double>(allocCount - before) / (N / 20));
+}
+
+/* ---------------- 静态文件: mmap+writev vs sendfile ---------------- */
+
+// threads个线程各自通过一对UNIX套接字反复发送同一个文件，对端线程只管读。
+// minSize为sendfile方式下直接读进缓冲区的文件大小上限，0表示所有文件都sendfile。
+// 返回每个响应的平均耗时(所有线程合计的吞吐折算)
+static double ServeFileNs(int mode, size_t minSize, const std::string& dir, const std::string& file, int threads, long rounds) {
+    HttpResponse::fileSendMode = mode;
+    size_t oldMinSize = HttpResponse::sendfileMinSize;
+    HttpResponse::sendfileMinSize = minSize;
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&dir, &file, rounds]() {
+            int sv[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) { perror("socketpair"); return; }
+            std::thread reader([fd = sv[1]]() {
+                char buf[65536];
+                while(read(fd, buf, sizeof(buf)) > 0) {}
+            });
+            HttpResponse response;
+            Buffer buff;
+            OutputChain output;
+            for(long i = 0; i < rounds; i++) {
+                std::string path = file;
+                response.Init(dir, path, true, 200);
+                response.MakeResponse(buff);
+                output.Append(buff);
+                if(response.FileFd() >= 0) {
+                    output.AppendFile(response.OpenedFile(), response.FileFd(), 0, response.FileLen());
+                } else if(response.File()) {
+                    output.AppendShared(response.MappedFile(), response.File(), response.FileLen());
+                }
+                response.UnmapFile();
+                int err = 0;
+                while(!output.Empty() && output.WriteFd(sv[0], &err) > 0) {}
+                assert(output.Empty());
+            }
+            close(sv[0]);
+            reader.join();
+            close(sv[1]);
+        });
+    }
+    for(auto& worker: workers) { worker.join(); }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    HttpResponse::fileSendMode = SENDFILE_SEND;
+    HttpResponse::sendfileMinSize = oldMinSize;
+    return ns / (rounds * threads);
+}
+
+void BenchStaticFile() {
+    char tmpl[] = "/tmp/bench-static-XXXXXX";
+    if(!mkdtemp(tmpl)) { perror("mkdtemp"); return; }
+    std::string dir = std::string(tmpl) + "/";
+    const struct { const char* name; size_t size; long rounds; } files[] = {
+        { "/small.html", 4 << 10, 100000 },
+        { "/large.bin", 4 << 20, 300 },
+    };
+    const size_t minSize = HttpResponse::sendfileMinSize;
+    printf("== static file, mmap+writev vs sendfile for every file vs sendfile above %zuK ==\n", minSize >> 10);
+    for(auto& f: files) {
+        std::string content(f.size, 'x');
+        FILE* fp = fopen((dir + f.name).c_str(), "w");
+        fwrite(content.data(), 1, content.size(), fp);
+        fclose(fp);
+        for(int threads: { 1, 4 }) {
+            double mmapNs = ServeFileNs(MMAP_SEND, minSize, dir, f.name, threads, f.rounds / threads);
+            double sendfileNs = ServeFileNs(SENDFILE_SEND, 0, dir, f.name, threads, f.rounds / threads);
+            double hybridNs = ServeFileNs(SENDFILE_SEND, minSize, dir, f.name, threads, f.rounds / threads);
+            printf("%-12s %5zuK %d thread(s)  mmap %9.0f ns/resp  sendfile %9.0f ns/resp  threshold %9.0f ns/resp\n",
+                   f.name + 1, f.size >> 10, threads, mmapNs, sendfileNs, hybridNs);
+        }
+    }
+
+    // 流水线: 一批16个请求走HttpConn，小文件每个响应单独sendfile时一批要30多次系统调用
+    printf("== pipelined static file, 16 requests per batch ==\n");
+    HttpConn::srcDir = dir;
+    HttpConn::isET = true;
+    const int k = 16;
+    for(auto& f: files) {
+        long rounds = std::max(f.rounds / k, 20L);
+        const struct { const char* name; int mode; size_t minSize; } modes[] = {
+            { "mmap", MMAP_SEND, minSize },
+            { "sendfile", SENDFILE_SEND, 0 },
+            { "threshold", SENDFILE_SEND, minSize },
+        };
+        printf("%-12s %5zuK", f.name + 1, f.size >> 10);
+        for(auto& m: modes) {
+            HttpResponse::fileSendMode = m.mode;
+            HttpResponse::sendfileMinSize = m.minSize;
+            double batches, writes;
+            double ns = PipelineNs(32, k, rounds, &batches, f.name, &writes);
+            printf("  %s %7.2f us/req (%5.1f writes)", m.name, ns / 1000, writes);
+        }
+        printf("\n");
+        HttpResponse::fileSendMode = SENDFILE_SEND;
+        HttpResponse::sendfileMinSize = minSize;
+        unlink((dir + f.name).c_str());
+    }
+    HttpConn::srcDir = "../resources/";
+    rmdir(tmpl);
+}
+
+/* ---------------- 请求头存储: unordered_map vs 对象内数组+常用头下标 ---------------- */
+
+// 原来的存法: 每个请求头拷成两个string放进unordered_map，IsKeepAlive查两次
+static bool LegacyHeaders(const std::string& raw, std::unordered_map<std::string, std::string>& header) {
+    header.clear();
+    size_t pos = raw.find("\r\n") + 2;
+    while(true) {
+        size_t eol = raw.find("\r\n", pos);
+        if(eol == pos) { break; }
+        size_t colon = raw.find(':', pos);
+        size_t value = colon + 1;
+        while(raw[value] == ' ') { value++; }
+        header[raw.substr(pos, colon - pos)] = raw.substr(value, eol - value);
+        pos = eol + 2;
+    }
+    bool keepAlive = false;
+    if(header.count("Connection") == 1) {
+        keepAlive = header.find("Connection")->second == "keep-alive";
+    }
+    return keepAlive && header.count("Host") == 1 && header.count("Cookie") == 1;
+}
+
+void BenchHeaderStore() {
+    const long N = 200000;
+    printf("== header store ==\n");
+    for(int c = 0; c < 3; c++) {
+        const std::string& raw = HTTP_CORPUS[c];
+        std::unordered_map<std::string, std::string> header;
+        long found = 0;
+        long allocs = allocCount;
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            found += LegacyHeaders(raw, header);
+        }
+        double legacyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        double legacyAllocs = static_cast<double>(allocCount - allocs) / N;
+
+        HttpRequest request;
+        Buffer buff;
+        request.Init();
+        buff.Append(raw);
+        request.parse(buff);
+        buff.RetrieveAll();
+        allocs = allocCount;
+        start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            request.Init();
+            buff.Append(raw);
+            request.parse(buff);
+            found += request.IsKeepAlive() && request.HasHeader(HttpRequest::HOST) && request.HasHeader(HttpRequest::COOKIE);
+            buff.RetrieveAll();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        double newAllocs = static_cast<double>(allocCount - allocs) / N;
+        printf("%-12s %2zu headers  map store only %5.0f ns %4.1f allocs/req  full parse + slots %5.0f ns %4.1f allocs/req (%ld)\n",
+               HTTP_CORPUS_NAMES[c], request.HeaderCount(), legacyNs, legacyAllocs, ns, newAllocs, found);
+    }
+}
+
+/* ---------------- 路由: 逐个比较路径 vs 按段查前缀树 ---------------- */
+
+void BenchRouter() {
+    const long N = 1000000;
+    printf("== router, 30 routes ==\n");
+    // 原来的做法: 页面名放在unordered_set里逐个比较，只能精确匹配
+    std::unordered_set<std::string> pages;
+    Router router;
+    long hits = 0;
+    auto count = [&hits](HttpRequest&, const RouteParams& params) { hits += 1 + params.Size(); };
+    const char* names[] = { "index", "register", "login", "welcome", "video", "picture", "about", "contact",
+                            "news", "faq", "terms", "privacy", "help", "search", "cart", "checkout",
+                            "orders", "profile", "settings", "logout" };
+    for(const char* name: names) {
+        pages.insert(std::string("/") + name);
+        router.Add("*", std::string("/") + name, count);
+    }
+    const char* params[] = { "/user/:id", "/user/:id/posts", "/post/:id", "/post/:id/comments/:cid", "/tag/:name" };
+    for(const char* pattern: params) { router.Add("GET", pattern, count); }
+    const char* prefixes[] = { "/static/*", "/images/*", "/api/v1/*", "/api/v2/*", "/download/*" };
+    for(const char* pattern: prefixes) { router.Add("*", pattern, count); }
+
+    const char* paths[] = { "/index", "/logout", "/post/42/comments/7", "/images/profile-image.jpg", "/nope.html" };
+    for(const char* path: paths) {
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(std::string("GET ") + path + " HTTP/1.1\r\nHost: x\r\n\r\n");
+        request.parse(buff);
+
+        long found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            for(auto& item: pages) {
+                if(item == request.path()) { found++; break; }
+            }
+        }
+        double scanNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+
+        hits = 0;
+        start = std::chrono::steady_clock::now();
+        for(long i = 0; i < N; i++) {
+            router.Dispatch(request);
+        }
+        double trieNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / N;
+        printf("%-28s scan %5.1f ns (%s)  trie %5.1f ns (%s)\n", path, scanNs, found ? "hit" : "miss",
+               trieNs, hits ? "hit" : "miss");
+    }
+}
+
+/* ---------------- 从反应堆: epoll就绪 vs io_uring poll就绪 vs io_uring完成 ---------------- */
+
+static bool ReadN(int fd, char* buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = ::read(fd, buf, len);
+        if(n <= 0) { return false; }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int ConnectLoopback(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 客户端线程: conns条保持连接，每轮每条连接发一个请求，再依次收齐respLen字节的响应
+static void KeepAliveClient(int port, int conns, size_t respLen, const std::atomic<bool>& stop,
+                            std::atomic<long>& done) {
+    const std::string req = "GET /index.html HTTP/1.1\r\nHost: bench\r\n\r\n";
+    std::vector<int> fds;
+    for(int i = 0; i < conns; i++) {
+        int fd = ConnectLoopback(port);
+        if(fd < 0) { break; }
+        fds.push_back(fd);
+    }
+    std::vector<char> buf(respLen);
+    long n = 0;
+    while(!stop) {
+        for(int fd: fds) {
+            if(::write(fd, req.data(), req.size()) != static_cast<ssize_t>(req.size())) { goto out; }
+        }
+        for(int fd: fds) {
+            if(!ReadN(fd, buf.data(), respLen)) { goto out; }
+        }
+        n += fds.size();
+    }
+out:
+    done += n;
+    for(int fd: fds) { close(fd); }
+}
+
+static double CpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// 一个从反应堆线程服务clients个客户端线程，每个线程conns条保持连接
+static void RunReactor(const char* name, Reactor* reactor, int port, int clients, int conns) {
+    const int SECONDS = 2;
+    int listenFd = CreateListener(port, false, 1024);
+    if(listenFd < 0) { return; }
+    reactor->SetListenFd(listenFd, EPOLLRDHUP | EPOLLET, 1024);
+    reactor->Start();
+    // 先请求一次，得到响应的长度
+    size_t respLen = 0;
+    {
+        int fd = ConnectLoopback(port);
+        const std::string req = "GET /index.html HTTP/1.1\r\nHost: bench\r\n\r\n";
+        ::write(fd, req.data(), req.size());
+        std::string head;
+        char ch;
+        while(head.find("\r\n\r\n") == std::string::npos && ::read(fd, &ch, 1) == 1) { head += ch; }
+        size_t cl = head.find("Content-length: ");
+        respLen = head.size() + (cl == std::string::npos ? 0 : atoi(head.c_str() + cl + 16));
+        close(fd);
+    }
+    std::atomic<bool> stop(false);
+    std::atomic<long> done(0);
+    double cpu = CpuSeconds();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < clients; i++) {
+        threads.emplace_back(KeepAliveClient, port, conns, respLen, std::cref(stop), std::ref(done));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(SECONDS));
+    stop = true;
+    for(auto& t: threads) { t.join(); }
+    cpu = CpuSeconds() - cpu;
+    reactor->Stop();
+    printf("%-28s %9.0f req/s  %6.2f us cpu/req (server + clients)\n", name,
+           done / (double)SECONDS, done ? cpu * 1e6 / done : 0.0);
+}
+
+void BenchReactor() {
+    const int maxFd = 1024;
+    const int CLIENTS = 4, CONNS = 16;
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = true;
+    std::unique_ptr<HttpConn[]> users(new HttpConn[maxFd]);
+    ThreadPool blockingPool(1);
+    printf("== one sub reactor, %d client threads x %d keep-alive conns ==\n", CLIENTS, CONNS);
+    uint32_t connEvent = EPOLLRDHUP | EPOLLET;
+    {
+        SubReactor reactor(0, 0, connEvent, users.get(), maxFd, &blockingPool, EPOLL_BACKEND);
+        RunReactor("epoll readiness", &reactor, 13170, CLIENTS, CONNS);
+    }
+    {
+        SubReactor reactor(0, 0, connEvent, users.get(), maxFd, &blockingPool, URING_BACKEND);
+        RunReactor(strcmp(reactor.Name(), "io_uring") == 0 ? "io_uring poll readiness" : "(no io_uring) epoll",
+                   &reactor, 13171, CLIENTS, CONNS);
+    }
+    {
+        UringReactor reactor(0, 0, users.get(), maxFd, &blockingPool);
+        if(reactor.IsOk()) {
+            RunReactor("io_uring completion", &reactor, 13172, CLIENTS, CONNS);
+        } else {
+            printf("io_uring completion not supported\n");
+        }
+    }
+}
+
+int main() {
+    BenchAccept();
+    BenchReactor();
+    BenchThreadPool();
+    BenchTask();
+    BenchElasticPool();
+    BenchCoroutine();
+    BenchBuffer();
+    BenchHttpLoop();
+    BenchBufferPool();
+    BenchOutputChain();
+    BenchAdaptiveRead();
+    BenchHttpParse();
+    BenchHttpScan();
+    BenchIncrementalParse();
+    BenchPipeline();
+    BenchRequestBody();
+    BenchUpload();
+    BenchJson();
+    BenchStaticFile();
+    BenchHeaderStore();
+    BenchRouter();
+}
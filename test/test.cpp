@@ -5,7 +5,24 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/pool/workstealingpool.h"
+#include "../code/buffer/bufferpool.h"
+#include "../code/buffer/outputchain.h"
+#include "../code/buffer/readsizer.h"
+#include "../code/http/httpconn.h"
+#include "../code/http/router.h"
+#include "../code/http/routes.h"
+#include "../code/http/httpscan.h"
+#include "../code/http/json.h"
+#include "../code/server/reactor.h"
+#include "../code/server/poller.h"
 #include <features.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <dirent.h>
+#include <string>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
@@ -50,7 +67,1607 @@ void TestThreadPool() {
     getchar();
 }
 
+/* ---------------- 任务对象 ---------------- */
+
+// 记录构造出的对象还有多少没析构，被移走的对象析构不计数
+struct Tracked {
+    static int live;
+    bool owns;
+    int* calls;
+    explicit Tracked(int* c) : owns(true), calls(c) { live++; }
+    Tracked(Tracked&& other) noexcept : owns(other.owns), calls(other.calls) { other.owns = false; }
+    Tracked(const Tracked&) = delete;
+    ~Tracked() { if(owns) { live--; } }
+    void operator()() { (*calls)++; }
+};
+int Tracked::live = 0;
+
+void TestTask() {
+    int calls = 0;
+    // 只能移动的捕获
+    {
+        std::unique_ptr<int> p(new int(7));
+        Task task([p = std::move(p), &calls] { calls += *p; });
+        Task moved(std::move(task));
+        assert(!task && moved);
+        moved();
+        assert(calls == 7);
+    }
+    // 超过CAPACITY的捕获放到堆上，行为不变
+    {
+        calls = 0;
+        char big[128];
+        memset(big, 1, sizeof(big));
+        auto fn = [big, &calls] { for(char c: big) { calls += c; } };
+        static_assert(!Task::FitsInline<decltype(fn)>(), "");
+        Task task(fn);
+        Task moved(std::move(task));
+        assert(!task);
+        moved();
+        assert(calls == 128);
+        // 堆上的捕获同样只析构一次
+        Tracked::live = 0;
+        {
+            Task heap([t = Tracked(&calls), pad = std::string(64, 'x')]() mutable { t(); });
+            Task other(std::move(heap));
+            other();
+            assert(Tracked::live == 1);
+        }
+        assert(Tracked::live == 0);
+    }
+    // 移动赋值: 旧的捕获析构，新的搬过来，自赋值不变
+    {
+        calls = 0;
+        Tracked::live = 0;
+        Task a{Tracked(&calls)};
+        Task b{Tracked(&calls)};
+        assert(Tracked::live == 2);
+        a = std::move(b);
+        assert(Tracked::live == 1 && a && !b);
+        Task& self = a;
+        a = std::move(self);
+        assert(Tracked::live == 1 && a);
+        a();
+        assert(calls == 1);
+        a = nullptr;
+        assert(Tracked::live == 0 && !a);
+        a = Task(Tracked(&calls));
+        assert(Tracked::live == 1);
+    }
+    assert(Tracked::live == 0);
+    // 经过队列扩容的多次移动后，每个捕获恰好执行一次、析构一次
+    {
+        calls = 0;
+        {
+            TaskQueue queue(2);
+            for(int i = 0; i < 100; i++) { queue.push(Task(Tracked(&calls))); }
+            assert(Tracked::live == 100);
+            for(int i = 0; i < 50; i++) { queue.pop()(); }
+            assert(Tracked::live == 50);
+        }
+        assert(Tracked::live == 0);
+        assert(calls == 50);
+    }
+    printf("TestTask ok\n");
+}
+
+/* ---------------- 工作窃取线程池 ---------------- */
+
+void TestMpmcRing() {
+    // 容量向上取整到2的幂，满了入队失败，先进先出
+    MpmcRing<int> ring(5);
+    for(int i = 0; i < 8; i++) { assert(ring.TryPush(int(i))); }
+    assert(!ring.TryPush(8));
+    int v = -1;
+    for(int i = 0; i < 8; i++) {
+        assert(ring.TryPop(v) && v == i);
+    }
+    assert(!ring.TryPop(v));
+
+    // 多生产者多消费者: 每个值恰好取出一次
+    const int PRODUCERS = 4, CONSUMERS = 4, PER = 50000;
+    MpmcRing<int> mpmc(64);
+    std::vector<std::atomic<int>> seen(PRODUCERS * PER);
+    std::atomic<int> popped(0);
+    std::vector<std::thread> threads;
+    for(int p = 0; p < PRODUCERS; p++) {
+        threads.emplace_back([&, p] {
+            for(int i = 0; i < PER; i++) {
+                int item = p * PER + i;
+                while(!mpmc.TryPush(std::move(item))) { std::this_thread::yield(); }
+            }
+        });
+    }
+    for(int c = 0; c < CONSUMERS; c++) {
+        threads.emplace_back([&] {
+            int item;
+            while(popped.load() < PRODUCERS * PER) {
+                if(mpmc.TryPop(item)) {
+                    seen[item]++;
+                    popped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for(auto& t: threads) { t.join(); }
+    for(auto& n: seen) { assert(n.load() == 1); }
+    assert(!mpmc.TryPop(v));
+    printf("TestMpmcRing ok\n");
+}
+
+static void WaitFor(const std::atomic<int>& counter, int target) {
+    for(int i = 0; i < 10000 && counter.load() < target; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(counter.load() == target);
+}
+
+// 工作线程内提交: 每个任务再提交两个子任务，直到depth层
+static void SpawnTree(WorkStealingPool* pool, std::atomic<int>* done, int depth) {
+    if(depth > 0) {
+        pool->AddTask([=] { SpawnTree(pool, done, depth - 1); });
+        pool->AddTask([=] { SpawnTree(pool, done, depth - 1); });
+    }
+    (*done)++;
+}
+
+void TestWorkStealingPool() {
+    // 外部多线程并发提交，队列很小，提交方会遇到满队列，空闲线程互相窃取: 每个任务恰好执行一次
+    {
+        const int SUBMITTERS = 4, PER = 20000;
+        std::vector<std::atomic<int>> runs(SUBMITTERS * PER);
+        std::atomic<int> done(0);
+        WorkStealingPool pool(4, 8);
+        std::vector<std::thread> threads;
+        for(int s = 0; s < SUBMITTERS; s++) {
+            threads.emplace_back([&, s] {
+                for(int i = 0; i < PER; i++) {
+                    int id = s * PER + i;
+                    pool.AddTask([&runs, &done, id] {
+                        runs[id]++;
+                        done++;
+                    });
+                }
+            });
+        }
+        for(auto& t: threads) { t.join(); }
+        WaitFor(done, SUBMITTERS * PER);
+        for(auto& n: runs) { assert(n.load() == 1); }
+    }
+    // 工作线程内提交，队列很快全满: 工作线程就地执行而不是互相等待
+    {
+        const int DEPTH = 14;
+        std::atomic<int> done(0);
+        WorkStealingPool pool(2, 4);
+        pool.AddTask([&] { SpawnTree(&pool, &done, DEPTH); });
+        WaitFor(done, (1 << (DEPTH + 1)) - 1);
+    }
+    // 析构时执行完已入队的任务再回收线程
+    {
+        const int TASKS = 2000;
+        std::atomic<int> done(0);
+        std::thread::id main = std::this_thread::get_id();
+        std::atomic<bool> onMain(false);
+        {
+            WorkStealingPool pool(2, 4096);
+            for(int i = 0; i < TASKS; i++) {
+                pool.AddTask([&] {
+                    std::this_thread::sleep_for(std::chrono::microseconds(10));
+                    if(std::this_thread::get_id() == main) { onMain = true; }
+                    done++;
+                });
+            }
+        }
+        assert(done.load() == TASKS);
+        assert(!onMain);
+    }
+    printf("TestWorkStealingPool ok\n");
+}
+
+// 弹性线程池: 任务全部阻塞、队列排队时加线程到上限，空闲后退回下限
+void TestThreadPoolElastic() {
+    const size_t MIN = 1, MAX = 4;
+    ThreadPool pool(MIN, MAX, 1, 100);
+    assert(pool.IsElastic());
+    assert(pool.GetStats().threads == MIN);
+    std::mutex mtx;
+    std::condition_variable cond;
+    bool release = false;
+    std::atomic<int> done(0);
+    const int TASKS = 16;
+    for(int i = 0; i < TASKS; i++) {
+        pool.AddTask([&] {
+            std::unique_lock<std::mutex> locker(mtx);
+            cond.wait(locker, [&] { return release; });
+            done++;
+        });
+    }
+    // 监控线程每50ms最多加一个线程
+    for(int i = 0; i < 200 && pool.GetStats().threads < MAX; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ThreadPool::Stats stats = pool.GetStats();
+    assert(stats.threads == MAX);
+    assert(stats.idle == 0 && stats.queued == TASKS - MAX);
+    assert(stats.waitMaxUs > 1000);
+    {
+        std::lock_guard<std::mutex> locker(mtx);
+        release = true;
+    }
+    cond.notify_all();
+    WaitFor(done, TASKS);
+    // 空闲超过100ms的线程退出，不少于下限
+    for(int i = 0; i < 300 && pool.GetStats().threads > MIN; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    stats = pool.GetStats();
+    assert(stats.threads == MIN && stats.queued == 0 && stats.done == TASKS);
+    // 收缩后仍能执行任务，退出的槽位可以复用
+    pool.AddTask([&] { done++; });
+    WaitFor(done, TASKS + 1);
+    printf("TestThreadPoolElastic ok\n");
+}
+
+/* ---------------- 缓冲区 ---------------- */
+
+// 统计是全局的，只比较前后的差值
+void TestBufferPool() {
+    BufferPool::Stats outer = BufferPool::GetStats();
+    // 在新线程里跑，线程缓存从空开始
+    std::thread([] {
+        const size_t K4 = BufferPool::ClassSize(0), K16 = BufferPool::ClassSize(1), K64 = BufferPool::ClassSize(2);
+        assert(K4 == 4096 && K16 == 16384 && K64 == 65536);
+        BufferPool::Stats before = BufferPool::GetStats();
+
+        // 按档向上取整，超过最大档按实际大小分配
+        assert(BufferPool::Alloc(0).empty());
+        BufferStorage a = BufferPool::Alloc(1), b = BufferPool::Alloc(K4), c = BufferPool::Alloc(K4 + 1);
+        BufferStorage d = BufferPool::Alloc(K64), e = BufferPool::Alloc(K64 + 1);
+        assert(a.size() == K4 && b.size() == K4 && c.size() == K16 && d.size() == K64 && e.size() == K64 + 1);
+        BufferPool::Stats st = BufferPool::GetStats();
+        assert(st.inUse[0] - before.inUse[0] == 2 && st.inUse[1] - before.inUse[1] == 1 &&
+               st.inUse[2] - before.inUse[2] == 1);
+        assert(st.misses - before.misses == 4 && st.hits == before.hits);
+        assert(st.oversize - before.oversize == 1);
+
+        // 归还进本线程缓存，再取同档时命中，后进先出
+        const char* pa = a.data();
+        BufferPool::Free(a);
+        BufferPool::Free(c);
+        BufferPool::Free(e);
+        assert(a.empty() && c.empty() && e.empty());
+        st = BufferPool::GetStats();
+        assert(st.cached[0] - before.cached[0] == 1 && st.cached[1] - before.cached[1] == 1);
+        assert(st.inUse[0] - before.inUse[0] == 1 && st.inUse[1] == before.inUse[1]);
+        BufferStorage f = BufferPool::Alloc(100);
+        assert(f.data() == pa && f.size() == K4);
+        st = BufferPool::GetStats();
+        assert(st.hits - before.hits == 1 && st.cached[0] == before.cached[0]);
+
+        // 不是某一档大小的存储直接释放，不动统计
+        BufferStorage odd(5000), big(K64 * 2);
+        BufferPool::Stats mid = BufferPool::GetStats();
+        BufferPool::Free(odd);
+        BufferPool::Free(big);
+        assert(odd.empty() && big.empty());
+        st = BufferPool::GetStats();
+        for(int i = 0; i < BufferPool::CLASS_NUM; i++) {
+            assert(st.inUse[i] == mid.inUse[i] && st.cached[i] == mid.cached[i]);
+        }
+
+        // 每档缓存有上限，超出的块直接释放
+        const size_t limit = BufferPool::MaxCached(0);
+        std::vector<BufferStorage> blocks;
+        for(size_t i = 0; i < limit + 10; i++) { blocks.push_back(BufferPool::Alloc(K4)); }
+        for(auto& blk: blocks) { BufferPool::Free(blk); }
+        st = BufferPool::GetStats();
+        assert(st.cached[0] - before.cached[0] == limit);
+        BufferPool::Free(b);
+        BufferPool::Free(d);
+        BufferPool::Free(f);
+        st = BufferPool::GetStats();
+        assert(st.cached[0] - before.cached[0] == limit);
+        for(int i = 0; i < BufferPool::CLASS_NUM; i++) { assert(st.inUse[i] == before.inUse[i]); }
+
+        // 在别的线程取的块归还到当前线程的缓存
+        BufferStorage g;
+        std::thread([&] { g = BufferPool::Alloc(K16); }).join();
+        size_t cached16 = BufferPool::GetStats().cached[1];
+        BufferPool::Free(g);
+        assert(BufferPool::GetStats().cached[1] == cached16 + 1);
+    }).join();
+    // 线程退出时缓存释放
+    BufferPool::Stats st = BufferPool::GetStats();
+    for(int i = 0; i < BufferPool::CLASS_NUM; i++) { assert(st.cached[i] == outer.cached[i]); }
+    printf("TestBufferPool ok\n");
+}
+
+// 非阻塞的socketpair，写端发送缓冲区调小，WriteFd很快就只能发出一部分
+static void SmallSocketPair(int fds[2]) {
+    int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(ret == 0);
+    (void)ret;
+    int sndBuf = 16 << 10;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+}
+
+// 交替地WriteFd和从另一端读，直到链发完，返回收到的全部数据和WriteFd遇到EAGAIN的次数
+static std::string DrainChain(OutputChain& chain, int fds[2], int* blocked) {
+    std::string out;
+    char buf[4096];
+    *blocked = 0;
+    while(!chain.Empty()) {
+        int err = 0;
+        ssize_t len = chain.WriteFd(fds[0], &err);
+        if(len < 0) {
+            assert(err == EAGAIN);
+            (*blocked)++;
+        }
+        ssize_t n;
+        while((n = read(fds[1], buf, sizeof(buf))) > 0) { out.append(buf, n); }
+    }
+    ssize_t n;
+    while((n = read(fds[1], buf, sizeof(buf))) > 0) { out.append(buf, n); }
+    return out;
+}
+
+static std::string Pattern(size_t len, int seed) {
+    std::string str(len, 0);
+    for(size_t i = 0; i < len; i++) { str[i] = static_cast<char>('a' + (i * 7 + seed) % 26); }
+    return str;
+}
+
+void TestOutputChain() {
+    // 拷贝追加的小片段进同一个暂存块，紧接着链尾时合并成一段
+    {
+        OutputChain chain;
+        chain.Append("HTTP/1.1 200 OK\r\n");
+        chain.Append(std::string("Content-length: 5\r\n"));
+        chain.Append("\r\n", 2);
+        assert(chain.SliceCount() == 1 && chain.Bytes() == 17 + 19 + 2);
+        // 共享片段打断合并，之后的拷贝另起一段，仍在同一个暂存块里
+        auto body = std::make_shared<std::string>("hello");
+        chain.AppendShared(body, body->data(), body->size());
+        chain.Append("tail");
+        chain.Append("!");
+        assert(chain.SliceCount() == 3 && chain.Bytes() == 38 + 5 + 5);
+        // 暂存块放不下时换一块新的，不和上一段合并
+        chain.Append(std::string(70000, 'x'));
+        assert(chain.SliceCount() == 4);
+        struct iovec iov[OutputChain::IOV_BATCH];
+        assert(chain.FillIov(iov, OutputChain::IOV_BATCH) == 4);
+        assert(std::string((char*)iov[0].iov_base, iov[0].iov_len) ==
+               "HTTP/1.1 200 OK\r\nContent-length: 5\r\n\r\n");
+        assert(std::string((char*)iov[2].iov_base, iov[2].iov_len) == "tail!");
+        assert(body.use_count() == 2);
+        chain.Consume(38 + 5);
+        assert(chain.SliceCount() == 2 && body.use_count() == 1);
+        chain.Clear();
+        assert(chain.Empty() && chain.Bytes() == 0);
+    }
+    // writev只发出一部分时，下次从片段中间接着发
+    {
+        int fds[2];
+        SmallSocketPair(fds);
+        const std::string a = Pattern(300000, 1), b = Pattern(1000, 2), c = Pattern(200000, 3);
+        auto owner = std::make_shared<std::string>(a + b + c);
+        OutputChain chain;
+        chain.AppendShared(owner, owner->data(), a.size());
+        chain.Append(b);
+        chain.AppendShared(owner, owner->data() + a.size() + b.size(), c.size());
+        int err = 0;
+        ssize_t len = chain.WriteFd(fds[0], &err);
+        assert(len > 0 && static_cast<size_t>(len) < a.size());
+        assert(chain.SliceCount() == 3 && chain.Bytes() == a.size() + b.size() + c.size() - len);
+        int blocked = 0;
+        std::string out = DrainChain(chain, fds, &blocked);
+        assert(blocked > 0);
+        assert(out == *owner);
+        // 发完后释放引用
+        assert(owner.use_count() == 1);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    // 一次writev最多IOV_BATCH段
+    {
+        int fds[2];
+        int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+        assert(ret == 0);
+        (void)ret;
+        auto owner = std::make_shared<std::string>(Pattern(1000, 4));
+        OutputChain chain;
+        for(int i = 0; i < 100; i++) { chain.AppendShared(owner, owner->data() + i * 10, 10); }
+        int err = 0;
+        assert(chain.WriteFd(fds[0], &err) == OutputChain::IOV_BATCH * 10);
+        assert(chain.SliceCount() == 100 - OutputChain::IOV_BATCH);
+        int blocked = 0;
+        std::string out = DrainChain(chain, fds, &blocked);
+        assert(out == *owner);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    // sendfile只发出一部分时，从文件区间的当前偏移接着发；前后的内存片段照常发送
+    {
+        char path[] = "/tmp/outputchainXXXXXX";
+        int fileFd = mkstemp(path);
+        assert(fileFd >= 0);
+        unlink(path);
+        const std::string content = Pattern(600000, 5);
+        ssize_t written = write(fileFd, content.data(), content.size());
+        assert(written == static_cast<ssize_t>(content.size()));
+        (void)written;
+        const off_t OFFSET = 100;
+        const size_t LEN = content.size() - 200;
+        auto fileOwner = std::make_shared<int>(fileFd);
+        int fds[2];
+        SmallSocketPair(fds);
+        OutputChain chain;
+        chain.Append("head");
+        chain.AppendFile(fileOwner, fileFd, OFFSET, LEN);
+        chain.Append("tail");
+        int err = 0;
+        assert(chain.WriteFd(fds[0], &err) == 4);
+        // 链头是文件区间时FillIov不取任何段
+        struct iovec iov[1];
+        assert(chain.FillIov(iov, 1) == 0);
+        ssize_t len = chain.WriteFd(fds[0], &err);
+        assert(len > 0 && static_cast<size_t>(len) < LEN);
+        assert(chain.SliceCount() == 2 && chain.Bytes() == LEN - len + 4);
+        int blocked = 0;
+        std::string out = DrainChain(chain, fds, &blocked);
+        assert(blocked > 0);
+        assert(out == "head" + content.substr(OFFSET, LEN) + "tail");
+        assert(fileOwner.use_count() == 1);
+        close(fileFd);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    printf("TestOutputChain ok\n");
+}
+
+void TestReadSizer() {
+    ReadSizer sizer;
+    assert(sizer.Hint() == ReadSizer::MIN_HINT);
+    // 没读到数据不计
+    sizer.Record(0, 4096);
+    assert(sizer.GetStats().reads == 0);
+    // 读满给定空间放大一档，到MAX_HINT为止；读到的比给的还多(readv的栈上缓冲区)也算读满
+    sizer.Record(4096, 4096);
+    assert(sizer.Hint() == 16384);
+    sizer.Record(20000, 16384);
+    assert(sizer.Hint() == 65536);
+    sizer.Record(65536, 65536);
+    assert(sizer.Hint() == ReadSizer::MAX_HINT);
+    const ReadSizer::Stats& st = sizer.GetStats();
+    assert(st.reads == 3 && st.fullReads == 3 && st.grows == 2 && st.shrinks == 0);
+    assert(st.bytes == 4096 + 20000 + 65536 && st.lastBytes == 65536 && st.maxBytes == 65536);
+    // 偏小的读要连续两次才缩小，中间一次不小的读重新计数
+    sizer.Record(16384, 65536);
+    assert(sizer.Hint() == 65536);
+    sizer.Record(30000, 65536);
+    sizer.Record(100, 65536);
+    assert(sizer.Hint() == 65536);
+    sizer.Record(100, 65536);
+    assert(sizer.Hint() == 16384 && st.shrinks == 1);
+    // 读满一次打断缩小的计数，并直接放大
+    sizer.Record(100, 16384);
+    sizer.Record(16384, 16384);
+    assert(sizer.Hint() == 65536);
+    sizer.Record(100, 65536);
+    assert(sizer.Hint() == 65536);
+    sizer.Record(100, 65536);
+    sizer.Record(100, 16384);
+    sizer.Record(100, 16384);
+    assert(sizer.Hint() == ReadSizer::MIN_HINT && st.shrinks == 3);
+    // 最小档不再缩小
+    for(int i = 0; i < 4; i++) { sizer.Record(1, 4096); }
+    assert(sizer.Hint() == ReadSizer::MIN_HINT && st.shrinks == 3);
+    assert(st.lastBytes == 1 && st.maxBytes == 65536);
+    sizer.Reset();
+    assert(sizer.Hint() == ReadSizer::MIN_HINT && sizer.GetStats().reads == 0 && sizer.GetStats().bytes == 0);
+
+    // 连接上一次到了大量数据，边沿触发读到EAGAIN，读大小逐档放大
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(ret == 0);
+    (void)ret;
+    const std::string body = Pattern(100000, 6);
+    ssize_t written = write(fds[1], body.data(), body.size());
+    assert(written == static_cast<ssize_t>(body.size()));
+    (void)written;
+    {
+        bool isET = HttpConn::isET;
+        HttpConn::isET = true;
+        HttpConn conn;
+        conn.init(fds[0], sockaddr_in());
+        int err = 0;
+        conn.read(&err);
+        const ReadSizer::Stats& rs = conn.GetReadStats();
+        assert(rs.bytes == body.size() && rs.grows >= 2 && rs.hint == ReadSizer::MAX_HINT);
+        HttpConn::isET = isET;
+    }
+    close(fds[1]);
+    printf("TestReadSizer ok\n");
+}
+
+/* ---------------- HTTP连接 ---------------- */
+
+// 把input一次写进socketpair的一端，连接读一次、处理、发完，返回另一端收到的全部响应
+// 在test目录下运行，静态资源取 ../resources/
+static std::string Roundtrip(const std::string& input, bool* keepAlive) {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    ssize_t len = write(fds[1], input.data(), input.size());
+    assert(len == static_cast<ssize_t>(input.size()));
+    (void)ret;
+    std::string out;
+    {
+        HttpConn conn;
+        sockaddr_in addr = {};
+        conn.init(fds[0], addr);
+        int err = 0;
+        conn.read(&err);
+        if(conn.process()) {
+            conn.write(&err);
+            assert(conn.ToWriteBytes() == 0);
+        }
+        *keepAlive = conn.IsKeepAlive();
+        // 析构时关闭fds[0]
+    }
+    char buf[65536];
+    while((len = read(fds[1], buf, sizeof(buf))) > 0) { out.append(buf, len); }
+    close(fds[1]);
+    return out;
+}
+
+static size_t CountOf(const std::string& text, const std::string& pattern) {
+    size_t n = 0;
+    for(size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1)) { n++; }
+    return n;
+}
+
+// HTTP/1.1默认保持连接: 没有Connection头的流水线请求要全部应答；HTTP/1.0要带keep-alive
+void TestPipeline() {
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = true;
+    const std::string get11 = "GET /index.html HTTP/1.1\r\nHost: test\r\n\r\n";
+    const std::string get10 = "GET /index.html HTTP/1.0\r\n\r\n";
+    bool keepAlive = false;
+
+    std::string out = Roundtrip(get11 + get11 + get11, &keepAlive);
+    assert(CountOf(out, "HTTP/1.1 200 OK") == 3);
+    assert(CountOf(out, "Connection: keep-alive") == 3);
+    assert(keepAlive);
+
+    // Connection: close的请求之后的请求不再处理
+    out = Roundtrip("GET /index.html HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n" + get11 + get11, &keepAlive);
+    assert(CountOf(out, "HTTP/1.1 200 OK") == 1);
+    assert(CountOf(out, "Connection: close") == 1);
+    assert(!keepAlive);
+
+    out = Roundtrip(get10 + get10 + get10, &keepAlive);
+    assert(CountOf(out, "HTTP/1.1 200 OK") == 1);
+    assert(!keepAlive);
+
+    const std::string keep10 = "GET /index.html HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n";
+    out = Roundtrip(keep10 + keep10 + keep10, &keepAlive);
+    assert(CountOf(out, "HTTP/1.1 200 OK") == 3);
+    assert(keepAlive);
+    printf("TestPipeline ok\n");
+}
+
+/* ---------------- HTTP请求解析 ---------------- */
+
+// 各个SIMD实现与逐字节实现的结果一致: 随机内容，每个起始偏移(对齐情况)、每个长度(覆盖16/32字节的整块和尾部)。
+// 数据放在堆上缓冲区的末尾，读过界时AddressSanitizer能发现
+void TestHttpScan() {
+    const HttpScan::ISA detected = HttpScan::Isa();
+    const HttpScan::ISA simd[] = { HttpScan::SSE42, HttpScan::AVX2 };
+    const int MAX_OFFSET = 64, MAX_LEN = 130;
+    const char chars[] = { ':', '\r', '\0', static_cast<char>(0xe4), static_cast<char>(0xff) };
+    unsigned seed = 12345;
+    auto next = [&seed] { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7fff; };
+    int checked = 0;
+    const char special[] = { '\r', '\n', '\t', 0x01, 0x1f, 0x7f, '"', '\\', ':', 0x00, 0x20 };
+    // 特殊字节的百分比由稀到密；-1时全是高位字节(有符号比较容易出错)
+    for(int density: { 0, 2, 16, 64, -1 }) {
+        std::string pool(MAX_OFFSET + MAX_LEN, 0);
+        for(char& ch: pool) {
+            if(density < 0) {
+                ch = static_cast<char>(0x80 + next() % 128);
+            } else if(static_cast<int>(next() % 100) < density) {
+                ch = special[next() % sizeof(special)];
+            } else {
+                ch = static_cast<char>(0x21 + next() % 222);
+            }
+        }
+        for(int offset = 0; offset < MAX_OFFSET; offset++) {
+            for(int len = 0; len <= MAX_LEN; len++) {
+                if(offset + len > static_cast<int>(pool.size())) { break; }
+                std::unique_ptr<char[]> mem(new char[len > 0 ? len : 1]);
+                memcpy(mem.get(), pool.data() + offset, len);
+                const char* begin = mem.get();
+                const char* end = begin + len;
+                HttpScan::UseIsa(HttpScan::SCALAR);
+                const char* ctl = HttpScan::FindCtl(begin, end);
+                const char* json = HttpScan::FindJsonSpecial(begin, end);
+                const char* found[sizeof(chars)];
+                for(size_t c = 0; c < sizeof(chars); c++) { found[c] = HttpScan::FindChar(begin, end, chars[c]); }
+                for(HttpScan::ISA isa: simd) {
+                    if(!HttpScan::UseIsa(isa)) { continue; }
+                    assert(HttpScan::FindCtl(begin, end) == ctl);
+                    assert(HttpScan::FindJsonSpecial(begin, end) == json);
+                    for(size_t c = 0; c < sizeof(chars); c++) {
+                        assert(HttpScan::FindChar(begin, end, chars[c]) == found[c]);
+                    }
+                    checked++;
+                }
+            }
+        }
+    }
+    // 数据在缓冲区中间时，区间外的字节不影响结果
+    {
+        std::string text(100, 'a');
+        text[10] = '\n';
+        text[60] = '"';
+        text[61] = ':';
+        for(HttpScan::ISA isa: { HttpScan::SCALAR, HttpScan::SSE42, HttpScan::AVX2 }) {
+            if(!HttpScan::UseIsa(isa)) { continue; }
+            const char* p = text.data();
+            assert(HttpScan::FindCtl(p + 11, p + 60) == p + 60);
+            assert(HttpScan::FindCtl(p, p + 60) == p + 10);
+            assert(HttpScan::FindJsonSpecial(p + 11, p + 59) == p + 59);
+            assert(HttpScan::FindJsonSpecial(p + 11, p + 100) == p + 60);
+            assert(HttpScan::FindChar(p, p + 61, ':') == p + 61);
+            assert(HttpScan::FindChar(p, p + 62, ':') == p + 61);
+        }
+    }
+    HttpScan::UseIsa(detected);
+    printf("TestHttpScan ok (%s, %d cases)\n", HttpScan::IsaName(detected), checked);
+}
+
+// 把raw按step字节一段段追加进读缓冲区，每段之后解析一次，模拟一个请求分多次读到。
+// 返回最后一次解析的结果，数据用完还不完整时是NO_REQUEST
+static HttpRequest::HTTP_CODE ParseInSteps(HttpRequest& request, Buffer& buff, const std::string& raw, size_t step) {
+    HttpRequest::HTTP_CODE ret = HttpRequest::NO_REQUEST;
+    for(size_t i = 0; i < raw.size(); i += step) {
+        buff.Append(raw.data() + i, std::min(step, raw.size() - i));
+        ret = request.parse(buff);
+        if(ret != HttpRequest::NO_REQUEST) { break; }
+    }
+    return ret;
+}
+
+static HttpRequest::HTTP_CODE ParseAll(const std::string& raw) {
+    HttpRequest request;
+    Buffer buff;
+    return ParseInSteps(request, buff, raw, raw.size());
+}
+
+// 请求行和请求头不合法的都按BAD_REQUEST处理，连接上返回400
+void TestParseMalformed() {
+    const char* bad[] = {
+        "GET  / HTTP/1.1\r\nHost: a\r\n\r\n",             // 多一个空格
+        "GET /a b HTTP/1.1\r\nHost: a\r\n\r\n",           // 目标里有空格
+        "G(T / HTTP/1.1\r\nHost: a\r\n\r\n",              // 方法不是token
+        " GET / HTTP/1.1\r\nHost: a\r\n\r\n",             // 以空格开头
+        "GET / HTTP/11\r\nHost: a\r\n\r\n",               // 版本格式
+        "GET / http/1.1\r\nHost: a\r\n\r\n",
+        "GET / HTTP/1.1 \r\nHost: a\r\n\r\n",
+        "GET /\x01 HTTP/1.1\r\nHost: a\r\n\r\n",          // 控制字符
+        "GET / HTTP/1.1\nHost: a\r\n\r\n",                 // 裸LF
+        "GET / HTTP/1.1\r\n\r\n",                           // HTTP/1.1没有Host
+        "GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\n\r\n",     // 重复的Host
+        "GET / HTTP/1.1\r\nHost : a\r\n\r\n",             // 名字和冒号之间有空白
+        "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n",     // 折行
+        "GET / HTTP/1.1\r\nHost: a\r\nNoColon\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: a\r\n: empty\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: a\r\nX-Bad: a\x7f\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: a\r\nX-Bad: a\rb\r\n\r\n",
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 1x\r\n\r\n",
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: -1\r\n\r\n",
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 2\r\nContent-Length: 3\r\n\r\nab",
+        "GET / HTTP/1.\xb9\r\nHost: a\r\n\r\n",          // 0x80以上的字节不是数字
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 1\xb9\r\n\r\nab",
+    };
+    for(const char* raw: bad) {
+        if(ParseAll(raw) != HttpRequest::BAD_REQUEST) {
+            printf("not rejected: %s\n", raw);
+            assert(false);
+        }
+    }
+    // 请求头太长，还没读到行尾也要拒绝
+    std::string huge = "GET / HTTP/1.1\r\nHost: a\r\nX-Long: " + std::string(HttpRequest::MAX_HEADER_BYTES, 'x');
+    assert(ParseAll(huge) == HttpRequest::BAD_REQUEST);
+    // 完整的请求头一次读到，一个超长的字段或很多小字段加起来超过上限
+    assert(ParseAll(huge + "\r\n\r\n") == HttpRequest::BAD_REQUEST);
+    std::string many = "GET / HTTP/1.1\r\nHost: a\r\n";
+    while(many.size() <= HttpRequest::MAX_HEADER_BYTES) { many += "X-Field: 0123456789\r\n"; }
+    assert(ParseAll(many + "\r\n") == HttpRequest::BAD_REQUEST);
+    // 上限以内的照常接受
+    std::string big = "GET / HTTP/1.1\r\nHost: a\r\nX-Long: " + std::string(HttpRequest::MAX_HEADER_BYTES / 2, 'x') + "\r\n\r\n";
+    assert(ParseAll(big) == HttpRequest::GET_REQUEST);
+
+    bool keepAlive = true;
+    std::string out = Roundtrip("GET / HTTP/1.1\r\nHost : a\r\n\r\n", &keepAlive);
+    assert(out.compare(0, 12, "HTTP/1.1 400") == 0);
+    assert(!keepAlive);
+    printf("TestParseMalformed ok\n");
+}
+
+// 请求在任意一个字节处断开，下次读到后接着解析，结果和一次读到完全一样
+void TestParseSplit() {
+    const std::string raw =
+        "\r\nPOST /login?x=1 HTTP/1.1\r\n"
+        "Host: example.com\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "X-Trim: \t spaced value \t\r\n"
+        "Content-Length: 27\r\n"
+        "\r\n"
+        "username=tom&password=12345"
+        "GET /next HTTP/1.1\r\nHost: example.com\r\n\r\n";
+    for(size_t cut = 1; cut < raw.size(); cut++) {
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(raw.data(), cut);
+        HttpRequest::HTTP_CODE ret = request.parse(buff);
+        // 第一个请求完整之前都是NO_REQUEST
+        bool rest = ret == HttpRequest::NO_REQUEST;
+        if(rest) {
+            buff.Append(raw.data() + cut, raw.size() - cut);
+            ret = request.parse(buff);
+        }
+        assert(ret == HttpRequest::GET_REQUEST);
+        assert(request.method() == "POST" && request.path() == "/login?x=1" && request.version() == "1.1");
+        assert(request.GetHeader(HttpRequest::HOST) == "example.com");
+        assert(request.GetHeader("X-Trim") == "spaced value");
+        assert(request.body() == "username=tom&password=12345");
+        assert(request.GetPost("username") == "tom" && request.GetPost("password") == "12345");
+        assert(request.IsKeepAlive());
+        // 第二个请求紧跟在读缓冲区里。请求头指向读缓冲区，检查完再追加
+        if(!rest) {
+            buff.Append(raw.data() + cut, raw.size() - cut);
+        }
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+        assert(request.method() == "GET" && request.path() == "/next");
+        assert(buff.ReadableBytes() == 0);
+    }
+    // 逐字节到达
+    HttpRequest request;
+    Buffer buff;
+    assert(ParseInSteps(request, buff, raw, 1) == HttpRequest::GET_REQUEST);
+    assert(request.body() == "username=tom&password=12345");
+    printf("TestParseSplit ok\n");
+}
+
+// 请求头的名字不区分大小写，常用请求头按下标取，超过内联个数的也能找到
+void TestHeaderLookup() {
+    std::string raw = "GET / HTTP/1.1\r\nhOsT: a.com\r\nCONNECTION: Close\r\nx-custom-header: v1\r\n";
+    for(int i = 0; i < 40; i++) {
+        raw += "X-Extra-" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+    }
+    raw += "content-length: 0\r\n\r\n";
+    HttpRequest request;
+    Buffer buff;
+    assert(ParseInSteps(request, buff, raw, raw.size()) == HttpRequest::GET_REQUEST);
+    assert(request.HeaderCount() == 44);
+    assert(request.HasHeader(HttpRequest::HOST) && request.GetHeader(HttpRequest::HOST) == "a.com");
+    assert(request.GetHeader("Host") == "a.com" && request.GetHeader("HOST") == "a.com");
+    assert(request.GetHeader("X-Custom-Header") == "v1" && request.GetHeader("X-CUSTOM-HEADER") == "v1");
+    assert(request.GetHeader("x-extra-0") == "0" && request.GetHeader("X-EXTRA-39") == "39");
+    assert(request.GetHeader(HttpRequest::CONTENT_LENGTH) == "0");
+    assert(request.GetHeader("X-Missing").empty() && !request.HasHeader(HttpRequest::COOKIE));
+    // Connection的值也不区分大小写
+    assert(!request.IsKeepAlive());
+    printf("TestHeaderLookup ok\n");
+}
+
+// 分块传输: 解码后的请求体和一次收到Content-Length长的请求体一样
+void TestChunkedBody() {
+    const std::string head = "POST /echo HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n";
+    // 块扩展忽略，尾部字段不使用，后面紧跟下一个请求
+    const std::string raw = head +
+        "5;name=value\r\nhello\r\n"
+        "1c ; ext\r\n, chunked bodies are decoded\r\n"
+        "0\r\nX-Trailer: t\r\nX-Other: o\r\n\r\n"
+        "GET /next HTTP/1.1\r\nHost: a\r\n\r\n";
+    const std::string body = "hello, chunked bodies are decoded";
+    // 块大小行、块数据、尾部字段在任意一个字节处断开
+    for(size_t cut = 1; cut < raw.size(); cut++) {
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(raw.data(), cut);
+        HttpRequest::HTTP_CODE ret = request.parse(buff);
+        if(ret == HttpRequest::NO_REQUEST) {
+            buff.Append(raw.data() + cut, raw.size() - cut);
+            ret = request.parse(buff);
+        } else {
+            buff.Append(raw.data() + cut, raw.size() - cut);
+        }
+        assert(ret == HttpRequest::GET_REQUEST);
+        assert(request.body() == body);
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.path() == "/next");
+    }
+    {
+        HttpRequest request;
+        Buffer buff;
+        assert(ParseInSteps(request, buff, raw, 1) == HttpRequest::GET_REQUEST);
+        assert(request.body() == body);
+    }
+
+    const char* bad[] = {
+        "zz\r\nhello\r\n0\r\n\r\n",                  // 不是十六进制
+        "\r\nhello\r\n0\r\n\r\n",                    // 没有块大小
+        "5x\r\nhello\r\n0\r\n\r\n",
+        "-5\r\nhello\r\n0\r\n\r\n",
+        "1000000000000000\r\n",                        // 16位十六进制，会溢出
+        "3\r\nhello\r\n0\r\n\r\n",                   // 块数据比块大小长
+        "5\nhello\r\n0\r\n\r\n",                      // 裸LF
+    };
+    for(const char* chunks: bad) {
+        if(ParseAll(head + chunks) != HttpRequest::BAD_REQUEST) {
+            printf("not rejected: %s\n", chunks);
+            assert(false);
+        }
+    }
+    // 块大小行太长
+    assert(ParseAll(head + "5;" + std::string(HttpRequest::MAX_CHUNK_LINE, 'x')) == HttpRequest::BAD_REQUEST);
+
+    // 和Content-Length同时出现，两边对长度的理解可能不一致，拒绝
+    assert(ParseAll("POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"
+                    "5\r\nhello\r\n0\r\n\r\n") == HttpRequest::BAD_REQUEST);
+    assert(ParseAll("POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n"
+                    "5\r\nhello\r\n0\r\n\r\n") == HttpRequest::BAD_REQUEST);
+    // Transfer-Encoding只接受一个字段、值只能是chunked，否则前后两边可能按不同的编码理解请求体
+    const char* badEncodings[] = {
+        "Transfer-Encoding: gzip\r\n",
+        "Transfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n",
+        "Transfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n",
+        "Transfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n",
+        "Transfer-Encoding: gzip, chunked\r\n",
+        "Transfer-Encoding: chunked, chunked\r\n",
+        "Transfer-Encoding: chunked;q=1\r\n",
+        "Transfer-Encoding:\r\n",
+    };
+    for(const char* te: badEncodings) {
+        if(ParseAll(std::string("POST / HTTP/1.1\r\nHost: a\r\n") + te + "\r\n5\r\nhello\r\n0\r\n\r\n")
+           != HttpRequest::BAD_REQUEST) {
+            printf("not rejected: %s\n", te);
+            assert(false);
+        }
+    }
+    assert(ParseAll("POST / HTTP/1.1\r\nHost: a\r\ntransfer-encoding: Chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n")
+           == HttpRequest::GET_REQUEST);
+
+    // 请求体上限: Content-Length在请求头里就拒绝，分块的累计超过时拒绝
+    size_t oldMax = HttpRequest::maxBodySize;
+    HttpRequest::maxBodySize = 16;
+    assert(ParseAll("POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 16\r\n\r\n" + std::string(16, 'x'))
+           == HttpRequest::GET_REQUEST);
+    assert(ParseAll("POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 17\r\n\r\n") == HttpRequest::BAD_REQUEST);
+    assert(ParseAll(head + "8\r\n12345678\r\n8\r\n12345678\r\n0\r\n\r\n") == HttpRequest::GET_REQUEST);
+    assert(ParseAll(head + "8\r\n12345678\r\n9\r\n") == HttpRequest::BAD_REQUEST);
+    {
+        // 块大小在上限以内、累计超过，逐字节到达时也在第一块超出的地方就停下
+        HttpRequest request;
+        Buffer buff;
+        assert(ParseInSteps(request, buff, head + "10\r\n1234567890abcdef\r\n1\r\nx\r\n0\r\n\r\n", 1)
+               == HttpRequest::BAD_REQUEST);
+    }
+    HttpRequest::maxBodySize = oldMax;
+    printf("TestChunkedBody ok\n");
+}
+
+// 路由: 精确段优先于参数段，参数段优先于前缀，具体方法优先于"*"，走不通时回退
+void TestRouter() {
+    Router router;
+    std::string hit;
+    auto route = [&hit](const char* name) {
+        return [&hit, name](HttpRequest& request, const RouteParams& params) {
+            hit = name;
+            for(const char* key: {"id", "name", "*"}) {
+                std::string_view value = params.Get(key);
+                if(!value.empty()) { hit += std::string(" ") + key + "=" + std::string(value); }
+            }
+        };
+    };
+    router.Add("GET", "/user/me", route("me"));
+    router.Add("GET", "/user/:id", route("user"));
+    router.Add("GET", "/user/:id/posts", route("posts"));
+    router.Add("POST", "/user/:id", route("update"));
+    router.Add("*", "/static/*", route("static"));
+    router.Add("GET", "/static/special", route("special"));
+    router.Add("*", "/", route("root"));
+
+    auto dispatch = [&router, &hit](const std::string& method, const std::string& path) {
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(method + " " + path + " HTTP/1.1\r\nHost: a\r\n\r\n");
+        HttpRequest::HTTP_CODE ret = request.parse(buff);
+        assert(ret == HttpRequest::GET_REQUEST);
+        (void)ret;
+        hit.clear();
+        return router.Dispatch(request) ? hit : std::string("none");
+    };
+    assert(dispatch("GET", "/user/me") == "me");
+    assert(dispatch("GET", "/user/42") == "user id=42");
+    assert(dispatch("GET", "/user/42?tab=1") == "user id=42");
+    assert(dispatch("GET", "/user/42/posts") == "posts id=42");
+    assert(dispatch("POST", "/user/42") == "update id=42");
+    assert(dispatch("DELETE", "/user/42") == "none");
+    assert(dispatch("GET", "/user/42/other") == "none");
+    assert(dispatch("GET", "/user/") == "none");
+    assert(dispatch("GET", "/static/css/a.css") == "static *=css/a.css");
+    assert(dispatch("PUT", "/static/special") == "static *=special");
+    assert(dispatch("GET", "/static/special") == "special");
+    assert(dispatch("HEAD", "/") == "root");
+    assert(dispatch("GET", "/index.html") == "none");
+    printf("TestRouter ok\n");
+}
+
+// 目录里的文件数
+static size_t FileCount(const std::string& dir) {
+    size_t n = 0;
+    DIR* d = opendir(dir.c_str());
+    assert(d);
+    while(dirent* entry = readdir(d)) {
+        if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) { n++; }
+    }
+    closedir(d);
+    return n;
+}
+
+static std::string ReadFile(const std::string& path) {
+    std::string data;
+    int fd = open(path.c_str(), O_RDONLY);
+    assert(fd >= 0);
+    char buf[4096];
+    ssize_t len;
+    while((len = read(fd, buf, sizeof(buf))) > 0) { data.append(buf, len); }
+    close(fd);
+    return data;
+}
+
+// multipart上传走注册的POST /upload路由: 文件写进临时文件，字段用GetPost取，
+// 分隔符跨读断开、中途中止和超过上限时临时文件都要删掉
+void TestUpload() {
+    char dirTemplate[] = "/tmp/webserver-test-XXXXXX";
+    char* made = mkdtemp(dirTemplate);
+    assert(made);
+    (void)made;
+    const std::string dir = dirTemplate;
+    std::string oldTmpDir = FormUpload::tmpDir;
+    size_t oldMax = HttpRequest::maxStreamBodySize;
+    FormUpload::tmpDir = dir;
+    {
+        // 默认不注册上传路由，请求体也就不会写进临时文件
+        Router router;
+        Routes::Register(&router);
+        HttpRequest request;
+        Buffer buff;
+        buff.Append("POST /upload HTTP/1.1\r\nHost: a\r\n\r\n");
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+        assert(!router.Dispatch(request) && !router.MakeBodyHandler(request));
+    }
+    Router router;
+    Routes::Register(&router, true);
+    HttpRequest::bodyHandlerFactory = [&router](HttpRequest& request) { return router.MakeBodyHandler(request); };
+
+    const std::string boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+    // 文件内容里有和分隔符很像的字节: 分隔符的前缀、前面没有CRLF的boundary
+    const std::string file1 = "first file\r\n--" + boundary.substr(0, 20) + "\r\n\r\nx--" + boundary + "\r\n-";
+    const std::string file2(3000, 'z');
+    const std::string body =
+        "preamble is ignored\r\n"
+        "--" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+        "hello world\r\n"
+        "--" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"a\"; filename=\"a.txt\"\r\n"
+        "Content-Type: text/plain\r\n\r\n" + file1 + "\r\n"
+        "--" + boundary + "\r\n"
+        "content-disposition: form-data; name=\"b\"; filename=\"dir/\\\"b\\\".bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n" + file2 + "\r\n"
+        "--" + boundary + "--\r\n";
+    const std::string head = "POST /upload HTTP/1.1\r\nHost: a\r\n"
+        "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    const std::string raw = head + body;
+
+    auto check = [&](HttpRequest& request) {
+        assert(request.GetPost("title") == "hello world");
+        assert(request.body().empty());
+        std::vector<UploadFile>& files = request.files();
+        assert(files.size() == 2);
+        assert(files[0].name == "a" && files[0].filename == "a.txt" && files[0].contentType == "text/plain");
+        assert(files[0].size == file1.size() && ReadFile(files[0].path) == file1);
+        assert(files[1].name == "b" && files[1].filename == "dir/\"b\".bin");
+        assert(files[1].size == file2.size() && ReadFile(files[1].path) == file2);
+        assert(FileCount(dir) == 2);
+        assert(router.Dispatch(request) && request.path() == "/welcome.html");
+        // 响应生成后删除
+        request.RemoveUploads();
+        assert(FileCount(dir) == 0);
+    };
+
+    // 在任意一个字节处断开: 分隔符、部分的头部、文件内容都会跨两次读
+    for(size_t cut = head.size(); cut < raw.size(); cut++) {
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(raw.data(), cut);
+        assert(request.parse(buff) == HttpRequest::NO_REQUEST);
+        buff.Append(raw.data() + cut, raw.size() - cut);
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+        check(request);
+    }
+    {
+        // 逐字节到达，读缓冲区里留下的最多是一行或分隔符长的尾巴
+        HttpRequest request;
+        Buffer buff;
+        HttpRequest::HTTP_CODE ret = HttpRequest::NO_REQUEST;
+        for(size_t i = 0; i < raw.size() && ret == HttpRequest::NO_REQUEST; i++) {
+            buff.Append(raw.data() + i, 1);
+            ret = request.parse(buff);
+            assert(buff.ReadableBytes() <= head.size() + MultipartParser::MAX_PART_HEADER);
+        }
+        assert(ret == HttpRequest::GET_REQUEST);
+        check(request);
+    }
+    {
+        // 连接中途断开: 已经完成的和正在写的临时文件都删掉
+        HttpRequest request;
+        Buffer buff;
+        size_t cut = raw.find(file2) + 1000;
+        buff.Append(raw.data(), cut);
+        assert(request.parse(buff) == HttpRequest::NO_REQUEST);
+        assert(FileCount(dir) == 2);
+        request.Init();
+        assert(FileCount(dir) == 0);
+        // 请求对象析构时一样
+        {
+            HttpRequest other;
+            Buffer more;
+            more.Append(raw.data(), cut);
+            assert(other.parse(more) == HttpRequest::NO_REQUEST);
+            assert(FileCount(dir) == 2);
+        }
+        assert(FileCount(dir) == 0);
+    }
+    {
+        // 没有选文件的文件框: filename=""的部分整个跳过，不建临时文件，也不算上传了文件
+        const std::string empty =
+            "--" + boundary + "\r\n"
+            "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+            "hi\r\n"
+            "--" + boundary + "\r\n"
+            "Content-Disposition: form-data; name=\"a\"; filename=\"\"\r\n"
+            "Content-Type: application/octet-stream\r\n\r\n"
+            "\r\n"
+            "--" + boundary + "--\r\n";
+        const std::string emptyRaw = "POST /upload HTTP/1.1\r\nHost: a\r\n"
+            "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n"
+            "Content-Length: " + std::to_string(empty.size()) + "\r\n\r\n" + empty;
+        for(size_t step: { emptyRaw.size(), static_cast<size_t>(7), static_cast<size_t>(1) }) {
+            HttpRequest request;
+            Buffer buff;
+            assert(ParseInSteps(request, buff, emptyRaw, step) == HttpRequest::GET_REQUEST);
+            assert(request.GetPost("title") == "hi");
+            assert(request.files().empty() && FileCount(dir) == 0);
+            assert(router.Dispatch(request) && request.path() == "/error.html");
+        }
+    }
+    {
+        // 格式错误(没有结束分隔符)按400处理，临时文件随请求释放
+        std::string truncated = body.substr(0, body.rfind("--" + boundary + "--"));
+        std::string bad = "POST /upload HTTP/1.1\r\nHost: a\r\n"
+            "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n"
+            "Content-Length: " + std::to_string(truncated.size()) + "\r\n\r\n" + truncated;
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(bad);
+        assert(request.parse(buff) == HttpRequest::BAD_REQUEST);
+        request.Init();
+        assert(FileCount(dir) == 0);
+    }
+    {
+        // 超过上传上限: Content-Length在请求头里就拒绝，还没有建临时文件
+        HttpRequest::maxStreamBodySize = body.size() - 1;
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(raw);
+        assert(request.parse(buff) == HttpRequest::BAD_REQUEST);
+        assert(FileCount(dir) == 0);
+        // 分块传输时收到超出的那一块才知道，已经写的文件删掉
+        std::string chunked = "POST /upload HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+            "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n\r\n";
+        size_t half = body.size() / 2;
+        char size[32];
+        snprintf(size, sizeof(size), "%zx\r\n", half);
+        chunked += size + body.substr(0, half) + "\r\n";
+        snprintf(size, sizeof(size), "%zx\r\n", body.size() - half);
+        chunked += size + body.substr(half) + "\r\n0\r\n\r\n";
+        HttpRequest other;
+        Buffer more;
+        assert(ParseInSteps(other, more, chunked, 64) == HttpRequest::BAD_REQUEST);
+        other.Init();
+        assert(FileCount(dir) == 0);
+        // 在上限以内的分块上传正常
+        HttpRequest::maxStreamBodySize = body.size();
+        HttpRequest ok;
+        Buffer okBuff;
+        assert(ParseInSteps(ok, okBuff, chunked, 64) == HttpRequest::GET_REQUEST);
+        check(ok);
+    }
+
+    HttpRequest::maxStreamBodySize = oldMax;
+    HttpRequest::bodyHandlerFactory = nullptr;
+    FormUpload::tmpDir = oldTmpDir;
+    rmdir(dir.c_str());
+    printf("TestUpload ok\n");
+}
+
+/* ---------------- JSON ---------------- */
+
+static bool JsonOk(std::string_view text) {
+    JsonDoc doc;
+    return doc.Parse(text);
+}
+
+// 合法与不合法的文档
+void TestJsonParse() {
+    const char* good[] = {
+        "0", "-0", "1.5", "-1.25e+10", "1E-2", "1e5", "123456789012345678901234567890",
+        "true", "false", "null", "\"\"", "\"a\\\"b\"", "\"\\/\\b\\f\\n\\r\\t\\\\\"", "\"\\u00e9\\uD83D\\uDE00\"",
+        "\"\\ud800\"", "\"\x7f\xe4\xb8\xad\"", "[]", "{}", " \t\r\n[ ]\n", "[1,[2,[3]],{}]",
+        "{\"a\":{\"b\":[]},\"a\":1}", "{ \"k\" : \"v\" , \"n\" : null }",
+    };
+    for(const char* text: good) {
+        if(!JsonOk(text)) {
+            printf("not accepted: %s\n", text);
+            assert(false);
+        }
+    }
+    const char* bad[] = {
+        "", "  ", "[1,]", "{\"a\":1,}", "[,1]", "{,}", "[1 2]", "{\"a\" 1}", "{\"a\":}", "{1:2}", "{'a':1}",
+        "[1]]", "[[1]", "{\"a\":1", "[1] x", "1 2", "tru", "nul", "nulll", "True",
+        // 数字
+        "01", "-01", "1.", ".5", "-", "+1", "1e", "1e+", "0x10", "1.e3", "--1", "NaN", "Infinity",
+        // 字符串: 没结束、坏的转义、没转义的控制字符
+        "\"abc", "\"\\x\"", "\"\\u12G4\"", "\"\\u12\"", "\"\\\"", "\"a\tb\"", "\"a\nb\"", "\"\\'\"",
+    };
+    for(const char* text: bad) {
+        if(JsonOk(text)) {
+            printf("not rejected: %s\n", text);
+            assert(false);
+        }
+    }
+    // 转义后面是NUL字节
+    assert(!JsonOk(std::string_view("\"\\\0\"", 4)));
+    assert(!JsonOk(std::string_view("[1,\0]", 5)));
+
+    // 嵌套层数上限
+    std::string deep = std::string(JsonDoc::MAX_DEPTH, '[') + std::string(JsonDoc::MAX_DEPTH, ']');
+    assert(JsonOk(deep));
+    deep = std::string(JsonDoc::MAX_DEPTH + 1, '[') + std::string(JsonDoc::MAX_DEPTH + 1, ']');
+    assert(!JsonOk(deep));
+    std::string deepObj;
+    for(size_t i = 0; i < JsonDoc::MAX_DEPTH; i++) { deepObj += "{\"a\":"; }
+    deepObj += "1" + std::string(JsonDoc::MAX_DEPTH, '}');
+    assert(JsonOk(deepObj));
+
+    // 解析失败后文档为空，同一个文档可以再次解析
+    JsonDoc doc;
+    assert(doc.Parse("[1,2]") && !doc.Empty() && doc.Root().Size() == 2);
+    assert(!doc.Parse("[1,2,]") && doc.Empty() && !doc.Root().IsValid());
+    assert(doc.Parse("\"s\"") && doc.Root().Equals("s"));
+
+    // 数字
+    assert(doc.Parse("[0, -0, 42, -9223372036854775808, 9223372036854775807, 9223372036854775808, 1.5, 1e3, 1e400, -1e400, 2.5e-3]"));
+    JsonValue n = doc.Root();
+    int64_t v = 0;
+    assert(n[0].TryGetInt(&v) && v == 0);
+    assert(n[1].TryGetInt(&v) && v == 0);
+    assert(n[2].GetInt(0) == 42 && n[2].GetDouble() == 42.0);
+    assert(n[3].GetInt(0) == INT64_MIN && n[4].GetInt(0) == INT64_MAX);
+    assert(!n[5].TryGetInt(&v) && n[5].GetInt(-1) == -1 && n[5].GetDouble() == 9223372036854775808.0);
+    assert(!n[6].TryGetInt(&v) && n[6].GetDouble() == 1.5);
+    assert(!n[7].TryGetInt(&v) && n[7].GetDouble() == 1000.0);
+    assert(n[8].GetDouble() == std::numeric_limits<double>::infinity());
+    assert(n[9].GetDouble() == -std::numeric_limits<double>::infinity());
+    assert(n[10].GetDouble() == 2.5e-3 && n[10].Raw() == "2.5e-3");
+    // 类型不对时取默认值
+    assert(doc.Parse("[\"1\", true, null]"));
+    assert(!doc.Root()[0].IsNumber() && doc.Root()[0].GetInt(7) == 7 && doc.Root()[0].GetDouble(2.0) == 2.0);
+    assert(doc.Root()[1].GetBool() && doc.Root()[2].IsNull() && !doc.Root()[2].GetBool(false));
+    printf("TestJsonParse ok\n");
+}
+
+// 取值: 字符串解码、比较，遍历
+void TestJsonValue() {
+    JsonDoc doc;
+    const std::string text =
+        "{\"plain\":\"abc\",\"esc\":\"a\\nb\\\"c\\\\d\\/e\",\"uni\":\"\\u00e9\\u4e2d\\uD83D\\uDE00\","
+        "\"lone\":\"x\\ud800y\\udc00z\\uD83D\\u0041\",\"nul\":\"a\\u0000b\",\"k\\\"ey\":1,"
+        "\"arr\":[1,{\"b\":null,\"c\":[true,false]},[],\"s\"],\"obj\":{},\"dup\":1,\"dup\":2}";
+    assert(doc.Parse(text));
+    JsonValue root = doc.Root();
+    assert(root.IsObject() && root.Size() == 10);
+
+    // 没有转义时GetString就是原文
+    assert(!root["plain"].HasEscape() && root["plain"].GetString() == "abc" && root["plain"].Raw() == "abc");
+    assert(root["esc"].HasEscape() && root["esc"].GetString() == "a\nb\"c\\d/e");
+    assert(root["esc"].Raw() == "a\\nb\\\"c\\\\d\\/e");
+    assert(root["uni"].GetString() == "\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80");
+    // 单独的代理项换成U+FFFD
+    assert(root["lone"].GetString() == "x\xef\xbf\xbdy\xef\xbf\xbdz\xef\xbf\xbd" "A");
+    assert(root["nul"].GetString() == std::string("a\0b", 3));
+
+    // Equals和解码后的值比较，前缀、多一个字节都不相等
+    assert(root["plain"].Equals("abc") && !root["plain"].Equals("ab") && !root["plain"].Equals("abcd"));
+    assert(root["esc"].Equals("a\nb\"c\\d/e"));
+    assert(!root["esc"].Equals("a\nb\"c\\d/") && !root["esc"].Equals("a\nb\"c\\d/ef") && !root["esc"].Equals(""));
+    assert(root["uni"].Equals("\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80"));
+    assert(root["nul"].Equals(std::string_view("a\0b", 3)));
+    assert(!root["arr"].Equals("") && !root["k\"ey"].Equals("1"));
+    // 键里有转义
+    assert(root["k\"ey"].GetInt(0) == 1 && !root["k\\\"ey"].IsValid());
+
+    // 下标和键
+    JsonValue arr = root["arr"];
+    assert(arr.IsArray() && arr.Size() == 4);
+    assert(arr[0].GetInt(0) == 1);
+    assert(arr[1].IsObject() && arr[1]["b"].IsNull() && arr[1]["c"][1].IsValid() && !arr[1]["c"][1].GetBool(true));
+    assert(arr[2].IsArray() && arr[2].Size() == 0 && !arr[2].First().IsValid() && !arr[2][0].IsValid());
+    assert(arr[3].Equals("s") && !arr[4].IsValid());
+    assert(root["obj"].IsObject() && root["obj"].Size() == 0 && !root["obj"].First().IsValid());
+    // 同名的取第一个，找不到、类型不对都得到无效值
+    assert(root["dup"].GetInt(0) == 1);
+    assert(!root["missing"].IsValid() && root["missing"].GetInt(-5) == -5 && root["missing"].GetString().empty());
+    assert(!root[0].IsValid() && !arr["b"].IsValid() && !arr[0][0].IsValid() && !arr[0]["x"].IsValid());
+    assert(!JsonValue().IsValid() && !JsonValue()["a"].IsValid() && !JsonValue().Next().IsValid());
+
+    // First/Next顺序访问，Next跳过整棵子树
+    std::vector<std::string> names;
+    for(JsonValue m = root.First(); m.IsValid(); m = m.Next()) {
+        assert(m.Name().IsString());
+        names.push_back(m.Name().GetString());
+    }
+    const std::vector<std::string> expect = { "plain", "esc", "uni", "lone", "nul", "k\"ey", "arr", "obj", "dup", "dup" };
+    assert(names == expect);
+    int count = 0;
+    for(JsonValue e = arr.First(); e.IsValid(); e = e.Next()) { count++; }
+    assert(count == 4);
+    assert(arr.First().Next().Next().Next().Equals("s") && !arr.First().Name().IsValid());
+    assert(!root.Next().IsValid() && !root.Name().IsValid());
+    // 嵌套对象的最后一个成员之后没有兄弟
+    JsonValue c = arr[1]["c"];
+    assert(arr[1].First().Next().Raw().empty() && arr[1].First().Next().IsArray());
+    assert(!c.Next().IsValid() && c.First().Next().IsValid() && !c.First().Next().Next().IsValid());
+    printf("TestJsonValue ok\n");
+}
+
+// 写出的JSON再解析，值不变
+void TestJsonWriter() {
+    {
+        Buffer buff;
+        JsonWriter w(buff);
+        w.BeginObject().Key("a").Int(1).Key("b").BeginArray().Bool(true).Null().String("x").BeginObject().EndObject()
+         .BeginArray().EndArray().EndArray().Key("c").Bool(false).EndObject();
+        assert(w.Complete());
+        assert(buff.RetrieveAllToStr() == "{\"a\":1,\"b\":[true,null,\"x\",{},[]],\"c\":false}");
+    }
+    const std::string strs[] = {
+        "", "plain", "quote\"back\\slash/", "\b\f\n\r\t", std::string("\x01\x1f\0z", 4), "\x7f", "\xe4\xb8\xad\xf0\x9f\x98\x80",
+        std::string(100, 'x') + "\"" + std::string(40, 'y'),
+    };
+    const int64_t ints[] = { 0, -1, 42, INT64_MIN, INT64_MAX };
+    const double doubles[] = { 0.1, -2.5, 1e300, 5e-324, 123456.789, 3.0 };
+    Buffer buff;
+    JsonWriter w(buff);
+    w.BeginObject();
+    w.Key("strs").BeginArray();
+    for(const std::string& str: strs) { w.String(str); }
+    w.EndArray();
+    w.Key("ints").BeginArray();
+    for(int64_t i: ints) { w.Int(i); }
+    w.EndArray();
+    w.Key("doubles").BeginArray();
+    for(double d: doubles) { w.Double(d); }
+    w.EndArray();
+    // 非有限的浮点数写成null
+    w.Key("inf").Double(std::numeric_limits<double>::infinity());
+    w.Key("nan").Double(std::numeric_limits<double>::quiet_NaN());
+    w.Key("k\"\n").BeginObject().Key("nested").BeginArray().BeginArray().EndArray().EndArray().EndObject();
+    assert(!w.Complete());
+    w.EndObject();
+    assert(w.Complete());
+
+    const std::string text = buff.RetrieveAllToStr();
+    JsonDoc doc;
+    assert(doc.Parse(text));
+    JsonValue root = doc.Root();
+    size_t i = 0;
+    for(JsonValue e = root["strs"].First(); e.IsValid(); e = e.Next(), i++) {
+        assert(e.GetString() == strs[i] && e.Equals(strs[i]));
+    }
+    assert(i == sizeof(strs) / sizeof(strs[0]));
+    for(i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) { assert(root["ints"][i].GetInt(1) == ints[i]); }
+    // to_chars写出最短的能还原的表示
+    for(i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) { assert(root["doubles"][i].GetDouble() == doubles[i]); }
+    assert(root["inf"].IsNull() && root["nan"].IsNull());
+    assert(root["k\"\n"]["nested"][0].IsArray() && root["k\"\n"]["nested"][0].Size() == 0);
+    printf("TestJsonWriter ok\n");
+}
+
+// 请求体是JSON时解析请求就解析好，格式错误按400处理
+void TestJsonRequest() {
+    auto post = [](const std::string& type, const std::string& body) {
+        return "POST /api HTTP/1.1\r\nHost: a\r\nContent-Type: " + type + "\r\nContent-Length: " +
+               std::to_string(body.size()) + "\r\n\r\n" + body;
+    };
+    const char* bad[] = { "{\"a\":1,}", "{\"a\":1", "[1 2]", "\"\\x\"", "{\"a\":01}", "nul" };
+    for(const char* body: bad) {
+        assert(ParseAll(post("application/json", body)) == HttpRequest::BAD_REQUEST);
+    }
+    // 带参数、大小写不同和+json后缀的都当JSON
+    assert(ParseAll(post("Application/JSON; charset=utf-8", "[,]")) == HttpRequest::BAD_REQUEST);
+    assert(ParseAll(post("application/problem+json", "{")) == HttpRequest::BAD_REQUEST);
+    // 不是JSON的类型不解析
+    assert(ParseAll(post("text/plain", "{")) == HttpRequest::GET_REQUEST);
+
+    // 请求在任意字节处断开，解析结果一样
+    const std::string raw = post("application/json", "{\"name\":\"w\\u00e9b\",\"ids\":[1,2,3]}");
+    for(size_t step = 1; step <= raw.size(); step++) {
+        HttpRequest request;
+        Buffer buff;
+        assert(ParseInSteps(request, buff, raw, step) == HttpRequest::GET_REQUEST);
+        assert(request.IsJson());
+        JsonValue json = request.Json();
+        assert(json["name"].Equals("w\xc3\xa9" "b") && json["ids"].Size() == 3 && json["ids"][2].GetInt(0) == 3);
+    }
+    // 没有请求体时不解析
+    {
+        HttpRequest request;
+        Buffer buff;
+        std::string empty = "POST /api HTTP/1.1\r\nHost: a\r\nContent-Type: application/json\r\nContent-Length: 0\r\n\r\n";
+        assert(ParseInSteps(request, buff, empty, empty.size()) == HttpRequest::GET_REQUEST);
+        assert(!request.Json().IsValid());
+    }
+
+    bool keepAlive = true;
+    std::string out = Roundtrip(post("application/json", "{\"a\":[1,}"), &keepAlive);
+    assert(out.compare(0, 12, "HTTP/1.1 400") == 0);
+    assert(!keepAlive);
+    printf("TestJsonRequest ok\n");
+}
+
+/* ---------------- 从反应堆 ---------------- */
+
+// 从fd一直读到收齐n个响应(按Content-length算)，对端关闭时提前返回，closed置true
+static std::string ReadResponses(int fd, int n, bool* closed) {
+    std::string out;
+    size_t pos = 0;
+    char buf[65536];
+    *closed = false;
+    while(n > 0) {
+        size_t end = out.find("\r\n\r\n", pos);
+        if(end != std::string::npos) {
+            size_t cl = out.find("Content-length: ", pos);
+            assert(cl != std::string::npos && cl < end);
+            size_t total = end + 4 + atoi(out.c_str() + cl + 16);
+            if(out.size() >= total) {
+                pos = total;
+                n--;
+                continue;
+            }
+        }
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if(len < 0 && errno == EINTR) { continue; }
+        if(len <= 0) {
+            *closed = true;
+            break;
+        }
+        out.append(buf, len);
+    }
+    return out;
+}
+
+static void WriteAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t len = write(fd, data.data() + sent, data.size() - sent);
+        if(len < 0 && errno == EINTR) { continue; }
+        assert(len > 0);
+        sent += len;
+    }
+}
+
+// rcvBuf不为0时把客户端的接收缓冲区调小，服务端很快就写满
+static int ConnectTo(int port, int rcvBuf = 0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(rcvBuf > 0) { setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)); }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int ret = connect(fd, (sockaddr*)&addr, sizeof(addr));
+    assert(ret == 0);
+    (void)ret;
+    // 出错时不要一直卡在read上。设了超时的阻塞读写会被io_uring退出时发给本线程的通知打断(EINTR)，
+    // 读写处都要重试
+    timeval tv = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+// io_uring的poll后端: EPOLLET只在有新数据到达时通知一次，ModFd重新检查当前状态
+void TestUringPollerEdge() {
+    std::unique_ptr<Poller> poller(Poller::Create(URING_BACKEND));
+    if(strcmp(poller->Name(), "io_uring") != 0) {
+        printf("TestUringPollerEdge skipped\n");
+        return;
+    }
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(ret == 0);
+    (void)ret;
+    poller->AddFd(fds[0], EPOLLIN | EPOLLET);
+    assert(poller->Wait(0) == 0);
+    WriteAll(fds[1], "a");
+    assert(poller->Wait(1000) == 1 && poller->GetEventFd(0) == fds[0]);
+    // 没读走也不再通知
+    assert(poller->Wait(50) == 0);
+    WriteAll(fds[1], "b");
+    assert(poller->Wait(1000) == 1);
+    assert(poller->Wait(50) == 0);
+    // 和epoll_ctl(MOD)一样，重新注册时数据还在就再通知一次
+    poller->ModFd(fds[0], EPOLLIN | EPOLLET);
+    assert(poller->Wait(1000) == 1);
+    assert(poller->Wait(50) == 0);
+    // 水平触发的没读走会一直通知
+    poller->ModFd(fds[0], EPOLLIN);
+    assert(poller->Wait(1000) == 1);
+    assert(poller->Wait(1000) == 1);
+    poller->DelFd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    printf("TestUringPollerEdge ok\n");
+}
+
+// io_uring完成语义的从反应堆: multishot accept/recv、sendmsg、sendfile等可写、异步关闭
+void TestUringReactor() {
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = true;
+    HttpConn::userCount = 0;
+    const int maxFd = 1024;
+    std::unique_ptr<HttpConn[]> users(new HttpConn[maxFd]);
+    ThreadPool blockingPool(1);
+    std::unique_ptr<Reactor> reactor(Reactor::Create(0, 60000, EPOLLRDHUP | EPOLLET, users.get(), maxFd,
+                                                     &blockingPool, URING_BACKEND));
+    if(strcmp(reactor->Name(), "io_uring(completion)") != 0) {
+        printf("TestUringReactor skipped: %s\n", reactor->Name());
+        return;
+    }
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    // 连接继承监听套接字的发送缓冲区，调小了大响应发不完，要分多次发
+    int sndBuf = 16 << 10;
+    setsockopt(listenFd, SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int ret = bind(listenFd, (sockaddr*)&addr, sizeof(addr));
+    assert(ret == 0);
+    ret = listen(listenFd, 16);
+    assert(ret == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd, (sockaddr*)&addr, &len);
+    int port = ntohs(addr.sin_port);
+    reactor->SetListenFd(listenFd, EPOLLRDHUP, maxFd);
+    reactor->Start();
+
+    const std::string get11 = "GET /index.html HTTP/1.1\r\nHost: test\r\n\r\n";
+    bool closed = false;
+    int fd = ConnectTo(port);
+    // 流水线的请求一起到，按顺序应答
+    WriteAll(fd, get11 + get11 + get11);
+    std::string out = ReadResponses(fd, 3, &closed);
+    assert(!closed && CountOf(out, "HTTP/1.1 200 OK") == 3);
+
+    // 一个请求分几段到，每段一个recv完成事件
+    for(size_t i = 0; i < get11.size(); i += 7) {
+        WriteAll(fd, get11.substr(i, 7));
+        usleep(1000);
+    }
+    out = ReadResponses(fd, 1, &closed);
+    assert(!closed && CountOf(out, "HTTP/1.1 200 OK") == 1);
+
+    // 大文件走sendfile，客户端接收缓冲区很小又先不读，套接字写满后等可写再接着发
+    const std::string font = ReadFile("../resources/fonts/fontawesome-webfont.svg");
+    assert(font.size() > (256u << 10));
+    int slow = ConnectTo(port, 4096);
+    WriteAll(slow, "GET /fonts/fontawesome-webfont.svg HTTP/1.1\r\nHost: test\r\n\r\n" + get11);
+    usleep(100 * 1000);
+    out = ReadResponses(slow, 2, &closed);
+    assert(!closed && CountOf(out, "HTTP/1.1 200 OK") == 2);
+    assert(out.find(font) != std::string::npos);
+    close(slow);
+
+    // 上千个流水线请求一次写过去，读缓冲区到高水位暂停接收，发完一批再接着收
+    const int many = 5000;
+    std::string batch;
+    for(int i = 0; i < many; i++) { batch += get11; }
+    assert(batch.size() > HttpConn::READ_HIGH_WATER);
+    std::thread writer([fd, &batch] { WriteAll(fd, batch); });
+    out = ReadResponses(fd, many, &closed);
+    writer.join();
+    assert(!closed && CountOf(out, "HTTP/1.1 200 OK") == static_cast<size_t>(many));
+
+    // Connection: close应答后由反应堆关闭
+    WriteAll(fd, "GET /index.html HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n");
+    out = ReadResponses(fd, 2, &closed);
+    assert(closed && CountOf(out, "HTTP/1.1 200 OK") == 1);
+    close(fd);
+
+    // 主反应堆转交的连接
+    int fds[2];
+    ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(ret == 0);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) & ~O_NONBLOCK);
+    timeval tv = { 5, 0 };
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    reactor->AddConn(fds[0], sockaddr_in());
+    WriteAll(fds[1], get11);
+    out = ReadResponses(fds[1], 1, &closed);
+    assert(!closed && CountOf(out, "HTTP/1.1 200 OK") == 1);
+    // 对端关闭后反应堆关闭连接、释放槽位
+    close(fds[1]);
+    for(int i = 0; i < 500 && HttpConn::userCount > 0; i++) { usleep(1000); }
+    assert(HttpConn::userCount == 0);
+
+    // 停止时还开着的连接也要关掉
+    fd = ConnectTo(port);
+    WriteAll(fd, get11);
+    out = ReadResponses(fd, 1, &closed);
+    assert(!closed && HttpConn::userCount == 1);
+    reactor.reset();
+    assert(HttpConn::userCount == 0);
+    char c;
+    ssize_t n;
+    while((n = read(fd, &c, 1)) < 0 && errno == EINTR) {}
+    assert(n == 0);
+    close(fd);
+    (void)ret;
+    (void)n;
+    printf("TestUringReactor ok\n");
+}
+
 int main() {
+    TestHttpScan();
+    TestPipeline();
+    TestParseMalformed();
+    TestParseSplit();
+    TestHeaderLookup();
+    TestChunkedBody();
+    TestRouter();
+    TestUpload();
+    TestJsonParse();
+    TestJsonValue();
+    TestJsonWriter();
+    TestJsonRequest();
+    TestUringPollerEdge();
+    TestUringReactor();
+    TestTask();
+    TestMpmcRing();
+    TestWorkStealingPool();
+    TestThreadPoolElastic();
+    TestBufferPool();
+    TestOutputChain();
+    TestReadSizer();
     TestLog();
     TestThreadPool();
 }
\ No newline at end of file